@@ -0,0 +1,27 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include "scene.h"
+
+// Flattened BVH node, laid out to match the std430 BvhNode in fragment.glsl.
+// Interior node (count == 0): left child is the next node, right child is
+// nodes[left_first]. Leaf: spheres prim_indices[left_first .. left_first + count).
+struct BvhNode
+{
+    float bmin[3];
+    int left_first;
+    float bmax[3];
+    int count;
+};
+
+struct Bvh
+{
+    std::vector<BvhNode> nodes;
+    std::vector<int> prim_indices;
+};
+
+// Binned-SAH BVH over every sphere in the scene
+void buildBvh(const Scene &scene, Bvh &bvh);
+
+#endif // BVH_H
@@ -0,0 +1,217 @@
+#ifndef CPU_TRACER_H
+#define CPU_TRACER_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "bvh.h"
+#include "environment.h"
+#include "path_guiding.h"
+#include "photon_map.h"
+#include "rng.h"
+#include "scene.h"
+
+// Pinhole / thin-lens camera, same parameters as the shader's camera uniforms
+struct CpuCamera
+{
+    vec3 origin = vec3(0.0f, 0.0f, 3.0f);
+    vec3 lookAt = vec3(0.0f, 0.0f, 0.0f);
+    vec3 up = vec3(0.0f, 1.0f, 0.0f);
+    float fov = 20.0f; // vertical, degrees
+    float focusDist = 10.0f;
+    float defocusAngle = 0.0f;
+};
+
+// Per-pixel running sums, top row first
+struct Film
+{
+    int width = 0;
+    int height = 0;
+    int spp = 0; // passes rendered
+    std::vector<vec3> sum;
+
+    // Per pixel: samples taken, and the running mean and sum of squared
+    // deviations of their luminance (Welford's algorithm)
+    std::vector<int> samples;
+    std::vector<float> mean;
+    std::vector<float> m2;
+
+    // Pixels the next pass samples, in scanline order (all after resize/clear)
+    std::vector<uint32_t> active;
+
+    // BDPT light tracing splats of the pass in progress, one buffer per
+    // worker; kept between passes and zeroed as they are merged
+    std::vector<std::vector<vec3>> splats;
+
+    void resize(int w, int h);
+    void clear();
+    void add(size_t pixel, const vec3 &c); // one camera sample
+    std::vector<vec3> image() const;        // sum / samples
+
+    // Estimated relative squared error of a pixel's mean, var / n / (mean^2 + 0.01),
+    // i.e. its expected share of the bench's relMSE (infinite below two samples)
+    float error(size_t pixel) const;
+    float meanError() const; // over all pixels
+
+    // Keep in active only the pixels with an error above threshold, or fewer
+    // than minSamples samples, and their 8 neighbours (a neighbour still
+    // converging hints at variance this pixel's samples have missed).
+    // Returns the number of active pixels.
+    size_t updateActive(float threshold, int minSamples);
+
+    // Debug view: samples per pixel on a black-red-yellow-white ramp, white
+    // being the most sampled pixel
+    std::vector<vec3> sampleMap() const;
+};
+
+// Run fn(row) for rows [0, rows) on count threads (0 = all cores)
+void parallelRows(int rows, int count, const std::function<void(int)> &fn);
+
+// The same, also passing which worker runs the row, in [0, workerCount()),
+// e.g. to pick a thread-local buffer
+int workerCount(int rows, int count);
+void parallelRowsWithWorker(int rows, int count, const std::function<void(int, int)> &fn);
+
+// Limits for CpuTracer::renderToBudget; 0 = none. Rendering stops at the
+// first limit reached.
+struct RenderBudget
+{
+    double seconds = 0.0; // wall clock; a pass is only started if it should finish in time
+    float error = 0.0f;   // Film::meanError(), checked once the film has 16 passes
+    int spp = 0;          // passes on the film
+};
+
+struct RenderReport
+{
+    int spp = 0;          // passes on the film
+    double samples = 0.0; // mean samples per pixel (fewer than spp with adaptive sampling)
+    double seconds = 0.0;
+    float error = 0.0f;   // Film::meanError() of the result
+};
+
+// CPU integrators
+enum Integrator
+{
+    INTEGRATOR_PATH, // the shader's unidirectional path tracer
+    INTEGRATOR_BDPT, // bidirectional path tracing
+};
+
+// Offline path tracer for the sphere scenes: the shader's integrator (same
+// materials, sky, NEE with MIS, environment sampling) on the CPU, with
+// jittered pixel samples, multithreading, optional path guiding and an
+// optional caustic photon pass. Alternatively renders by bidirectional
+// path tracing (see integrator).
+class CpuTracer
+{
+public:
+    explicit CpuTracer(const Scene &scene, const Environment *env = nullptr);
+
+    CpuCamera camera;
+    int maxDepth = 6;
+    int threadCount = 0;
+
+    // INTEGRATOR_BDPT traces a camera and a light subpath per pixel and
+    // combines every connection strategy with the power heuristic; light
+    // tracing splats go to per-thread buffers merged after the pass. The
+    // emissive spheres are the light subpaths' sources; sky light is left to
+    // the camera subpath (hits and environment NEE, as in the path mode).
+    // Glass and metal vertices cannot be connected to (metal's fuzz lobe has
+    // no density). The camera is treated as a pinhole. Guiding and caustic
+    // photons only apply to INTEGRATOR_PATH.
+    Integrator integrator = INTEGRATOR_PATH;
+
+    // Guided bounces at Lambertian vertices once guide->ready(); with
+    // recordGuide every Lambertian vertex feeds the guide's current iteration
+    PathGuide *guide = nullptr;
+    bool recordGuide = false;
+
+    // Caustics by photon mapping: with causticPhotons > 0 each pass first
+    // shoots that many photons from the emitters and the sky at the glass and
+    // metal spheres and keeps those that reach a diffuse surface through
+    // them. Paths gather the photons at their diffuse vertices instead of
+    // following glass/metal chains from there to a light. The gather
+    // radius starts at causticRadius and shrinks with every pass of the film
+    // (progressive photon mapping), so the estimate converges.
+    int causticPhotons = 0;
+    float causticRadius = 0.05f;
+
+    // Adaptive sampling: with adaptiveThreshold > 0, each pass first narrows
+    // film.active to the pixels whose error (Film::error) is still above it,
+    // once they have adaptiveMinSamples, and then samples only those, handing
+    // them to the threads in chunks. Converged pixels keep their estimate.
+    // INTEGRATOR_PATH only: BDPT's light subpaths splat onto every pixel.
+    float adaptiveThreshold = 0.0f;
+    int adaptiveMinSamples = 16;
+
+    // One jittered sample for every active pixel of the film (plus, for
+    // BDPT, the light tracing splats of as many light subpaths)
+    void renderPass(Film &film, uint32_t pass) const;
+
+    // Passes until a budget limit is reached (at least one limit must be set).
+    // Pass indices start at firstPass; the film is not cleared first.
+    RenderReport renderToBudget(Film &film, const RenderBudget &budget, uint32_t firstPass = 0) const;
+
+    // Caustic photons for one pass, traced on threadCount threads
+    void emitCausticPhotons(int count, uint32_t pass, std::vector<Photon> &out) const;
+
+    vec3 radiance(vec3 ro, vec3 rd, Rng &rng, const PhotonMap *caustics = nullptr) const;
+    void cameraRay(float px, float py, int width, int height, Rng &rng, vec3 &ro, vec3 &rd) const;
+
+    int intersect(const vec3 &ro, const vec3 &rd, float &t) const; // sphere index or -1
+    bool occluded(const vec3 &ro, const vec3 &rd, float tmax) const;
+
+    // Bounds of everything but ground-sized spheres (for spatial structures)
+    void bounds(vec3 &lo, vec3 &hi) const;
+
+    const Scene &scene;
+
+private:
+    vec3 skyRadiance(const vec3 &d) const;
+    float envPdf(const vec3 &d) const;
+    bool sampleEnv(Rng &rng, vec3 &wi, float &pdf) const;
+
+    int pickLight(float u, float &pmf) const;
+    float lightPmf(int sphere) const;
+    bool sampleSphereLight(int s, const vec3 &p, Rng &rng, vec3 &wi, float &dist, float &pdf) const;
+    float sphereSolidAnglePdf(int s, const vec3 &p) const;
+
+    // Density of the bounce direction at a Lambertian vertex (BSDF or guide mixture)
+    float bouncePdf(int leaf, const vec3 &n, const vec3 &wi) const;
+    vec3 sampleDirect(const vec3 &p, const vec3 &n, const vec3 &albedo, int leaf, Rng &rng) const;
+    vec3 sampleEnvDirect(const vec3 &p, const vec3 &n, const vec3 &albedo, int leaf, Rng &rng) const;
+
+    // --- Bidirectional path tracing (bdpt.cpp) ---
+    struct PathVertex;
+    struct CameraFrame;
+    void renderPassBdpt(Film &film, uint32_t pass) const;
+    vec3 bdptSample(const CameraFrame &cam, int x, int y, Rng &rng, std::vector<vec3> &splats) const;
+    int randomWalk(vec3 ro, vec3 rd, vec3 beta, float pdfDir, bool fromCamera, Rng &rng, PathVertex *path,
+                   int maxVertices, vec3 &sky) const;
+    vec3 connect(const CameraFrame &cam, const PathVertex *light, int s, const PathVertex *eye, int t, Rng &rng,
+                 std::vector<vec3> &splats) const;
+    float misWeight(const CameraFrame &cam, const PathVertex *light, int s, const PathVertex *eye, int t,
+                    const PathVertex &sampled) const;
+    float vertexPdf(const CameraFrame &cam, const PathVertex &v, const PathVertex *prev, const PathVertex &next) const;
+    float lightOriginPdf(const PathVertex &v) const;
+    vec3 vertexBsdf(const PathVertex &v, const vec3 &wi) const;
+    bool connectible(const PathVertex &v) const;
+
+    bool scatterSpecular(int s, const vec3 &p, const vec3 &rd, Rng &rng, vec3 &wo, vec3 &weight) const;
+    bool isSpecular(int s) const; // glass or metal: what caustic photons pass through
+    void emitPhoton(int count, Rng &rng, std::vector<Photon> &out) const;
+
+    Bvh bvh;
+    std::vector<int> lights;       // emissive spheres
+    std::vector<float> lightCdf;   // by power, like the light BVH's phi
+    std::vector<float> lightPmfs;  // per sphere (0 for non-emitters)
+    const Environment *environment;
+    std::vector<EnvTexel> envTexels;
+
+    // Photon emission: sky photons aim at a glass or metal sphere picked by area
+    std::vector<int> specular;
+    std::vector<float> specularCdf;
+    float skyPhotonFraction = 0.0f; // share of photons from the sky, by flux
+    float sceneExtent = 1.0f;       // diagonal of bounds()
+};
+
+#endif // CPU_TRACER_H
@@ -0,0 +1,47 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <string>
+#include <vector>
+#include "vec.h"
+
+// One texel of the environment as the shader reads it, laid out to match the
+// std430 EnvTexel in fragment.glsl. Besides the radiance, each texel is an
+// entry of a Walker/Vose alias table over all texels: pick entry i uniformly,
+// keep it with probability q, otherwise take alias. pmf is the resulting
+// probability of choosing this texel (for MIS with BSDF sampling).
+struct EnvTexel
+{
+    float radiance[3];
+    float pmf;
+    float q;
+    int alias;
+    int pad[2];
+};
+
+// Equirectangular HDR environment: row 0 is straight up (+y), column 0
+// looks along -x and columns advance toward +z (matches env_direction()).
+struct Environment
+{
+    int width = 0;
+    int height = 0;
+    std::vector<vec3> pixels;
+
+    bool empty() const { return pixels.empty(); }
+};
+
+// Load a map from disk. Supported, all without external libraries:
+//   .pfm          Portable Float Map (PF colour or Pf greyscale)
+//   .hdr / .pic   Radiance RGBE, flat or new-style run-length encoded
+//   .raw / .f32   headerless native-endian RGB floats, 2:1 aspect, top row first
+bool loadEnvironment(const std::string &path, Environment &env);
+
+// Procedural fallback: the usual white-to-blue gradient with a small, very
+// bright sun, so there is a hard-to-sample sky even without a file
+void buildSunSky(Environment &env, int width);
+
+// Radiance plus alias table for importance sampling texels by luminance
+// times solid angle (sin(theta) of the texel row)
+void buildEnvironmentTexels(const Environment &env, std::vector<EnvTexel> &texels);
+
+#endif // ENVIRONMENT_H
@@ -0,0 +1,57 @@
+#ifndef FOVEATION_H
+#define FOVEATION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Foveated sampling: pixels near a focus point are traced every frame,
+// farther ones every 2nd or 4th frame, decided per FOVEA_TILE-pixel square
+// tile (so whole SIMD groups skip together) by the tile centre's distance
+// from the focus in units of the full-rate radius. Tiles of one rate take
+// turns by position, so each frame traces about the same share of them.
+// Mirrors fovea_rate() and fovea_traced() in fragment.glsl; the bench uses
+// it to drive the CPU tracer.
+
+const int FOVEA_TILE = 8;
+const int FOVEA_MAX_RATE = 4;
+
+struct Foveation
+{
+    bool enabled = false;
+    float x = 0.5f, y = 0.5f; // focus point in [0, 1] of the image, y up
+    float radius = 0.25f;     // full-rate radius as a fraction of the image height
+};
+
+// Traced every rate-th frame: 1, 2 or FOVEA_MAX_RATE
+inline int foveaRate(const Foveation &f, int tileX, int tileY, int width, int height)
+{
+    if (!f.enabled) return 1;
+    float dx = (tileX + 0.5f) * FOVEA_TILE - f.x * width;
+    float dy = (tileY + 0.5f) * FOVEA_TILE - f.y * height;
+    float rings = std::sqrt(dx * dx + dy * dy) / (f.radius * height);
+    return std::min(1 << std::min((int)rings, 8), FOVEA_MAX_RATE);
+}
+
+inline bool foveaTraced(const Foveation &f, int x, int y, int width, int height, uint32_t frame)
+{
+    int tx = x / FOVEA_TILE, ty = y / FOVEA_TILE;
+    int rate = foveaRate(f, tx, ty, width, height);
+    return (frame + (uint32_t)(tx + 2 * ty)) % (uint32_t)rate == 0u;
+}
+
+// Mean share of the pixels traced per frame
+inline double foveaTracedFraction(const Foveation &f, int width, int height)
+{
+    if (!f.enabled) return 1.0;
+    double traced = 0.0;
+    for (int ty = 0; ty * FOVEA_TILE < height; ++ty)
+        for (int tx = 0; tx * FOVEA_TILE < width; ++tx)
+        {
+            int w = std::min(FOVEA_TILE, width - tx * FOVEA_TILE), h = std::min(FOVEA_TILE, height - ty * FOVEA_TILE);
+            traced += (double)w * h / foveaRate(f, tx, ty, width, height);
+        }
+    return traced / ((double)width * height);
+}
+
+#endif // FOVEATION_H
@@ -3,9 +3,18 @@
 
 #include <SDL3/SDL.h>
 #include <glad/glad.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include "vec.h"
+#include "scene.h"
+#include "environment.h"
+#include "foveation.h"
+#include "triple_buffer.h"
 
 class Game
 {
@@ -19,10 +28,69 @@ public:
     void render();
     bool running() { return isRunning; }
 
+    // HDR map (.pfm/.hdr/.raw) to light the scene with; loaded by init()
+    void setEnvironmentFile(const std::string &path) { envPath = path; }
+
+    // Offline render budgets: accumulate until the time (seconds since the
+    // view last changed) or the estimated relative MSE is reached, then
+    // report the samples taken. With an output file (.pfm/.ppm) the image is
+    // written there and the app exits.
+    void setTimeBudget(double seconds) { timeBudget = seconds; }
+    void setErrorBudget(float relMse) { errorBudget = relMse; }
+    void setSampleBudget(int spp) { sampleBudget = spp; }
+    void setOutputFile(const std::string &path) { outputPath = path; }
+    // Also write the primary hits' albedo, normal and depth next to the
+    // output file (<name>_albedo.pfm, ...), for offline denoisers
+    void setAovExport(bool enabled) { aovExport = enabled; }
+
+    // Frame rate the dynamic resolution aims for; 0 always traces at window size
+    void setTargetFps(float fps) { targetFps = fps; }
+    // Trace time per frame before the rest of a sample waits for the next
+    // frame (by default a share of the refresh interval); 0 traces whole
+    // samples
+    void setTileBudget(float ms)
+    {
+        tiledDispatch = ms > 0.0f;
+        if (tiledDispatch)
+            tileBudgetMs = ms;
+    }
+    // Highest quality tier: 0 albedo, 1 ambient occlusion, 2 limited GI, 3 full
+    void setQualityTier(int tier) { qualityTier = std::clamp(tier, (int)TIER_ALBEDO, (int)TIER_FULL); }
+    // Drop to a preview tier while the camera moves, climbing back when still
+    void setAutoTier(bool enabled) { autoTier = enabled; }
+    // Primary visibility from rasterized sphere impostors
+    void setHybrid(bool on) { hybridEnabled = on; }
+    // Stop tracing pixels of a still view once their estimated relative MSE,
+    // and their neighbours', is below this; 0 traces every pixel
+    void setAdaptiveThreshold(float relMse) { adaptiveThreshold = relMse; }
+    // Camera rays per pixel per frame; 0 tunes them to the frame-rate target
+    void setSamplesPerFrame(int count)
+    {
+        autoSamples = count <= 0;
+        if (!autoSamples)
+            samplesPerFrame = std::min(count, MAX_SAMPLES_PER_FRAME);
+    }
+    // Trace at a fixed fraction of the window size instead (dynamic resolution off)
+    void setRenderScale(float scale)
+    {
+        dynamicResolution = false;
+        fixedResolutionScale = std::clamp(scale, minResolutionScale, 1.0f);
+    }
+
+    // Foveated sampling around (x, y) in [0, 1] of the window, y up, at full
+    // rate within radius (a fraction of the window height)
+    void setFoveation(float x, float y, float radius)
+    {
+        foveation.enabled = true;
+        foveation.x = x;
+        foveation.y = y;
+        foveation.radius = radius;
+    }
+
 private:
 
     // -------------------
-    // CAMERA DATA
+    // CAMERA DATA (the render thread's copy of the simulated camera)
     // -------------------
     vec3 cameraPos = vec3(0.0f, 0.0f, 3.0f);
     float yaw = -90.0f;
@@ -30,6 +98,69 @@ private:
     float moveSpeed = 3.0f;
     float mouseSensitivity = 0.1f;
 
+    // -------------------
+    // SIMULATION (camera motion on its own thread at a fixed timestep)
+    // -------------------
+    struct InputState
+    {
+        unsigned held = 0;          // MOVE_* bits of the movement keys down
+        double lookX = 0.0;         // mouse motion so far, in pixels; running
+        double lookY = 0.0;         // totals, so a value overwritten unread loses nothing
+    };
+    struct CameraState
+    {
+        vec3 pos;
+        float yaw = 0.0f;
+        float pitch = 0.0f;
+        double lookX = 0.0;         // the InputState look totals applied
+        double lookY = 0.0;
+    };
+    enum { MOVE_FORWARD = 1, MOVE_BACK = 2, MOVE_LEFT = 4, MOVE_RIGHT = 8 };
+
+    void startSimulation();
+    void stopSimulation();
+    void simulate(CameraState cam, InputState applied);
+    void step(CameraState &cam, unsigned held, float seconds) const;
+
+    std::thread simThread;
+    std::atomic<bool> simRunning{false};
+    std::mutex simMutex;                 // guards simWoken; the simulation sleeps on simWake
+    std::condition_variable simWake;     // while no key is held and no look is pending
+    bool simWoken = false;               // new input since the simulation last looked
+    InputState input;                    // the event thread's, published after each poll
+    TripleBuffer<InputState> inputState; // event thread -> simulation
+    TripleBuffer<CameraState> cameraState; // simulation -> render thread
+
+    // -------------------
+    // LATE LATCH (the present camera, written just before the display pass)
+    // -------------------
+    struct PresentCamera            // std140 PresentCamera in fragment.glsl
+    {
+        float origin[3];
+        int warp;
+        float lookAt[3];
+        float pad;
+    };
+    static const int PRESENT_CAMERA_SLOTS = 3; // written round-robin, fenced
+
+    void initPresentCamera();
+    void latchPresentCamera();
+    void publishInput();
+
+    GLuint presentCameraBuffer = 0;
+    unsigned char *presentCameraMap = nullptr; // persistently mapped; null = updated with glBufferSubData
+    GLsizeiptr presentCameraStride = 0;
+    GLsync presentCameraFences[PRESENT_CAMERA_SLOTS] = {};
+    int presentCameraSlot = 0;
+
+    // Input-to-present latency: from an input event to the swap of the
+    // first frame whose present camera includes it
+    Uint64 pendingInputNS = 0;          // oldest input event not latched yet, 0 = none
+    Uint64 latchedInputNS = 0;          // the one the frame being drawn shows
+    double latencySumMs = 0.0;          // over the status interval
+    double latencyMaxMs = 0.0;
+    int latencyCount = 0;
+
     // -------------------
     // TIME
     // -------------------
@@ -52,15 +183,237 @@ private:
     GLuint vbo = 0;
     GLuint ebo = 0;
 
-   
-    void buildFinalScene();
-    int scene_count = 0;
-    std::vector<vec3> scene_centers;
-    std::vector<float> scene_radii;
-    std::vector<int> scene_material;
-    std::vector<vec3> scene_albedo;
-    std::vector<float> scene_fuzz;
-    std::vector<float> scene_ref_idx;
+    // -------------------
+    // SCENE
+    // -------------------
+    void loadScene(int index);
+    void uploadScene();
+
+    Scene scene;
+    int sceneIndex = 0;     // 0 = final scene, 1 = many-lights scene, 2 = glass scene
+    int lightCount = 0;
+    int lightSampling = 1;  // 0 = uniform, 1 = light BVH
+
+    // Shader storage buffers (bindings 0-4 in fragment.glsl)
+    GLuint sphereBuffer = 0;
+    GLuint bvhNodeBuffer = 0;
+    GLuint bvhIndexBuffer = 0;
+    GLuint lightNodeBuffer = 0;
+    GLuint lightListBuffer = 0;
+
+    // -------------------
+    // ENVIRONMENT
+    // -------------------
+    void uploadEnvironment();
+
+    Environment environment;
+    std::string envPath;     // empty = procedural sun sky
+    bool envEnabled = false; // false = analytic gradient sky
+    GLuint envBuffer = 0;    // binding 9: texels + alias table
+
+    // -------------------
+    // RESTIR (direct and indirect lighting reuse)
+    // -------------------
+    void resizeRenderTargets();
+
+    bool restirDI = true;         // resample light samples (scenes with emitters)
+    bool restirGI = true;         // resample secondary-bounce path samples
+    bool restirHistory = false;   // last frame's reservoirs usable for temporal reuse
+    int restirCandidates = 8;
+    int restirSpatialSamples = 4;
+    float restirRadius = 16.0f;
+
+    GLuint restirFinalBuffer = 0;   // binding 5: shaded reservoirs, read next frame
+    GLuint restirInitialBuffer = 0; // binding 6: candidates + temporal reuse
+    GLuint giFinalBuffer = 0;       // binding 7: GI reservoirs, read next frame
+    GLuint giInitialBuffer = 0;     // binding 8: GI candidates + temporal reuse
+
+    // -------------------
+    // RADIANCE CACHE (world-space hash grid that paths terminate in)
+    // -------------------
+    void clearRadianceCache();
+
+    bool cacheEnabled = true;
+    unsigned int cacheCells = 1u << 20; // power of two
+    float cacheCellSize = 0.02f;        // near the camera; doubles with distance
+    float cacheMinSamples = 8.0f;
+    float cacheMaxSamples = 256.0f;
+    unsigned int cacheMaxAge = 64;      // frames
+    GLuint cacheBuffer = 0;             // binding 10: cells
+    GLuint cacheDirtyBuffer = 0;        // binding 11: cells sampled this frame
+
+    // -------------------
+    // ACCUMULATION (progressive image reprojected across camera moves, render budgets)
+    // -------------------
+    float estimateError();
+    void finishBudget(double seconds);
+    void bindHistory(int index);
+
+    // Ping-pong pairs: this frame's history is written while last frame's is read
+    GLuint historyFbo[2] = {0, 0};
+    GLuint historyTexture[2] = {0, 0};  // RGBA32F: mean radiance, sample count
+    GLuint momentsTexture[2] = {0, 0};  // R32F: mean squared luminance
+    GLuint primaryHitBuffer[2] = {0, 0}; // bindings 12 (this frame) and 13 (last frame)
+    int historyIndex = 0;               // pair holding the newest history
+    GLuint errorFbo = 0;
+    GLuint errorTexture = 0;      // R32F per-pixel relative MSE, mipmapped to its mean
+    bool accumDirty = true;       // scene or settings changed: start over
+    int accumSamples = 0;         // samples since the camera last moved
+    Uint64 accumStart = 0;        // ticks at the first of them
+    Uint64 lastSampleTicks = 0;
+    float accumError = -1.0f;     // last estimate, -1 = none yet
+    double timeBudget = 0.0;      // 0 = none
+    float errorBudget = 0.0f;     // 0 = none
+    int sampleBudget = 0;         // 0 = none
+    bool renderBudget() const { return timeBudget > 0.0 || errorBudget > 0.0f || sampleBudget > 0; }
+    bool budgetReached = false;
+    bool accumSettled = false;    // no budget: converged (SETTLED_ERROR) or capped
+    bool accumulationDone() const { return budgetReached || accumSettled; }
+    std::string outputPath;
+    bool aovExport = false;
+
+    // -------------------
+    // DENOISER (a-trous filter guided by the primary hits)
+    // -------------------
+    GLuint denoise();
+    void writeAovs(const std::string &basePath);
+
+    bool denoiseEnabled = true;
+    int denoiseLevels = 5;              // tap spacing 1, 2, 4, 8, 16
+    float denoiseSigmaLuminance = 4.0f; // luminance edge stop, in standard deviations
+    GLuint denoiseFbo[2] = {0, 0};
+    GLuint denoiseTexture[2] = {0, 0};  // RGBA32F: colour, variance of the mean
+
+    // -------------------
+    // INTERLEAVE (trace a checkerboard or a quarter of the pixels per frame)
+    // -------------------
+    int interleave = 1;                 // 1 = every pixel, 2 = checkerboard, 4 = one pixel in 2x2;
+                                        // render budgets always trace every pixel
+    GLuint sampleFbo = 0;
+    GLuint sampleTexture = 0;           // RGBA32F: the shading passes' samples, packed to the pattern
+
+    // -------------------
+    // FOVEATION (full sampling rate near a focus point, less toward the edges)
+    // -------------------
+    Foveation foveation;                // off during render budgets
+
+    // -------------------
+    // ADAPTIVE SAMPLING (converged pixels of a still view are skipped)
+    // -------------------
+    float adaptiveThreshold = 0.0f;     // relative MSE, 0 = off
+    bool sampleAdaptive = false;        // the sample in progress skips converged pixels
+
+    // -------------------
+    // UPSCALER (edge-adaptive, guided by the window pixels' primary hits)
+    // -------------------
+    bool upscaleEnabled = true;         // off = bilinear
+    bool guideDirty = true;             // view changed: retrace the window's primary hits
+    GLuint displayHitBuffer = 0;        // PrimaryHit per window pixel
+
+    // -------------------
+    // TILED DISPATCH (a sample traced in tiles over as many frames as it takes)
+    // -------------------
+    void beginSample();
+    bool traceTiles(int pattern, Uint64 frameStart);
+    bool sampleInProgress() const { return tilesDone < tileCount; }
+
+    bool tiledDispatch = true;
+    float tileBudgetMs = 0.0f;          // trace time per frame (at least one tile is traced);
+                                        // 0 until init = a share of the refresh interval
+    float refreshRate = 0.0f;           // Hz, of the window's display
+    float tileMs = 0.0f;                // measured cost of a tile, smoothed
+    int tileCount = 0;                  // of the sample in progress
+    int tileColumns = 0;
+    int tilesDone = 0;
+    vec3 sampleCameraPos;               // camera the sample in progress is traced with
+    vec3 sampleCameraTarget;
+    bool sampleCameraMoved = false;
+    bool sampleHistoryValid = false;
+
+    // -------------------
+    // PRIMARY HIT CACHE (the camera rays' first hits, reused while the view holds still)
+    // -------------------
+    bool primaryCacheEnabled = true;    // never used with defocus blur
+    bool primaryCacheDirty = true;      // view or scene changed since it was filled
+    bool samplePrimaryCache = false;    // the sample in progress reads and fills it
+    GLuint primaryCacheBuffer = 0;      // binding 15: first sphere per pixel cell, 16 bits each
+
+    // -------------------
+    // IDLE (wait for events instead of rendering when there is nothing new to show)
+    // -------------------
+    bool idle() const;
+
+    bool windowHidden = false;          // minimized, hidden or occluded
+    bool presentPending = true;         // an event arrived since the last frame
+
+    // -------------------
+    // QUALITY TIERS (cheaper shading while the camera moves, full path tracing once it settles)
+    // -------------------
+    enum Tier { TIER_ALBEDO, TIER_AO, TIER_GI, TIER_FULL };
+    // ReSTIR passes run (only for the path-traced tiers)
+    bool resampling() const { return ((restirDI && lightCount > 0) || restirGI) && activeTier >= TIER_GI; }
+
+    int qualityTier = TIER_FULL;        // highest tier (F1-F4)
+    bool autoTier = false;              // motionTier while the camera moves, then back up (M)
+    int motionTier = TIER_AO;
+    int activeTier = TIER_FULL;         // of the sample in progress
+    int tierSamples = 0;                // still samples traced at it
+    bool sampleTierChanged = false;     // the sample in progress is the first at a new tier
+
+    // -------------------
+    // HYBRID (primary visibility from rasterized sphere impostors, the rest traced)
+    // -------------------
+    void rasterizePrimary();
+
+    bool hybridEnabled = false;         // never used with defocus blur
+    bool sampleHybrid = false;          // the sample in progress starts from the impostor pass
+    float cameraJitter[2] = {0.5f, 0.5f}; // its camera rays' position in the pixel
+    GLuint impostorShader = 0;
+    GLuint impostorFbo = 0;
+    GLuint primaryIdTexture = 0;        // R32I: first sphere per traced pixel, -1 = sky (unit 4)
+    GLuint impostorDepthTexture = 0;    // reversed depth, 1 / (1 + t)
+
+    // -------------------
+    // DYNAMIC RESOLUTION (trace fewer pixels than the window to hold a frame
+    // rate, or more rays per pixel when there is time to spare)
+    // -------------------
+    static const int MAX_SAMPLES_PER_FRAME = 16;
+    void updateResolution();
+    void setResolutionScale(float scale);
+
+    bool autoSamples = true;            // samplesPerFrame follows the frame-rate target
+    int samplesPerFrame = 1;
+    int frameSamples = 1;               // of the sample in progress (1 with ReSTIR)
+
+    bool dynamicResolution = true;      // off while a render budget is set
+    float targetFps = 30.0f;
+    float resolutionScale = 1.0f;       // traced size / window size, per axis
+    float minResolutionScale = 0.25f;
+    float fixedResolutionScale = 1.0f;  // with dynamic resolution off
+    int renderW = 0;                    // traced pixels; the targets are window-sized
+    int renderH = 0;
+    int prevRenderW = 0;                // of the last traced frame
+    int prevRenderH = 0;
+    // GPU time of a sample's trace work: one query per tile batch, summed
+    // (so the frames between batches are not counted), read 3 samples late
+    struct SampleTimer
+    {
+        std::vector<GLuint> queries;    // grown as needed, reused
+        int used = 0;                   // of them, by this sample
+        float scale = 0.0f;
+        int samples = 1;
+    };
+    void beginTimer();
+    void endTimer();
+    SampleTimer sampleTimers[3];
+    bool timerOpen = false;             // a batch query has begun and not ended
+    int timerCount = 0;                 // samples timed
+    int timerRead = 0;                  // samples whose time has been used
+    float frameCost = 0.0f;             // smoothed GPU seconds per ray per pixel at window size
+
+    Uint32 frameIndex = 0;
+    vec3 prevCameraPos = vec3(0.0f, 0.0f, 3.0f);
+    vec3 prevCameraTarget = vec3(0.0f, 0.0f, 2.0f);
 };
 
 #endif
@@ -0,0 +1,16 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <string>
+#include <vector>
+#include "vec.h"
+
+// Linear HDR image, top row first (for references, AOVs, offline output)
+bool writePfm(const std::string &path, int width, int height, const std::vector<vec3> &pixels);
+bool readPfm(const std::string &path, int &width, int &height, std::vector<vec3> &pixels);
+
+// 8-bit preview: exposure scale, clamp and the same sqrt gamma as the shader
+bool writePpm(const std::string &path, int width, int height, const std::vector<vec3> &pixels,
+              float exposure = 1.0f);
+
+#endif // IMAGE_IO_H
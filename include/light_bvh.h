@@ -0,0 +1,38 @@
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include <cstdint>
+#include <vector>
+#include "scene.h"
+
+// Flattened light-hierarchy node, laid out to match the std430 LightNode in
+// fragment.glsl. Each node bounds a cluster of emitters by position, total
+// power (phi) and an orientation cone: emission directions lie within
+// cos_theta_o of w, and each emitter radiates up to cos_theta_e past that.
+// Interior: left child is the next node, right child is nodes[child_or_light].
+// Leaf: child_or_light is the emissive sphere's index in the scene.
+struct LightBvhNode
+{
+    float bmin[3];
+    float phi;
+    float bmax[3];
+    float cos_theta_o;
+    float w[3];
+    float cos_theta_e;
+    int child_or_light;
+    int is_leaf;
+    int pad[2];
+};
+
+struct LightBvh
+{
+    std::vector<LightBvhNode> nodes;
+    std::vector<int> lights;       // emissive sphere indices (for uniform selection)
+    std::vector<uint64_t> trail;   // per sphere: root-to-leaf path, bit d set = right at depth d
+};
+
+// Build the hierarchy over every MAT_DIFFUSE_LIGHT sphere, splitting with
+// pbrt's surface-area-orientation heuristic
+void buildLightBvh(const Scene &scene, LightBvh &bvh);
+
+#endif // LIGHT_BVH_H
@@ -0,0 +1,108 @@
+#ifndef PATH_GUIDING_H
+#define PATH_GUIDING_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "rng.h"
+#include "vec.h"
+
+// Practical path guiding (Mueller et al. 2017): an SD-tree learns, from the
+// radiance the renderer's own paths carry, where incident light comes from.
+// The spatial part is a binary tree over the scene bounds; each leaf owns a
+// directional quadtree over the square [0,1)^2, mapped to the sphere with
+// the area-preserving cylindrical map, so densities differ by 1/(4 pi).
+//
+// Training runs in iterations with doubling sample counts. Paths sample from
+// the previous iteration's trees and record into the current ones; between
+// iterations nextIteration() refines both trees from what was recorded.
+
+// Directional quadtree. Node children are 0 for leaves; root is node 0.
+class DTree
+{
+public:
+    DTree();
+
+    void record(float u, float v, float value);
+    void sample(Rng &rng, float &u, float &v) const;
+    float pdf(float u, float v) const; // density over the unit square
+
+    float total() const;
+    float statisticalWeight() const { return sampleCount; }
+    void scaleWeight(float s) { sampleCount *= s; }
+
+    // New tree structure refined from this one's energy: leaves holding more
+    // than a fraction rho of the total split, interior nodes below it merge.
+    // Sums are zeroed, ready to record the next iteration.
+    DTree refined(float rho, int maxDepth) const;
+
+private:
+    struct Node
+    {
+        float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        uint32_t child[4] = {0, 0, 0, 0};
+    };
+
+    void refineNode(DTree &out, uint32_t outNode, uint32_t node, float total, float rho, int depth,
+                    int maxDepth) const;
+
+    std::vector<Node> nodes;
+    float sampleCount = 0.0f;
+};
+
+class PathGuide
+{
+public:
+    PathGuide(const vec3 &bmin, const vec3 &bmax);
+
+    // Index of the spatial leaf containing p
+    int leafAt(const vec3 &p) const;
+
+    // True once an iteration has been learned (before that: BSDF sampling only)
+    bool ready() const { return iteration > 0; }
+
+    // Direction from the leaf's learned distribution and its solid-angle density
+    vec3 sample(int leaf, Rng &rng, float &pdf) const;
+    float pdf(int leaf, const vec3 &dir) const;
+
+    // Incident radiance estimate (luminance / sampling density) along dir.
+    // Safe to call from several render threads.
+    void record(int leaf, const vec3 &dir, float value);
+
+    // Close the current training iteration, rendered at spp samples per pixel
+    void nextIteration(int spp);
+
+    int iterationCount() const { return iteration; }
+    int leafCount() const { return (int)leaves.size(); }
+
+    float bsdfFraction = 0.5f;     // one-sample MIS: share of bounces sampled from the BSDF
+    float spatialThreshold = 12000.0f; // leaf splits past c * sqrt(spp) records
+    float directionalRho = 0.01f;  // quadtree energy fraction to split at
+    int maxDirectionalDepth = 20;
+
+private:
+    struct SNode
+    {
+        int axis = 0;
+        int child = -1; // interior: children child, child + 1
+        int leaf = -1;  // leaf: index into leaves
+    };
+
+    struct Leaf
+    {
+        DTree sampling; // learned last iteration, read while rendering
+        DTree building; // being recorded this iteration
+    };
+
+    void subdivide(int node, float threshold);
+
+    vec3 lo, hi;
+    std::vector<SNode> nodes;
+    std::vector<Leaf> leaves;
+    int iteration = 0;
+
+    static const int LOCK_COUNT = 64;
+    std::mutex locks[LOCK_COUNT]; // striped over leaves for record()
+};
+
+#endif // PATH_GUIDING_H
@@ -0,0 +1,45 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include <cstdint>
+#include <vector>
+#include "vec.h"
+
+// A photon stored where a light path first reached a diffuse surface
+struct Photon
+{
+    vec3 position;
+    vec3 direction; // of travel, i.e. pointing into the surface
+    vec3 power;     // flux carried, already divided by the photons emitted
+};
+
+// Hash grid over photons for fixed-radius density estimation. Cells are one
+// search diameter wide, so a query touches the 2x2x2 cells nearest to it.
+// Photons are counting-sorted by cell, so each cell is a contiguous range.
+class PhotonMap
+{
+public:
+    // Take the photons and build the grid for gathers of the given radius,
+    // hashing and scattering on threadCount threads (0 = all cores)
+    void build(std::vector<Photon> &&photons, float radius, int threadCount);
+
+    // Flux per unit area arriving at p from the side n faces (irradiance
+    // estimate with a constant kernel). Times albedo / pi gives the radiance
+    // the photons reflect off a Lambertian surface.
+    vec3 irradiance(const vec3 &p, const vec3 &n) const;
+
+    bool empty() const { return photons.empty(); }
+    size_t size() const { return photons.size(); }
+    float radius() const { return searchRadius; }
+
+private:
+    uint32_t cellIndex(int x, int y, int z) const;
+
+    std::vector<Photon> photons;    // sorted by cell
+    std::vector<uint32_t> cellStart; // photons of cell c: [cellStart[c], cellStart[c + 1])
+    uint32_t cellMask = 0;
+    float searchRadius = 0.0f;
+    float invCellSize = 0.0f;
+};
+
+#endif // PHOTON_MAP_H
@@ -0,0 +1,34 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// PCG32 (O'Neill): small, fast, and seekable per pixel/sample, so CPU
+// renders come out the same whatever the thread count
+struct Rng
+{
+    uint64_t state = 0;
+    uint64_t inc = 1;
+
+    Rng(uint64_t seed = 0, uint64_t stream = 0)
+    {
+        inc = (stream << 1u) | 1u;
+        next();
+        state += seed;
+        next();
+    }
+
+    uint32_t next()
+    {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = (uint32_t)(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+
+    // [0, 1)
+    float uniform() { return (next() >> 8) * (1.0f / 16777216.0f); }
+};
+
+#endif // RNG_H
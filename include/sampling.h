@@ -0,0 +1,58 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <algorithm>
+#include <cmath>
+#include "rng.h"
+#include "vec.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Small shading and sampling helpers shared by the CPU integrators, written
+// to match their fragment.glsl counterparts
+
+inline float luminance(const vec3 &c) { return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z; }
+inline vec3 mul(const vec3 &a, const vec3 &b) { return vec3(a.x * b.x, a.y * b.y, a.z * b.z); }
+
+inline float powerHeuristic(float a, float b)
+{
+    float a2 = a * a, b2 = b * b;
+    return (a2 + b2 > 0.0f) ? a2 / (a2 + b2) : 0.0f;
+}
+
+inline vec3 reflectVec(const vec3 &v, const vec3 &n) { return v - n * (2.0f * dot(v, n)); }
+
+inline float schlick(float cosine, float ref_idx)
+{
+    float r0 = (1.0f - ref_idx) / (1.0f + ref_idx);
+    r0 = r0 * r0;
+    return r0 + (1.0f - r0) * std::pow(1.0f - cosine, 5.0f);
+}
+
+inline vec3 refractVec(const vec3 &uv, const vec3 &n, float etai_over_etat)
+{
+    float cos_theta = std::min(dot(uv * -1.0f, n), 1.0f);
+    vec3 r_out_perp = (uv + n * cos_theta) * etai_over_etat;
+    float k = 1.0f - dot(r_out_perp, r_out_perp);
+    return r_out_perp - n * std::sqrt(std::fabs(k));
+}
+
+inline vec3 randomUnitVector(Rng &rng)
+{
+    float z = rng.uniform() * 2.0f - 1.0f;
+    float a = rng.uniform() * 2.0f * (float)M_PI;
+    float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+    return vec3(r * std::cos(a), r * std::sin(a), z);
+}
+
+// Cosine-weighted direction about n (normal + unit vector, as in the shader)
+inline vec3 cosineDirection(const vec3 &n, Rng &rng)
+{
+    vec3 d = n + randomUnitVector(rng);
+    if (std::fabs(d.x) < 1e-8f && std::fabs(d.y) < 1e-8f && std::fabs(d.z) < 1e-8f) d = n;
+    return normalize(d);
+}
+
+#endif // SAMPLING_H
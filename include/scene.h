@@ -0,0 +1,42 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <vector>
+#include "vec.h"
+
+#define MAT_LAMBERTIAN 0
+#define MAT_METAL 1
+#define MAT_DIELECTRIC 2
+#define MAT_DIFFUSE_LIGHT 3
+
+// Sphere world, stored as parallel arrays (one entry per sphere).
+struct Scene
+{
+    std::vector<vec3> centers;
+    std::vector<float> radii;
+    std::vector<int> material;
+    std::vector<vec3> albedo;
+    std::vector<float> fuzz;
+    std::vector<float> ref_idx;
+    std::vector<vec3> emission; // radiance leaving MAT_DIFFUSE_LIGHT spheres
+
+    float sky_intensity = 1.0f; // scales the gradient sky on a miss
+
+    int count() const { return (int)centers.size(); }
+    void clear();
+    void addSphere(const vec3 &center, float radius, int mat, const vec3 &alb,
+                   float fz = 0.0f, float ri = 0.0f, const vec3 &emit = vec3());
+};
+
+// "Ray Tracing in One Weekend" final scene (deterministic layout)
+void buildFinalScene(Scene &scene);
+
+// Lighting-design scene: the final-scene centerpiece lit by thousands of
+// small emissive spheres under a dark sky
+void buildLightsScene(Scene &scene);
+
+// Glass-heavy scene: a lamp sealed inside a glass globe, so no shadow ray
+// reaches it, above a field of glass and diffuse spheres under a dim sky
+void buildGlassScene(Scene &scene);
+
+#endif // SCENE_H
@@ -0,0 +1,54 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single-producer, single-consumer handoff of the latest value.
+// Three slots: the writer fills its own, then swaps it with the shared
+// middle one; the reader swaps its own with the middle one when that holds
+// something newer. Neither side ever waits, and the reader always sees a
+// whole value (the newest published), never a half-written one.
+template <typename T>
+class TripleBuffer
+{
+public:
+    // Every slot to `value`; before either side starts
+    void reset(const T &value)
+    {
+        for (T &slot : slots)
+            slot = value;
+        middle.store(MIDDLE, std::memory_order_release);
+        back = BACK;
+        front = FRONT;
+    }
+
+    // Writer
+    void publish(const T &value)
+    {
+        slots[back] = value;
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Reader: whether a value was published since the last latest()
+    bool fresh() const { return (middle.load(std::memory_order_acquire) & FRESH) != 0; }
+
+    // Reader: the newest published value
+    const T &latest()
+    {
+        if (fresh())
+            front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return slots[front];
+    }
+
+private:
+    static const uint8_t INDEX = 3, FRESH = 4;
+    static const uint8_t BACK = 0, MIDDLE = 1, FRONT = 2;
+
+    T slots[3] = {};
+    uint8_t back = BACK;                 // writer's
+    uint8_t front = FRONT;               // reader's
+    std::atomic<uint8_t> middle{MIDDLE}; // slot index | FRESH
+};
+
+#endif // TRIPLE_BUFFER_H
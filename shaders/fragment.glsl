@@ -1,44 +1,101 @@
-#version 330 core
-out vec4 FragColor;
+#version 430 core
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 FragMoments; // PASS_TEMPORAL only
 
-uniform vec2 WINDOW;
+uniform vec2 WINDOW;          // traced resolution (at most the window's)
+uniform vec2 uDisplaySize;    // window resolution, for the display pass
 
 // Camera uniforms
 uniform vec3 uCameraOrigin;
 uniform vec3 uLookAt;
 uniform vec3 uUp;
 uniform float uFOV;
-uniform vec2 uSeed;         // Varies every frame 
+uniform uint uFrame;        // Varies every frame 
 uniform int uMaxDepth;
 
 // Defocus blur
 uniform float uDefocusAngle;
 uniform float uFocusDist;
 
-#define MAX_SPHERES 512
+// Lighting
+uniform float uSkyIntensity;
+uniform int uLightSampling;  // 0 = uniform over lights, 1 = light BVH
+uniform int light_count;
+uniform int uEnvMap;         // 1 = HDR environment (binding 9) instead of the gradient sky
+uniform ivec2 uEnvSize;      // environment texels (equirectangular, width = 2 * height)
+
 #define MAT_LAMBERTIAN 0
 #define MAT_METAL 1
 #define MAT_DIELECTRIC 2
+#define MAT_DIFFUSE_LIGHT 3
+
+#define PI 3.14159265359
+#define BVH_STACK_SIZE 48
+#define ONE_MINUS_EPSILON 0.99999994
+
+// ---------------- SCENE BUFFERS ----------------
+// Layouts match GpuSphere (game.cpp), BvhNode (bvh.h), LightBvhNode (light_bvh.h)
+// and EnvTexel (environment.h)
+struct Sphere {
+    vec3 center;   float radius;
+    vec3 albedo;   float fuzz;
+    vec3 emission; float ref_idx;
+    int material;
+    uint trail_lo; // light BVH root-to-leaf path (emitters only)
+    uint trail_hi;
+    int pad;
+};
+
+struct BvhNode {
+    vec3 bmin; int left_first;
+    vec3 bmax; int count;
+};
+
+struct LightNode {
+    vec3 bmin; float phi;
+    vec3 bmax; float cos_theta_o;
+    vec3 w;    float cos_theta_e;
+    int child_or_light;
+    int is_leaf;
+    int pad0;
+    int pad1;
+};
+
+layout(std430, binding = 0) readonly buffer SphereBuffer { Sphere spheres[]; };
+layout(std430, binding = 1) readonly buffer BvhNodeBuffer { BvhNode bvh_nodes[]; };
+layout(std430, binding = 2) readonly buffer BvhIndexBuffer { int bvh_prims[]; };
+layout(std430, binding = 3) readonly buffer LightNodeBuffer { LightNode light_nodes[]; };
+layout(std430, binding = 4) readonly buffer LightListBuffer { int light_list[]; };
 
-uniform int sphere_count;
-// Arrays
-uniform vec3 sphere_centers[MAX_SPHERES];
-uniform float sphere_radii[MAX_SPHERES];
-uniform int sphere_material[MAX_SPHERES];
-uniform vec3 sphere_albedo[MAX_SPHERES];
-uniform float sphere_fuzz[MAX_SPHERES];
-uniform float sphere_ref_idx[MAX_SPHERES];
+struct EnvTexel {
+    vec3 radiance; float pmf;  // pmf: probability the alias table picks this texel
+    float q;       int alias;  // keep with probability q, else take alias
+    int pad0;      int pad1;
+};
+
+layout(std430, binding = 9) readonly buffer EnvBuffer { EnvTexel env_texels[]; };
 
 // ---------------- RANDOM HELPERS ----------------
 // We use 'inout' to update the seed state after every generation
 // This prevents "banding" artifacts where every bounce uses the same random number.
 
-float rand01(inout vec2 seed) {
-    seed += vec2(0.123, 0.456); // Perturb seed so next call is different
-    return fract(sin(dot(seed, vec2(12.9898, 78.233))) * 43758.5453);
+// PCG hash: decorrelates pixel / frame / pass into a starting state
+uint pcg_hash(uint v) {
+    uint state = v * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+uint init_seed(uvec2 pixel, uint frame, uint stream) {
+    return pcg_hash(pixel.x + pixel.y * 65536u + pcg_hash(frame * 4u + stream));
 }
 
-vec2 random_in_unit_disk(inout vec2 seed) {
+float rand01(inout uint seed) {
+    seed = pcg_hash(seed); // Advance the state so next call is different
+    return float(seed >> 8) / 16777216.0;
+}
+
+vec2 random_in_unit_disk(inout uint seed) {
     float u = rand01(seed);
     float v = rand01(seed); 
     float r = sqrt(u);
@@ -46,7 +103,7 @@ vec2 random_in_unit_disk(inout vec2 seed) {
     return vec2(r * cos(theta), r * sin(theta));
 }
 
-vec3 random_unit_vector(inout vec2 seed) {
+vec3 random_unit_vector(inout uint seed) {
     float z = rand01(seed) * 2.0 - 1.0;
     float a = rand01(seed) * 6.2831853;
     float r = sqrt(max(0.0, 1.0 - z*z));
@@ -96,8 +153,99 @@ float hit_sphere(vec3 center, float radius, vec3 ro, vec3 rd) {
     return -1.0;
 }
 
+float hit_aabb(vec3 bmin, vec3 bmax, vec3 ro, vec3 inv_rd, float tmax) {
+    vec3 t0 = (bmin - ro) * inv_rd;
+    vec3 t1 = (bmax - ro) * inv_rd;
+    vec3 tsmall = min(t0, t1);
+    vec3 tbig = max(t0, t1);
+    float tnear = max(max(tsmall.x, tsmall.y), max(tsmall.z, 0.0));
+    float tfar = min(min(tbig.x, tbig.y), min(tbig.z, tmax));
+    return (tnear <= tfar) ? tnear : -1.0;
+}
+
+vec3 safe_inverse(vec3 rd) {
+    return vec3(abs(rd.x) > 1e-8 ? 1.0 / rd.x : 1e8,
+                abs(rd.y) > 1e-8 ? 1.0 / rd.y : 1e8,
+                abs(rd.z) > 1e-8 ? 1.0 / rd.z : 1e8);
+}
+
+// Closest sphere along the ray via the BVH. Returns -1 on a miss.
+int trace_closest(vec3 ro, vec3 rd, inout float closest_t) {
+    int hit_id = -1;
+    if (bvh_nodes.length() == 0) return hit_id;
+
+    vec3 inv_rd = safe_inverse(rd);
+    int stack[BVH_STACK_SIZE];
+    int sp = 0;
+    int node = 0;
+
+    while (true) {
+        BvhNode nd = bvh_nodes[node];
+        if (nd.count > 0) {
+            for (int i = 0; i < nd.count; i++) {
+                int s = bvh_prims[nd.left_first + i];
+                float t = hit_sphere(spheres[s].center, spheres[s].radius, ro, rd);
+                if (t > 0.001 && t < closest_t) {
+                    closest_t = t;
+                    hit_id = s;
+                }
+            }
+            if (sp == 0) break;
+            node = stack[--sp];
+            continue;
+        }
+
+        // Visit the nearer child first, push the other
+        int near_child = node + 1;
+        int far_child = nd.left_first;
+        float t_near = hit_aabb(bvh_nodes[near_child].bmin, bvh_nodes[near_child].bmax, ro, inv_rd, closest_t);
+        float t_far = hit_aabb(bvh_nodes[far_child].bmin, bvh_nodes[far_child].bmax, ro, inv_rd, closest_t);
+        if (t_near < 0.0 || (t_far >= 0.0 && t_far < t_near)) {
+            int tmp_child = near_child; near_child = far_child; far_child = tmp_child;
+            float tmp_t = t_near; t_near = t_far; t_far = tmp_t;
+        }
+
+        if (t_near < 0.0) {
+            if (sp == 0) break;
+            node = stack[--sp];
+            continue;
+        }
+        node = near_child;
+        if (t_far >= 0.0 && sp < BVH_STACK_SIZE) stack[sp++] = far_child;
+    }
+    return hit_id;
+}
+
+// Any hit before tmax (shadow rays)
+bool occluded(vec3 ro, vec3 rd, float tmax) {
+    if (bvh_nodes.length() == 0) return false;
+
+    vec3 inv_rd = safe_inverse(rd);
+    int stack[BVH_STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    while (sp > 0) {
+        int node = stack[--sp];
+        BvhNode nd = bvh_nodes[node];
+        if (hit_aabb(nd.bmin, nd.bmax, ro, inv_rd, tmax) < 0.0) continue;
+
+        if (nd.count > 0) {
+            for (int i = 0; i < nd.count; i++) {
+                int s = bvh_prims[nd.left_first + i];
+                float t = hit_sphere(spheres[s].center, spheres[s].radius, ro, rd);
+                if (t > 0.001 && t < tmax) return true;
+            }
+        } else if (sp + 2 <= BVH_STACK_SIZE) {
+            stack[sp++] = nd.left_first;
+            stack[sp++] = node + 1;
+        }
+    }
+    return false;
+}
+
 // ---------------- MATERIALS ----------------
-bool scatter_lambertian(vec3 rd, vec3 p, vec3 normal, inout vec2 seed, vec3 albedo,
+bool scatter_lambertian(vec3 rd, vec3 p, vec3 normal, inout uint seed, vec3 albedo,
                         out vec3 attenuation, out vec3 scattered)
 {
     vec3 scatter_dir = normal + random_unit_vector(seed);
@@ -111,7 +259,7 @@ bool scatter_lambertian(vec3 rd, vec3 p, vec3 normal, inout vec2 seed, vec3 albe
     return true;
 }
 
-bool scatter_metal(vec3 rd, vec3 p, vec3 normal, inout vec2 seed, vec3 albedo, float fuzz,
+bool scatter_metal(vec3 rd, vec3 p, vec3 normal, inout uint seed, vec3 albedo, float fuzz,
                    out vec3 attenuation, out vec3 scattered)
 {
     vec3 reflected = reflect_vec(normalize(rd), normal);
@@ -120,7 +268,7 @@ bool scatter_metal(vec3 rd, vec3 p, vec3 normal, inout vec2 seed, vec3 albedo, f
     return (dot(scattered, normal) > 0.0);
 }
 
-bool scatter_dielectric(vec3 rd, vec3 p, vec3 geom_normal, inout vec2 seed, float ref_idx,
+bool scatter_dielectric(vec3 rd, vec3 p, vec3 geom_normal, inout uint seed, float ref_idx,
                         out vec3 attenuation, out vec3 scattered)
 {
     attenuation = vec3(1.0); // Glass absorbs nothing
@@ -153,12 +301,300 @@ bool scatter_dielectric(vec3 rd, vec3 p, vec3 geom_normal, inout vec2 seed, floa
     return true;
 }
 
-// ---------------- MAIN ----------------
-void main()
-{
-    // Initialize seed: Screen Coordinate + Time/Frame variation from C++
-    vec2 seed = gl_FragCoord.xy * uSeed;
+// ---------------- LIGHT SAMPLING ----------------
+float safe_sqrt(float x) { return sqrt(max(0.0, x)); }
+
+// cos(max(0, theta_a - theta_b)) and sin(...) from sines/cosines
+float cos_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b) {
+    if (cos_a > cos_b) return 1.0;
+    return cos_a * cos_b + sin_a * sin_b;
+}
+float sin_sub_clamped(float sin_a, float cos_a, float sin_b, float cos_b) {
+    if (cos_a > cos_b) return 0.0;
+    return sin_a * cos_b - cos_a * sin_b;
+}
+
+// Conservative estimate of a light cluster's contribution at p with surface
+// normal n: power over squared distance, bounded by the emission cone and
+// the cosine at the receiver (pbrt's LightBounds::Importance).
+float light_importance(LightNode node, vec3 p, vec3 n) {
+    vec3 pc = 0.5 * (node.bmin + node.bmax);
+    float d2 = dot(p - pc, p - pc);
+    d2 = max(d2, length(node.bmax - node.bmin) * 0.5);
+
+    vec3 wi = normalize(p - pc);
+    float cos_w = dot(node.w, wi);
+    float sin_w = safe_sqrt(1.0 - cos_w * cos_w);
+
+    // Cone of directions subtended by the bounds' bounding sphere
+    float radius2 = 0.25 * dot(node.bmax - node.bmin, node.bmax - node.bmin);
+    float cos_b = (dot(p - pc, p - pc) < radius2) ? -1.0 : safe_sqrt(1.0 - radius2 / dot(p - pc, p - pc));
+    float sin_b = safe_sqrt(1.0 - cos_b * cos_b);
+
+    float sin_o = safe_sqrt(1.0 - node.cos_theta_o * node.cos_theta_o);
+    float cos_x = cos_sub_clamped(sin_w, cos_w, sin_o, node.cos_theta_o);
+    float sin_x = sin_sub_clamped(sin_w, cos_w, sin_o, node.cos_theta_o);
+    float cos_p = cos_sub_clamped(sin_x, cos_x, sin_b, cos_b);
+    if (cos_p <= node.cos_theta_e) return 0.0;
+
+    float importance = node.phi * cos_p / d2;
+
+    // Receiver cosine: only the hemisphere above n reflects
+    float cos_i = dot(-wi, n);
+    float sin_i = safe_sqrt(1.0 - cos_i * cos_i);
+    importance *= max(cos_sub_clamped(sin_i, cos_i, sin_b, cos_b), 0.0);
+    return importance;
+}
+
+// Walk the light BVH choosing children in proportion to their importance.
+// Returns the chosen sphere (or -1) and its selection probability.
+int sample_light_bvh(vec3 p, vec3 n, float u, out float pmf) {
+    pmf = 1.0;
+    if (light_nodes.length() == 0) return -1;
+
+    int node = 0;
+    for (int depth = 0; depth < 64; depth++) {
+        LightNode nd = light_nodes[node];
+        if (nd.is_leaf == 1) {
+            if (node > 0 || light_importance(nd, p, n) > 0.0) return nd.child_or_light;
+            return -1;
+        }
+
+        float c0 = light_importance(light_nodes[node + 1], p, n);
+        float c1 = light_importance(light_nodes[nd.child_or_light], p, n);
+        if (c0 == 0.0 && c1 == 0.0) return -1;
+
+        float p0 = c0 / (c0 + c1);
+        if (u < p0) {
+            node = node + 1;
+            u = min(u / p0, ONE_MINUS_EPSILON);
+            pmf *= p0;
+        } else {
+            node = nd.child_or_light;
+            u = min((u - p0) / (1.0 - p0), ONE_MINUS_EPSILON);
+            pmf *= 1.0 - p0;
+        }
+    }
+    return -1;
+}
+
+// Probability that sample_light_bvh(p, n) picks sphere s, following its bit trail
+float light_bvh_pmf(vec3 p, vec3 n, int s) {
+    uint lo = spheres[s].trail_lo;
+    uint hi = spheres[s].trail_hi;
+    float pmf = 1.0;
+    int node = 0;
+    for (int depth = 0; depth < 64; depth++) {
+        LightNode nd = light_nodes[node];
+        if (nd.is_leaf == 1) return pmf;
+
+        float c0 = light_importance(light_nodes[node + 1], p, n);
+        float c1 = light_importance(light_nodes[nd.child_or_light], p, n);
+        if (c0 + c1 == 0.0) return 0.0;
+
+        bool right = (lo & 1u) != 0u;
+        pmf *= (right ? c1 : c0) / (c0 + c1);
+        node = right ? nd.child_or_light : node + 1;
+        lo = (lo >> 1) | (hi << 31);
+        hi >>= 1;
+    }
+    return 0.0;
+}
+
+int pick_light(vec3 p, vec3 n, float u, out float pmf) {
+    pmf = 0.0;
+    if (light_count == 0) return -1;
+    if (uLightSampling == 1) return sample_light_bvh(p, n, u, pmf);
+
+    pmf = 1.0 / float(light_count);
+    return light_list[min(int(u * float(light_count)), light_count - 1)];
+}
+
+float pick_light_pmf(vec3 p, vec3 n, int s) {
+    if (light_count == 0) return 0.0;
+    if (uLightSampling == 1) return light_bvh_pmf(p, n, s);
+    return 1.0 / float(light_count);
+}
+
+// 1 - cos(theta_max) of the cone subtended by sphere s from p (0 if inside)
+float sphere_cone_one_minus_cos(int s, vec3 p) {
+    vec3 d = spheres[s].center - p;
+    float r = spheres[s].radius;
+    float sin2_max = r * r / dot(d, d);
+    if (sin2_max >= 1.0) return 0.0;
+    // Small-angle series keeps precision for tiny, distant lamps
+    return (sin2_max < 0.00068523) ? 0.5 * sin2_max : 1.0 - sqrt(1.0 - sin2_max);
+}
+
+// Solid-angle density of a cone sample toward sphere s
+float sphere_solid_angle_pdf(int s, vec3 p) {
+    float one_minus_cos = sphere_cone_one_minus_cos(s, p);
+    return (one_minus_cos > 0.0) ? 1.0 / (2.0 * PI * one_minus_cos) : 0.0;
+}
+
+// Uniformly sample a direction in the cone subtended by sphere s
+bool sample_sphere_light(int s, vec3 p, inout uint seed, out vec3 wi, out float dist, out float pdf) {
+    float one_minus_cos = sphere_cone_one_minus_cos(s, p);
+    if (one_minus_cos <= 0.0) return false;
+
+    vec3 axis = normalize(spheres[s].center - p);
+    float cos_t = 1.0 - rand01(seed) * one_minus_cos;
+    float sin_t = safe_sqrt(1.0 - cos_t * cos_t);
+    float phi = 2.0 * PI * rand01(seed);
+
+    vec3 t1 = normalize(abs(axis.x) > 0.9 ? cross(axis, vec3(0.0, 1.0, 0.0)) : cross(axis, vec3(1.0, 0.0, 0.0)));
+    vec3 t2 = cross(axis, t1);
+    wi = normalize(sin_t * cos(phi) * t1 + sin_t * sin(phi) * t2 + cos_t * axis);
+
+    dist = hit_sphere(spheres[s].center, spheres[s].radius, p, wi);
+    if (dist < 0.0) dist = length(spheres[s].center - p) - spheres[s].radius; // grazing
+    pdf = 1.0 / (2.0 * PI * one_minus_cos);
+    return true;
+}
+
+float power_heuristic(float pdf_a, float pdf_b) {
+    float a2 = pdf_a * pdf_a;
+    float b2 = pdf_b * pdf_b;
+    return (a2 + b2 > 0.0) ? a2 / (a2 + b2) : 0.0;
+}
+
+// Next-event estimation of the emissive spheres at a Lambertian point: one
+// light picked by pick_light(), one shadow ray, MIS-weighted against cosine
+// BSDF sampling unless use_mis is off (BSDF rays from p then ignore emitters).
+vec3 sample_direct(vec3 p, vec3 n, vec3 albedo, bool use_mis, inout uint seed) {
+    float pmf;
+    int s = pick_light(p, n, rand01(seed), pmf);
+    if (s < 0 || pmf <= 0.0) return vec3(0.0);
+
+    vec3 wi;
+    float dist, pdf_dir;
+    if (!sample_sphere_light(s, p, seed, wi, dist, pdf_dir)) return vec3(0.0);
+
+    float cos_i = dot(wi, n);
+    if (cos_i <= 0.0) return vec3(0.0);
+    if (occluded(p + wi * 0.001, wi, dist - 0.002)) return vec3(0.0);
+
+    float pdf_light = pmf * pdf_dir;
+    float pdf_bsdf = cos_i / PI;
+    float weight = use_mis ? power_heuristic(pdf_light, pdf_bsdf) : 1.0;
+    return albedo / PI * cos_i * spheres[s].emission * weight / pdf_light;
+}
+
+// ---------------- ENVIRONMENT ----------------
+// Equirectangular map: u = phi / 2pi around +y starting at -x, v = theta / pi
+// from straight up. Texels are importance sampled through a CPU-built alias
+// table in proportion to luminance * sin(theta), i.e. to their share of the
+// radiance over the sphere.
+vec3 env_direction(vec2 uv) {
+    float phi = 2.0 * PI * uv.x;
+    float theta = PI * uv.y;
+    return vec3(-cos(phi) * sin(theta), cos(theta), sin(phi) * sin(theta));
+}
+
+vec2 env_uv(vec3 d) {
+    float phi = atan(d.z, -d.x);
+    if (phi < 0.0) phi += 2.0 * PI;
+    return vec2(phi / (2.0 * PI), acos(clamp(d.y, -1.0, 1.0)) / PI);
+}
+
+int env_texel_index(vec3 d) {
+    ivec2 t = min(ivec2(env_uv(d) * vec2(uEnvSize)), uEnvSize - 1);
+    return t.y * uEnvSize.x + t.x;
+}
+
+// Radiance arriving from direction d (unit) on a miss
+vec3 sky_radiance(vec3 d) {
+    if (uEnvMap == 1)
+        return env_texels[env_texel_index(d)].radiance * uSkyIntensity;
+
+    float tsky = 0.5 * (d.y + 1.0);
+    return mix(vec3(1.0), vec3(0.5, 0.7, 1.0), tsky) * uSkyIntensity;
+}
+
+// Solid-angle density of sample_env() producing direction d
+float env_pdf(vec3 d) {
+    float sin_theta = safe_sqrt(1.0 - d.y * d.y);
+    if (sin_theta <= 0.0) return 0.0;
+    float pmf = env_texels[env_texel_index(d)].pmf;
+    return pmf * float(uEnvSize.x * uEnvSize.y) / (2.0 * PI * PI * sin_theta);
+}
+
+// Alias-table texel pick, then a uniform point inside that texel
+bool sample_env(inout uint seed, out vec3 wi, out float pdf) {
+    int count = uEnvSize.x * uEnvSize.y;
+    int i = min(int(rand01(seed) * float(count)), count - 1);
+    if (rand01(seed) >= env_texels[i].q) i = env_texels[i].alias;
 
+    vec2 uv = (vec2(i % uEnvSize.x, i / uEnvSize.x) + vec2(rand01(seed), rand01(seed))) / vec2(uEnvSize);
+    wi = env_direction(uv);
+    float sin_theta = sin(PI * uv.y);
+    if (sin_theta <= 0.0) return false;
+    pdf = env_texels[i].pmf * float(count) / (2.0 * PI * PI * sin_theta);
+    return pdf > 0.0;
+}
+
+// Next-event estimation of the environment at a Lambertian point, always
+// MIS-weighted: trace_path() weights BSDF rays that escape accordingly.
+vec3 sample_environment(vec3 p, vec3 n, vec3 albedo, inout uint seed) {
+    if (uEnvMap == 0) return vec3(0.0);
+
+    vec3 wi;
+    float pdf_env;
+    if (!sample_env(seed, wi, pdf_env)) return vec3(0.0);
+
+    float cos_i = dot(wi, n);
+    if (cos_i <= 0.0) return vec3(0.0);
+    if (occluded(p + wi * 0.001, wi, 100000.0)) return vec3(0.0);
+
+    float weight = power_heuristic(pdf_env, cos_i / PI);
+    return albedo / PI * cos_i * sky_radiance(wi) * weight / pdf_env;
+}
+
+// ---------------- CAMERA ----------------
+// The path tracing pass traces uSamplesPerFrame camera rays per pixel and
+// averages them. The ReSTIR passes keep to one (a reservoir per pixel), and
+// the host passes 1 while they are on.
+uniform int uSamplesPerFrame;
+
+// While the view holds still (and without defocus blur) the camera rays
+// keep to PRIMARY_CACHE_GRID^2 fixed positions per pixel, whose first hits
+// are cached (binding 15)
+#define PRIMARY_CACHE_GRID 4
+uniform int uPrimaryCache;
+
+// Hybrid mode: the impostor pass rasterized every pixel's first sphere
+// (texture unit 4) for a camera ray at uCameraJitter in the pixel, the same
+// for all pixels and rotating by frame. One ray per pixel, no defocus blur.
+uniform int uHybrid;
+uniform isampler2D uPrimaryIds; // sphere index, -1 = sky
+uniform vec2 uCameraJitter;
+
+// Cell of camera ray s of count in an m x m grid over the pixel. The cells
+// taken rotate with the frame, so counts short of a square cover the grid
+// evenly over frames.
+int pixel_cell(int s, int count) {
+    int m = (uPrimaryCache == 1) ? PRIMARY_CACHE_GRID : int(ceil(sqrt(float(count))));
+    return int((uint(s) + uFrame * uint(count)) % uint(m * m));
+}
+
+// Position of the ray in the pixel: jittered in its cell, or with the cache
+// at a position fixed per pixel and cell (a random stream of its own)
+vec2 pixel_jitter(uvec2 pixel, int cell, int count, inout uint seed) {
+    if (uHybrid == 1) return uCameraJitter;
+    int m = (uPrimaryCache == 1) ? PRIMARY_CACHE_GRID : int(ceil(sqrt(float(count))));
+    vec2 offset;
+    if (uPrimaryCache == 1) {
+        uint fixed_seed = init_seed(pixel, uint(cell), 0u) ^ 0x9E3779B9u;
+        offset = vec2(rand01(fixed_seed), rand01(fixed_seed));
+    } else {
+        offset = vec2(rand01(seed), rand01(seed));
+    }
+    return (vec2(cell % m, cell / m) + offset) / float(m);
+}
+
+// Camera ray through window position frag_coord (gl_FragCoord units)
+void camera_ray(vec2 frag_coord, inout uint seed, out vec3 ro, out vec3 rd)
+{
     // --- Camera Setup ---
     float aspect = WINDOW.x / WINDOW.y;
     float theta = radians(uFOV);
@@ -178,7 +614,7 @@ void main()
     vec3 vertical   = viewport_height * v;
     vec3 lower_left_focus = uCameraOrigin - w * fd - horizontal * 0.5 - vertical * 0.5;
 
-    vec2 pixel_uv = gl_FragCoord.xy / WINDOW;
+    vec2 pixel_uv = frag_coord / WINDOW;
     vec3 pixel_focus_pos = lower_left_focus + pixel_uv.x * horizontal + pixel_uv.y * vertical;
 
     // --- Defocus Blur (Depth of Field) ---
@@ -186,7 +622,6 @@ void main()
     vec3 defocus_disk_u = u * defocus_radius;
     vec3 defocus_disk_v = v * defocus_radius;
 
-    vec3 ro;
     if (uDefocusAngle <= 0.0) {
         ro = uCameraOrigin;
     } else {
@@ -194,51 +629,264 @@ void main()
         ro = uCameraOrigin + lens_rnd.x * defocus_disk_u + lens_rnd.y * defocus_disk_v;
     }
 
-    vec3 rd = normalize(pixel_focus_pos - ro);
+    rd = normalize(pixel_focus_pos - ro);
+}
+
+// Window position (gl_FragCoord units) where a camera at origin looking at
+// look_at sees pos; negative when pos is behind that camera.
+vec2 project_to_screen(vec3 pos, vec3 origin, vec3 look_at)
+{
+    vec3 w = normalize(origin - look_at);
+    vec3 u = normalize(cross(uUp, w));
+    vec3 v = cross(w, u);
+
+    vec3 d = pos - origin;
+    float z = -dot(d, w);
+    if (z <= 1e-4) return vec2(-1.0);
 
+    float h = tan(radians(uFOV) * 0.5);
+    float aspect = WINDOW.x / WINDOW.y;
+    vec2 uv = vec2(0.5 + dot(d, u) / (z * 2.0 * h * aspect),
+                   0.5 + dot(d, v) / (z * 2.0 * h));
+    return uv * WINDOW;
+}
+
+// ---------------- RADIANCE CACHE ----------------
+// World-space hash grid of the radiance leaving Lambertian surfaces, keyed by
+// position (cells double in size with each doubling of camera distance) and
+// by the normal's dominant axis. PASS_CACHE_UPDATE traces full paths for one
+// pixel in every 4x4 tile and adds the radiance leaving each of their
+// Lambertian vertices to that vertex's cell, listing each cell the first time
+// it is touched in a frame; PASS_CACHE_RESOLVE then folds the listed cells'
+// sums into their running means. Paths in the other passes end at the first
+// Lambertian vertex after a diffuse bounce whose cell has enough samples,
+// taking its mean as the rest of the path. Cells that go unsampled for
+// uCacheMaxAge frames are ignored and may be claimed by another key.
+#define PASS_CACHE_UPDATE 3
+#define PASS_CACHE_RESOLVE 4
+
+uniform int uCache;               // 1 = paths may terminate in the cache
+uniform uint uCacheCells;         // table size, a power of two
+uniform float uCacheCellSize;     // cell width within distance 1 of the camera
+uniform float uCacheMinSamples;   // samples a cell needs before paths stop at it
+uniform float uCacheMaxSamples;   // cap on a mean's weight, so it keeps adapting
+uniform uint uCacheMaxAge;        // frames without samples before a cell goes stale
+
+#define CACHE_PROBES 8             // linear probing distance
+#define CACHE_FIXED_POINT 1024.0   // sums are atomically added as 22.10 fixed point
+#define CACHE_MAX_RADIANCE 1024.0  // per-sample clamp, keeps the sums from overflowing
+#define CACHE_MAX_RECORDS 4        // Lambertian vertices an update path records
+
+// Layout matches the buffers allocated in Game::clearRadianceCache()
+struct CacheCell {
+    uint key;           // 0 = never used
+    uint last_frame;    // frame of the last resolved samples
+    uint frame_count;   // samples added this frame
+    float count;        // samples behind radiance (capped)
+    uint frame_sum[4];  // radiance added this frame, fixed point (w unused)
+    vec4 radiance;      // running mean of outgoing radiance (w unused)
+};
+
+layout(std430, binding = 10) buffer RadianceCacheBuffer { CacheCell cache[]; };
+layout(std430, binding = 11) buffer CacheDirtyBuffer {     // cleared by the host every frame
+    uint dirty_count;
+    uint dirty[];       // cells given samples this frame
+};
+
+bool cache_query = false;   // set by main() for the passes that read the cache
+bool cache_update = false;  // set by main() for PASS_CACHE_UPDATE paths
+
+bool cache_stale(uint s) { return uFrame - cache[s].last_frame > uCacheMaxAge; }
+
+// Home slot and key of the cell holding surface point p with normal n
+void cache_cell(vec3 p, vec3 n, out uint slot, out uint key)
+{
+    uint level = uint(max(log2(max(distance(p, uCameraOrigin), 1.0)), 0.0));
+    ivec3 q = ivec3(floor(p / (uCacheCellSize * exp2(float(level)))));
+
+    vec3 a = abs(n);
+    int axis = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+    uint bucket = uint(axis * 2) + (n[axis] < 0.0 ? 1u : 0u);
+
+    uint h = pcg_hash(uint(q.x) + pcg_hash(uint(q.y) + pcg_hash(uint(q.z) + pcg_hash(level * 8u + bucket))));
+    slot = h & (uCacheCells - 1u);
+    key = pcg_hash(h + 0x68bc21ebu) | 1u;
+}
+
+// Cached outgoing radiance at p, when its cell has enough recent samples
+bool cache_lookup(vec3 p, vec3 n, out vec3 radiance)
+{
+    radiance = vec3(0.0);
+    uint slot, key;
+    cache_cell(p, n, slot, key);
+    for (int i = 0; i < CACHE_PROBES; i++) {
+        uint s = (slot + uint(i)) & (uCacheCells - 1u);
+        uint k = cache[s].key;
+        if (k == key) {
+            radiance = cache[s].radiance.rgb;
+            return cache[s].count >= uCacheMinSamples && !cache_stale(s);
+        }
+        if (k == 0u) break;
+    }
+    return false;
+}
+
+// Slot of p's cell, claiming a free or stale one on first use (-1 = none near)
+int cache_insert(vec3 p, vec3 n)
+{
+    uint slot, key;
+    cache_cell(p, n, slot, key);
+    for (int i = 0; i < CACHE_PROBES; i++) {
+        uint s = (slot + uint(i)) & (uCacheCells - 1u);
+        uint k = atomicCompSwap(cache[s].key, 0u, key);
+        if (k == key) return int(s);
+        if (k == 0u || (cache_stale(s) && atomicCompSwap(cache[s].key, k, key) == k)) {
+            // Start from no samples, and keep the cell from being claimed again this frame
+            cache[s].count = 0.0;
+            cache[s].last_frame = uFrame;
+            return int(s);
+        }
+    }
+    return -1;
+}
+
+void cache_add(int s, vec3 radiance)
+{
+    if (s < 0 || any(isnan(radiance)) || any(isinf(radiance))) return;
+    uvec3 v = uvec3(clamp(radiance, 0.0, CACHE_MAX_RADIANCE) * CACHE_FIXED_POINT + 0.5);
+    atomicAdd(cache[s].frame_sum[0], v.r);
+    atomicAdd(cache[s].frame_sum[1], v.g);
+    atomicAdd(cache[s].frame_sum[2], v.b);
+    if (atomicAdd(cache[s].frame_count, 1u) == 0u)
+        dirty[atomicAdd(dirty_count, 1u)] = uint(s);
+}
+
+// Fold cell s's samples from this frame into its mean (restarting it if the
+// cell had gone stale)
+void cache_resolve(uint s)
+{
+    float n = float(cache[s].frame_count);
+    vec3 mean = vec3(cache[s].frame_sum[0], cache[s].frame_sum[1], cache[s].frame_sum[2]) / (CACHE_FIXED_POINT * n);
+    float prev = cache_stale(s) ? 0.0 : cache[s].count;
+    float count = min(prev + n, uCacheMaxSamples);
+
+    cache[s].radiance = vec4(mix(cache[s].radiance.rgb, mean, min(n / count, 1.0)), 0.0);
+    cache[s].count = count;
+    cache[s].last_frame = uFrame;
+    cache[s].frame_count = 0u;
+    cache[s].frame_sum[0] = 0u;
+    cache[s].frame_sum[1] = 0u;
+    cache[s].frame_sum[2] = 0u;
+}
+
+// ---------------- PATH TRACING ----------------
+#define VERTEX_NONE 0     // camera or specular vertex: emitter hits count fully
+#define VERTEX_NEE 1      // Lambertian vertex with next-event estimation: MIS
+#define VERTEX_LIGHTS 2   // vertex whose direct light was fully light-sampled
+                          // (ReSTIR): emitter hits count zero
+                          // Environment hits after either Lambertian kind are
+                          // MIS-weighted against sample_environment().
+#define HIT_UNKNOWN -2
+
+// Radiance arriving along (ro, rd) from at most max_depth vertices.
+// first_vertex describes the vertex the ray leaves and first_pdf the
+// solid-angle density it sampled rd with; first_hit/first_t may supply an
+// already traced first intersection (HIT_UNKNOWN = trace it).
+vec3 trace_path(vec3 ro, vec3 rd, inout uint seed, int max_depth, int first_vertex,
+                float first_pdf, int first_hit, float first_t)
+{
     // --- Path Tracing Loop ---
     vec3 throughput = vec3(1.0);
     vec3 final_color = vec3(0.0);
 
-    for (int depth = 0; depth < uMaxDepth; depth++)
+    // Previous Lambertian vertex, for MIS when its BSDF ray lands on a light
+    int prev_vertex = first_vertex;
+    vec3 prev_p = vec3(0.0);
+    vec3 prev_n = vec3(0.0);
+    float prev_bsdf_pdf = first_pdf;
+
+    // Radiance cache: Lambertian vertices so far, and for update paths the
+    // cell, throughput and radiance total at each one they record
+    int diffuse_vertices = (first_vertex != VERTEX_NONE) ? 1 : 0;
+    int records = 0;
+    int record_cell[CACHE_MAX_RECORDS];
+    vec3 record_throughput[CACHE_MAX_RECORDS];
+    vec3 record_color[CACHE_MAX_RECORDS];
+
+    for (int depth = 0; depth < max_depth; depth++)
     {
         float closest_t = 100000.0; // Infinity
-        int hit_id = -1;
-
-        // Iterate all spheres
-        for (int i = 0; i < sphere_count; i++)
-        {
-            float t = hit_sphere(sphere_centers[i], sphere_radii[i], ro, rd);
-            if (t > 0.001 && t < closest_t) { 
-                closest_t = t; 
-                hit_id = i; 
-            }
+        int hit_id;
+        if (depth == 0 && first_hit != HIT_UNKNOWN) {
+            hit_id = first_hit;
+            closest_t = first_t;
+        } else {
+            hit_id = trace_closest(ro, rd, closest_t);
         }
 
         // --- MISS: Sky Background ---
         if (hit_id == -1) {
             vec3 unit_direction = normalize(rd);
-            float tsky = 0.5 * (unit_direction.y + 1.0);
-            vec3 sky = mix(vec3(1.0), vec3(0.5, 0.7, 1.0), tsky);
-            final_color += throughput * sky;
+            float weight = 1.0;
+            if (uEnvMap == 1 && prev_vertex != VERTEX_NONE)
+                weight = power_heuristic(prev_bsdf_pdf, env_pdf(unit_direction));
+            final_color += throughput * sky_radiance(unit_direction) * weight;
             break;
         }
 
         // --- HIT: Scatter ---
         vec3 p = ro + closest_t * rd;
-        vec3 geom_normal = normalize(p - sphere_centers[hit_id]);
+        vec3 geom_normal = normalize(p - spheres[hit_id].center);
+
+        int m = spheres[hit_id].material;
+        vec3 albedo = spheres[hit_id].albedo;
+        float fuzz = spheres[hit_id].fuzz;
+        float ref_idx = spheres[hit_id].ref_idx;
 
-        int m = sphere_material[hit_id];
-        vec3 albedo = sphere_albedo[hit_id];
-        float fuzz = sphere_fuzz[hit_id];
-        float ref_idx = sphere_ref_idx[hit_id];
+        // --- HIT: Emitter ---
+        if (m == MAT_DIFFUSE_LIGHT) {
+            if (dot(rd, geom_normal) < 0.0) {
+                float weight = (prev_vertex == VERTEX_LIGHTS) ? 0.0 : 1.0;
+                if (prev_vertex == VERTEX_NEE) {
+                    float pdf_light = pick_light_pmf(prev_p, prev_n, hit_id) * sphere_solid_angle_pdf(hit_id, prev_p);
+                    weight = power_heuristic(prev_bsdf_pdf, pdf_light);
+                }
+                final_color += throughput * spheres[hit_id].emission * weight;
+            }
+            break;
+        }
 
         vec3 attenuation;
         vec3 scattered;
         bool ok = false;
+        prev_vertex = VERTEX_NONE;
+
+        if (m == MAT_LAMBERTIAN) {
+            vec3 n = dot(rd, geom_normal) < 0.0 ? geom_normal : -geom_normal;
 
-        if (m == MAT_LAMBERTIAN)
-            ok = scatter_lambertian(rd, p, geom_normal, seed, albedo, attenuation, scattered);
+            // Past the first diffuse bounce a converged cache cell stands in for the rest of the path
+            vec3 cached;
+            if (cache_query && diffuse_vertices > 0 && cache_lookup(p, n, cached)) {
+                final_color += throughput * cached;
+                break;
+            }
+            if (cache_update && records < CACHE_MAX_RECORDS) {
+                record_cell[records] = cache_insert(p, n);
+                record_throughput[records] = throughput;
+                record_color[records] = final_color;
+                records++;
+            }
+            diffuse_vertices++;
+
+            final_color += throughput * (sample_direct(p, n, albedo, true, seed) +
+                                         sample_environment(p, n, albedo, seed));
+            prev_vertex = VERTEX_NEE;
+            ok = scatter_lambertian(rd, p, n, seed, albedo, attenuation, scattered);
+
+            prev_p = p;
+            prev_n = n;
+            prev_bsdf_pdf = max(dot(scattered, n), 0.0) / PI;
+        }
         else if (m == MAT_METAL)
             ok = scatter_metal(rd, p, geom_normal, seed, albedo, fuzz, attenuation, scattered);
         else if (m == MAT_DIELECTRIC)
@@ -259,5 +907,993 @@ void main()
         rd = scattered;
     }
 
-    FragColor = vec4(gamma_correct(final_color), 1.0);
-}
\ No newline at end of file
+    // Everything gathered after a recorded vertex, divided by the throughput
+    // reaching it, is the radiance that vertex sends back along the path
+    for (int i = 0; i < records; i++) {
+        vec3 t = record_throughput[i];
+        vec3 l = final_color - record_color[i];
+        cache_add(record_cell[i], vec3(t.r > 0.0 ? l.r / t.r : 0.0,
+                                       t.g > 0.0 ? l.g / t.g : 0.0,
+                                       t.b > 0.0 ? l.b / t.b : 0.0));
+    }
+
+    return final_color;
+}
+
+// ---------------- INTERLEAVE ----------------
+// Interleaved rendering: with uInterleave 2 the shading passes trace a
+// checkerboard, alternating each frame; with 4, one pixel of every 2x2
+// block in turn. They draw over a viewport packed to just those pixels (so
+// no SIMD lanes idle on skipped ones) and write their samples there;
+// PASS_TEMPORAL then traces only the primary hit of the other pixels, which
+// carry their history over, and history_filled fills any that do not
+// reproject from their neighbours.
+uniform int uInterleave;           // 1 = every pixel, 2 = checkerboard, 4 = one pixel in 2x2
+
+const uint INTERLEAVE_ORDER[4] = uint[4](0u, 3u, 1u, 2u); // 2x2 blocks: diagonal pairs first
+
+bool interleave_traced(ivec2 p) {
+    if (uInterleave == 2) return ((uint(p.x + p.y) + uFrame) & 1u) == 0u;
+    if (uInterleave == 4) return uint((p.x & 1) + 2 * (p.y & 1)) == INTERLEAVE_ORDER[uFrame & 3u];
+    return true;
+}
+
+// Pixel a fragment of the packed viewport traces, and back
+ivec2 interleave_pixel(ivec2 frag) {
+    if (uInterleave == 2) return ivec2(2 * frag.x + int((uint(frag.y) + uFrame) & 1u), frag.y);
+    if (uInterleave == 4) {
+        uint k = INTERLEAVE_ORDER[uFrame & 3u];
+        return 2 * frag + ivec2(k & 1u, k >> 1u);
+    }
+    return frag;
+}
+
+ivec2 interleave_fragment(ivec2 pixel) {
+    if (uInterleave == 2) return ivec2(pixel.x / 2, pixel.y);
+    if (uInterleave == 4) return pixel / 2;
+    return pixel;
+}
+
+// ---------------- FOVEATION ----------------
+// Full sampling rate near a focus point, every 2nd or 4th frame farther out,
+// per FOVEA_TILE-pixel tile (see include/foveation.h, which mirrors this).
+// Skipped tiles carry their history over like pixels the interleave pattern
+// skips. Applied on top of the interleave pattern.
+#define FOVEA_TILE 8
+#define FOVEA_MAX_RATE 4
+
+uniform int uFovea;                // 1 = foveated sampling
+uniform vec2 uFoveaCenter;         // focus point in [0, 1] of the traced image
+uniform float uFoveaRadius;        // full-rate radius as a fraction of the traced height
+
+uint fovea_rate(ivec2 tile) {
+    vec2 d = (vec2(tile) + 0.5) * float(FOVEA_TILE) - uFoveaCenter * WINDOW;
+    int rings = int(length(d) / (uFoveaRadius * WINDOW.y));
+    return uint(min(1 << min(rings, 8), FOVEA_MAX_RATE));
+}
+
+bool fovea_traced(ivec2 pixel) {
+    if (uFovea == 0) return true;
+    ivec2 tile = pixel / FOVEA_TILE;
+    return (uFrame + uint(tile.x + 2 * tile.y)) % fovea_rate(tile) == 0u;
+}
+
+// ---------------- RESTIR ----------------
+// Reservoir-based spatiotemporal resampling at the primary hit, for direct
+// light samples (DI) and for secondary-bounce path samples (GI).
+// PASS_RESTIR_INITIAL traces the primary ray, streams fresh samples into
+// per-pixel reservoirs and merges last frame's reservoir at the
+// reprojected pixel. PASS_RESTIR_SHADE merges neighbour reservoirs, checks
+// visibility of the surviving samples only and shades the pixel.
+#define PASS_PATH 0
+#define PASS_RESTIR_INITIAL 1
+#define PASS_RESTIR_SHADE 2
+
+uniform int uPass;
+uniform int uRestirDI;            // resample direct light (needs emitters)
+uniform int uRestirGI;            // resample indirect light
+uniform int uRestirCandidates;
+uniform int uRestirSpatialSamples;
+uniform float uRestirRadius;      // spatial reuse radius in pixels
+uniform int uRestirHistory;       // 0 when last frame's reservoirs are invalid
+uniform vec3 uPrevCameraOrigin;
+uniform vec3 uPrevLookAt;
+
+#define RESTIR_TEMPORAL_MAX_M 20.0 // history may outweigh fresh samples at most 20:1
+
+int pixel_index(ivec2 p) { return p.y * int(WINDOW.x) + p.x; }
+
+float luminance(vec3 c) { return dot(c, vec3(0.2126, 0.7152, 0.0722)); }
+
+// ---------------- PRIMARY HIT CACHE ----------------
+// The sphere each fixed camera ray hits first, 16 bits per pixel cell (two
+// cells to a uint): 0 = not traced yet, else the sphere index + 2 (1 = sky).
+// The host clears it when the view or scene changes. A cached ray only
+// intersects its sphere again for the distance, instead of the whole BVH.
+layout(std430, binding = 15) buffer PrimaryCacheBuffer { uint primary_cache[]; };
+
+// First hit of camera ray (ro, rd) through cell of pixel, as trace_closest()
+int camera_hit(ivec2 pixel, int cell, vec3 ro, vec3 rd, inout float t) {
+    if (uHybrid == 1) {
+        // A grazing ray the raster found may just miss here: trace it
+        int hit_id = texelFetch(uPrimaryIds, pixel, 0).r;
+        if (hit_id < 0) return hit_id;
+        float ht = hit_sphere(spheres[hit_id].center, spheres[hit_id].radius, ro, rd);
+        if (ht > 0.001) {
+            t = ht;
+            return hit_id;
+        }
+        return trace_closest(ro, rd, t);
+    }
+    if (uPrimaryCache == 0) return trace_closest(ro, rd, t);
+
+    uint slot = uint(pixel_index(pixel) * PRIMARY_CACHE_GRID * PRIMARY_CACHE_GRID + cell);
+    uint shift = 16u * (slot % 2u);
+    uint code = (primary_cache[slot / 2u] >> shift) & 0xFFFFu;
+    if (code == 0u) {
+        int hit_id = trace_closest(ro, rd, t);
+        if (hit_id + 2 <= 0xFFFF)
+            atomicOr(primary_cache[slot / 2u], uint(hit_id + 2) << shift);
+        return hit_id;
+    }
+    int hit_id = int(code) - 2;
+    if (hit_id >= 0)
+        t = hit_sphere(spheres[hit_id].center, spheres[hit_id].radius, ro, rd);
+    return hit_id;
+}
+
+// --- DI reservoirs ---
+// Layout matches the reservoir buffers allocated in Game::resizeRenderTargets().
+// Besides the light sample, each one records the primary hit it belongs to,
+// which is also what the similarity tests and GI reuse read.
+struct Reservoir {
+    vec3 light_pos; int light;   // chosen point on an emitter and its sphere (-1 = none)
+    vec3 pos;       int hit_id;  // primary hit this reservoir belongs to (-1 = sky)
+    vec3 normal;    float M;     // its facing normal; number of candidates represented
+    float w_sum;    float W;     // running resampling weight; unbiased contribution weight
+    float pad0;     float pad1;
+};
+
+layout(std430, binding = 5) buffer RestirFinalBuffer { Reservoir restir_final[]; };     // shaded, reused next frame
+layout(std430, binding = 6) buffer RestirInitialBuffer { Reservoir restir_initial_buf[]; }; // candidates + temporal
+
+// Unshadowed Lambertian contribution of light sample (light, y) at (pos, n)
+vec3 restir_contribution(vec3 pos, vec3 n, vec3 albedo, int light, vec3 y) {
+    vec3 d = y - pos;
+    float dist2 = dot(d, d);
+    vec3 wi = d * inversesqrt(dist2);
+    float cos_x = dot(n, wi);
+    float cos_y = dot(normalize(y - spheres[light].center), -wi);
+    if (cos_x <= 0.0 || cos_y <= 0.0) return vec3(0.0);
+    return albedo / PI * spheres[light].emission * cos_x * cos_y / dist2;
+}
+
+void reservoir_update(inout Reservoir r, int light, vec3 y, float w, float count, inout uint seed) {
+    r.w_sum += w;
+    r.M += count;
+    if (w > 0.0 && rand01(seed) * r.w_sum < w) {
+        r.light = light;
+        r.light_pos = y;
+    }
+}
+
+// Fold another reservoir in, re-targeting its sample to this pixel's surface
+void reservoir_merge(inout Reservoir r, Reservoir other, vec3 albedo, inout uint seed) {
+    float target = 0.0;
+    if (other.light >= 0)
+        target = luminance(restir_contribution(r.pos, r.normal, albedo, other.light, other.light_pos));
+    reservoir_update(r, other.light, other.light_pos, target * other.W * other.M, other.M, seed);
+}
+
+void reservoir_finalize(inout Reservoir r, vec3 albedo) {
+    float target = 0.0;
+    if (r.light >= 0)
+        target = luminance(restir_contribution(r.pos, r.normal, albedo, r.light, r.light_pos));
+    r.W = (target > 0.0 && r.M > 0.0) ? r.w_sum / (r.M * target) : 0.0;
+}
+
+// Reuse is only valid between samples on (nearly) the same surface
+bool restir_similar(Reservoir r, Reservoir other) {
+    if (other.hit_id < 0 || spheres[other.hit_id].material != MAT_LAMBERTIAN) return false;
+    float depth = length(r.pos - uCameraOrigin);
+    return dot(r.normal, other.normal) > 0.9 &&
+           abs(dot(other.pos - r.pos, r.normal)) < 0.01 * depth;
+}
+
+// --- GI reservoirs ---
+// A sample is a secondary vertex x_s seen from the primary hit x_v, with the
+// radiance leaving x_s toward x_v. Reusing it at another primary hit
+// reconnects to the same x_s, so its density changes by the solid-angle
+// Jacobian of that reconnection.
+struct GIReservoir {
+    vec3 sample_pos;    float w_sum;  // secondary hit x_s (far along the ray for sky)
+    vec3 sample_normal; float M;      // its normal, facing x_v
+    vec3 radiance;      float W;      // outgoing radiance from x_s toward x_v
+    vec3 visible_pos;   float pad;    // x_v the weights are expressed at
+};
+
+layout(std430, binding = 7) buffer GIFinalBuffer { GIReservoir gi_final[]; };
+layout(std430, binding = 8) buffer GIInitialBuffer { GIReservoir gi_initial_buf[]; };
+
+#define GI_SKY_DISTANCE 10000.0
+#define GI_MAX_JACOBIAN 10.0
+
+float gi_target(vec3 pos, vec3 n, vec3 albedo, GIReservoir g) {
+    vec3 wi = normalize(g.sample_pos - pos);
+    return luminance(albedo / PI * g.radiance * max(dot(n, wi), 0.0));
+}
+
+// |d omega_old / d omega_new| inverse: scales W when moving the sample's
+// visible point from g.visible_pos to new_pos. 0 when the reconnection is
+// unusable (x_s faces away or the density change is extreme).
+float gi_jacobian(vec3 new_pos, GIReservoir g) {
+    vec3 to_new = new_pos - g.sample_pos;
+    vec3 to_old = g.visible_pos - g.sample_pos;
+    float d_new2 = dot(to_new, to_new);
+    float d_old2 = dot(to_old, to_old);
+    float cos_new = dot(g.sample_normal, to_new) * inversesqrt(d_new2);
+    float cos_old = dot(g.sample_normal, to_old) * inversesqrt(d_old2);
+    if (cos_new <= 0.0 || cos_old <= 0.0) return 0.0;
+
+    float jacobian = (cos_new / cos_old) * (d_old2 / d_new2);
+    return (jacobian > GI_MAX_JACOBIAN || jacobian < 1.0 / GI_MAX_JACOBIAN) ? 0.0 : jacobian;
+}
+
+void gi_merge(inout GIReservoir r, GIReservoir other, vec3 pos, vec3 n, vec3 albedo, inout uint seed) {
+    float jacobian = gi_jacobian(pos, other);
+    if (jacobian <= 0.0) return;
+
+    float w = gi_target(pos, n, albedo, other) * other.W * other.M * jacobian;
+    r.w_sum += w;
+    r.M += other.M;
+    if (w > 0.0 && rand01(seed) * r.w_sum < w) {
+        r.sample_pos = other.sample_pos;
+        r.sample_normal = other.sample_normal;
+        r.radiance = other.radiance;
+    }
+}
+
+void gi_finalize(inout GIReservoir r, vec3 pos, vec3 n, vec3 albedo) {
+    float target = gi_target(pos, n, albedo, r);
+    r.W = (target > 0.0 && r.M > 0.0) ? r.w_sum / (r.M * target) : 0.0;
+    r.visible_pos = pos;
+}
+
+GIReservoir gi_empty(vec3 pos) {
+    GIReservoir g;
+    g.sample_pos = pos;
+    g.sample_normal = vec3(0.0);
+    g.radiance = vec3(0.0);
+    g.visible_pos = pos;
+    g.w_sum = 0.0;
+    g.M = 0.0;
+    g.W = 0.0;
+    g.pad = 0.0;
+    return g;
+}
+
+// Fresh sample: cosine-sample a bounce from x_v and path trace the rest.
+// Emission at x_s itself is left out (it is x_v's direct light).
+GIReservoir gi_initial(vec3 pos, vec3 n, vec3 albedo, inout uint seed) {
+    vec3 attenuation, dir;
+    scatter_lambertian(-n, pos, n, seed, albedo, attenuation, dir);
+
+    vec3 ro = pos + dir * 0.001;
+    float t = 100000.0;
+    int hit = trace_closest(ro, dir, t);
+
+    GIReservoir g = gi_empty(pos);
+    float pdf = max(dot(dir, n), 0.0) / PI;
+    g.radiance = trace_path(ro, dir, seed, uMaxDepth - 1, VERTEX_LIGHTS, pdf, hit, t);
+    if (hit >= 0) {
+        g.sample_pos = ro + t * dir;
+        vec3 ns = normalize(g.sample_pos - spheres[hit].center);
+        g.sample_normal = dot(ns, dir) < 0.0 ? ns : -ns;
+    } else {
+        g.sample_pos = pos + dir * GI_SKY_DISTANCE;
+        g.sample_normal = -dir;
+    }
+
+    float w = (pdf > 0.0) ? gi_target(pos, n, albedo, g) / pdf : 0.0;
+    g.w_sum = w;
+    g.M = 1.0;
+    gi_finalize(g, pos, n, albedo);
+    return g;
+}
+
+// --- Passes ---
+void restir_initial(ivec2 frag, int cell, vec3 ro, vec3 rd, inout uint seed) {
+    int pixel = pixel_index(frag);
+
+    Reservoir r;
+    r.light = -1;
+    r.light_pos = vec3(0.0);
+    r.w_sum = 0.0;
+    r.M = 0.0;
+    r.W = 0.0;
+    r.pad0 = 0.0;
+    r.pad1 = 0.0;
+
+    float t = 100000.0;
+    r.hit_id = camera_hit(frag, cell, ro, rd, t);
+    r.pos = ro + t * rd;
+    r.normal = vec3(0.0);
+
+    GIReservoir g = gi_empty(r.pos);
+    if (r.hit_id < 0 || spheres[r.hit_id].material != MAT_LAMBERTIAN) {
+        restir_initial_buf[pixel] = r;
+        gi_initial_buf[pixel] = g;
+        return;
+    }
+
+    vec3 geom_normal = normalize(r.pos - spheres[r.hit_id].center);
+    r.normal = dot(rd, geom_normal) < 0.0 ? geom_normal : -geom_normal;
+    vec3 albedo = spheres[r.hit_id].albedo;
+
+    // --- DI candidates: light BVH / uniform pick + cone sample, weighted by
+    // unshadowed contribution over source density (area measure) ---
+    bool di = (uRestirDI == 1 && light_count > 0);
+    for (int i = 0; di && i < uRestirCandidates; i++) {
+        float pmf;
+        int s = pick_light(r.pos, r.normal, rand01(seed), pmf);
+        vec3 wi;
+        float dist, pdf_dir;
+        if (s < 0 || pmf <= 0.0 || !sample_sphere_light(s, r.pos, seed, wi, dist, pdf_dir)) {
+            r.M += 1.0;
+            continue;
+        }
+        vec3 y = r.pos + wi * dist;
+        float cos_y = dot(normalize(y - spheres[s].center), -wi);
+        float pdf_area = pmf * pdf_dir * max(cos_y, 0.0) / (dist * dist);
+        float target = luminance(restir_contribution(r.pos, r.normal, albedo, s, y));
+        reservoir_update(r, s, y, pdf_area > 0.0 ? target / pdf_area : 0.0, 1.0, seed);
+    }
+    if (di) reservoir_finalize(r, albedo);
+
+    // --- GI candidate: one fresh secondary path ---
+    if (uRestirGI == 1) g = gi_initial(r.pos, r.normal, albedo, seed);
+
+    // --- Temporal: last frame's shaded reservoirs where this point was ---
+    if (uRestirHistory == 1) {
+        vec2 prev = project_to_screen(r.pos, uPrevCameraOrigin, uPrevLookAt);
+        if (all(greaterThanEqual(prev, vec2(0.0))) && all(lessThan(prev, WINDOW))) {
+            int prev_pixel = pixel_index(ivec2(prev));
+            Reservoir h = restir_final[prev_pixel];
+            if (restir_similar(r, h)) {
+                if (di) {
+                    Reservoir merged = r;
+                    merged.w_sum = 0.0;
+                    merged.M = 0.0;
+                    reservoir_merge(merged, r, albedo, seed);
+                    h.M = min(h.M, RESTIR_TEMPORAL_MAX_M * float(uRestirCandidates));
+                    reservoir_merge(merged, h, albedo, seed);
+                    reservoir_finalize(merged, albedo);
+                    r = merged;
+                }
+                if (uRestirGI == 1) {
+                    GIReservoir gh = gi_final[prev_pixel];
+                    gh.M = min(gh.M, RESTIR_TEMPORAL_MAX_M);
+                    GIReservoir merged = gi_empty(r.pos);
+                    gi_merge(merged, g, r.pos, r.normal, albedo, seed);
+                    gi_merge(merged, gh, r.pos, r.normal, albedo, seed);
+                    gi_finalize(merged, r.pos, r.normal, albedo);
+                    g = merged;
+                }
+            }
+        }
+    }
+
+    restir_initial_buf[pixel] = r;
+    gi_initial_buf[pixel] = g;
+}
+
+vec3 restir_shade(ivec2 frag, vec3 ro, vec3 rd, inout uint seed) {
+    int pixel = pixel_index(frag);
+    Reservoir r = restir_initial_buf[pixel];
+    GIReservoir g = gi_initial_buf[pixel];
+    float primary_t = length(r.pos - ro);
+
+    if (r.hit_id < 0 || spheres[r.hit_id].material != MAT_LAMBERTIAN) {
+        restir_final[pixel] = r;
+        gi_final[pixel] = g;
+        return trace_path(ro, rd, seed, uMaxDepth, VERTEX_NONE, 0.0, r.hit_id, primary_t);
+    }
+    vec3 albedo = spheres[r.hit_id].albedo;
+
+    // --- Spatial: merge a few similar neighbours ---
+    Reservoir s = r;
+    s.w_sum = 0.0;
+    s.M = 0.0;
+    reservoir_merge(s, r, albedo, seed);
+    GIReservoir gs = gi_empty(r.pos);
+    gi_merge(gs, g, r.pos, r.normal, albedo, seed);
+
+    for (int i = 0; i < uRestirSpatialSamples; i++) {
+        ivec2 q = frag + ivec2(random_in_unit_disk(seed) * uRestirRadius);
+        if (q == frag || any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, ivec2(WINDOW)))) continue;
+        int qi = pixel_index(q);
+        Reservoir nb = restir_initial_buf[qi];
+        if (!restir_similar(r, nb)) continue;
+        reservoir_merge(s, nb, albedo, seed);
+        if (uRestirGI == 1) gi_merge(gs, gi_initial_buf[qi], r.pos, r.normal, albedo, seed);
+    }
+    reservoir_finalize(s, albedo);
+    gi_finalize(gs, r.pos, r.normal, albedo);
+
+    // --- Direct: one shadow ray for the surviving light sample ---
+    vec3 direct = vec3(0.0);
+    if (uRestirDI == 1 && light_count > 0) {
+        if (s.light >= 0 && s.W > 0.0) {
+            vec3 d = s.light_pos - s.pos;
+            float dist = length(d);
+            vec3 wi = d / dist;
+            if (occluded(s.pos + wi * 0.001, wi, dist - 0.002))
+                s.W = 0.0; // don't let later frames reuse an invisible sample
+            else
+                direct = restir_contribution(s.pos, s.normal, albedo, s.light, s.light_pos) * s.W;
+        }
+    } else {
+        direct = sample_direct(r.pos, r.normal, albedo, false, seed);
+    }
+    direct += sample_environment(r.pos, r.normal, albedo, seed);
+    restir_final[pixel] = s;
+
+    // --- Indirect: reused path sample, or continue the path ---
+    vec3 indirect = vec3(0.0);
+    if (uRestirGI == 1) {
+        // A neighbour's x_s may be hidden from this pixel's x_v: fall back to
+        // this pixel's own reservoir rather than going black (a zero-weight
+        // reservoir would also dilute the history for the next 20 frames).
+        if (gs.W > 0.0 && gs.sample_pos != g.sample_pos) {
+            vec3 d = gs.sample_pos - r.pos;
+            float dist = length(d);
+            vec3 wi = d / dist;
+            if (occluded(r.pos + wi * 0.001, wi, dist - 0.002)) gs = g;
+        }
+        vec3 wi = normalize(gs.sample_pos - r.pos);
+        indirect = albedo / PI * gs.radiance * max(dot(r.normal, wi), 0.0) * gs.W;
+        gi_final[pixel] = gs;
+    } else {
+        vec3 attenuation, dir;
+        scatter_lambertian(rd, r.pos, r.normal, seed, albedo, attenuation, dir);
+        float pdf = max(dot(dir, r.normal), 0.0) / PI;
+        indirect = attenuation * trace_path(r.pos + dir * 0.001, dir, seed, uMaxDepth - 1, VERTEX_LIGHTS, pdf,
+                                            HIT_UNKNOWN, 0.0);
+    }
+
+    return direct + indirect;
+}
+
+// ---------------- ACCUMULATION ----------------
+// Per-pixel history: the running mean of radiance (rgb) and the number of
+// samples behind it (a), plus the mean squared luminance in a second target.
+// The shading passes record each pixel's primary hit and write its new
+// sample to a separate target; PASS_TEMPORAL blends that into last frame's
+// history. If the camera moved, the primary hit is reprojected with last
+// frame's camera and the history there is reused only if that pixel saw the
+// same sphere at a similar depth and normal (also when the traced
+// resolution changed, which counts as a move). While moving, history counts at most
+// TEMPORAL_MAX_HISTORY samples, which turns the blend into an exponential
+// moving average; once the camera stops it converges like plain
+// accumulation. A new quality tier keeps the history too, counted as at
+// most TIER_MAX_HISTORY samples, so the preview fades as the new tier's
+// samples come in. PASS_DISPLAY shows the mean, upscaled from the traced
+// resolution to the window (see UPSCALER); PASS_ERROR writes each pixel's
+// estimated relative MSE (var / n / (mean^2 + 0.01), as Film::error on the
+// CPU), which the host averages through the mip chain.
+#define PASS_DISPLAY 5
+#define PASS_ERROR 6
+#define PASS_TEMPORAL 8
+#define TEMPORAL_MAX_HISTORY 16.0
+#define TIER_MAX_HISTORY 1.0
+
+uniform sampler2D uSamples;        // this frame's shading pass output (packed when interleaved)
+
+uniform sampler2D uDenoiseInput;   // denoiser ping-pong input; for display, its result
+uniform int uDisplayDenoised;      // 1 = display uDenoiseInput instead of the history
+
+uniform sampler2D uHistory;        // mean (rgb), samples (a): last frame's, or this frame's
+                                   // for the other passes
+uniform sampler2D uHistoryMoments; // mean squared luminance (r)
+uniform int uHistoryValid;         // 0 = start over (scene or settings changed)
+uniform int uCameraMoved;          // 1 = reproject the history
+uniform int uTierChanged;          // 1 = the history was shaded at another quality tier
+uniform vec2 uPrevWindow;          // last frame's traced resolution
+
+// Layout matches the primary hit buffers allocated in Game::resizeRenderTargets().
+// They also serve as the denoiser's guides and as exported AOVs.
+struct PrimaryHit {
+    vec3 pos;    int id;      // primary hit (far along the ray for sky, id -1)
+    vec3 normal; float depth; // outward sphere normal; distance along the ray
+    vec3 albedo; float pad;   // Lambertian/metal albedo, 1 for glass, lights and sky
+};
+
+layout(std430, binding = 12) buffer PrimaryHitBuffer { PrimaryHit primary_hits[]; };          // this frame
+layout(std430, binding = 13) buffer PrevPrimaryHitBuffer { PrimaryHit prev_primary_hits[]; }; // last frame
+
+bool temporal_similar(PrimaryHit a, PrimaryHit b) {
+    if (a.id != b.id) return false;
+    if (a.id < 0) return true;
+    float depth = length(a.pos - uCameraOrigin);
+    return dot(a.normal, b.normal) > 0.9 && abs(dot(b.pos - a.pos, a.normal)) < 0.01 * depth;
+}
+
+PrimaryHit primary_hit(vec3 ro, vec3 rd, int hit_id, float t) {
+    PrimaryHit h;
+    h.id = hit_id;
+    h.pos = ro + rd * (hit_id < 0 ? GI_SKY_DISTANCE : t);
+    h.normal = hit_id < 0 ? vec3(0.0) : normalize(h.pos - spheres[hit_id].center);
+    h.depth = hit_id < 0 ? GI_SKY_DISTANCE : t;
+    h.albedo = vec3(1.0);
+    if (hit_id >= 0 && (spheres[hit_id].material == MAT_LAMBERTIAN || spheres[hit_id].material == MAT_METAL))
+        h.albedo = spheres[hit_id].albedo;
+    h.pad = 0.0;
+    return h;
+}
+
+// Adaptive sampling (CpuTracer::adaptiveThreshold on the GPU). While the
+// view holds still, a pixel with ADAPTIVE_MIN_SAMPLES samples is skipped
+// once its estimated relative MSE and its 3x3 neighbours' (the last
+// PASS_ERROR output, for the history this sample reads) are at most
+// uAdaptive. Converged regions are skipped as a whole, so the shading
+// passes' fragments there return together.
+#define ADAPTIVE_MIN_SAMPLES 16.0
+
+uniform float uAdaptive;        // 0 = trace every pixel
+uniform sampler2D uConvergence; // per-pixel relative MSE
+
+bool adaptive_traced(ivec2 pixel) {
+    if (uAdaptive <= 0.0 || texelFetch(uHistory, pixel, 0).a < ADAPTIVE_MIN_SAMPLES) return true;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            ivec2 q = clamp(pixel + ivec2(dx, dy), ivec2(0), ivec2(WINDOW) - 1);
+            if (texelFetch(uConvergence, q, 0).r > uAdaptive) return true;
+        }
+    }
+    return false;
+}
+
+// PASS_TEMPORAL: blend the pixel's new sample (from the shading passes'
+// target) into the history. Pixels the interleave pattern or foveation
+// skipped trace their primary hit here and only carry their history over;
+// converged pixels keep last frame's, as the view has not moved.
+void temporal_resolve(ivec2 pixel, vec3 ro, vec3 rd) {
+    bool converged = !adaptive_traced(pixel);
+    bool traced = !converged && interleave_traced(pixel) && fovea_traced(pixel);
+    PrimaryHit cur;
+    vec4 sample_color = vec4(0.0); // mean radiance, mean squared luminance
+    if (traced) {
+        cur = primary_hits[pixel_index(pixel)];
+        sample_color = texelFetch(uSamples, interleave_fragment(pixel), 0);
+    } else if (converged) {
+        cur = prev_primary_hits[pixel_index(pixel)];
+        primary_hits[pixel_index(pixel)] = cur;
+    } else {
+        float t = 100000.0;
+        int hit_id = trace_closest(ro, rd, t);
+        cur = primary_hit(ro, rd, hit_id, t);
+        primary_hits[pixel_index(pixel)] = cur;
+    }
+
+    vec4 history = vec4(0.0);
+    float moments = 0.0;
+    if (uHistoryValid == 1) {
+        ivec2 prev = pixel;
+        bool reuse = true;
+        if (uCameraMoved == 1) {
+            vec2 p = project_to_screen(cur.pos, uPrevCameraOrigin, uPrevLookAt) * (uPrevWindow / WINDOW);
+            reuse = all(greaterThanEqual(p, vec2(0.0))) && all(lessThan(p, uPrevWindow));
+            prev = ivec2(p);
+            reuse = reuse && temporal_similar(cur, prev_primary_hits[prev.y * int(uPrevWindow.x) + prev.x]);
+        }
+        if (reuse) {
+            history = texelFetch(uHistory, prev, 0);
+            moments = texelFetch(uHistoryMoments, prev, 0).r;
+        }
+    }
+
+    float n = history.a;
+    if (uCameraMoved == 1) n = min(n, TEMPORAL_MAX_HISTORY);
+    if (uTierChanged == 1) n = min(n, TIER_MAX_HISTORY);
+    if (!traced) {
+        FragColor = vec4(history.rgb, n); // n == 0: a hole, filled from neighbours when read
+        FragMoments = vec4(moments, 0.0, 0.0, 0.0);
+        return;
+    }
+    float k = float(uSamplesPerFrame);
+    n += k;
+    FragColor = vec4(mix(history.rgb, sample_color.rgb, k / n), n);
+    FragMoments = vec4(mix(moments, sample_color.a, k / n), 0.0, 0.0, 0.0);
+}
+
+// History at p; for a hole (nothing traced or reprojected there yet) the mean
+// of its 3x3 neighbours with history, preferring those on the same sphere,
+// as one sample. Skipped foveation tiles leave wider holes, so the ring
+// widens (taps 2, 4, then 8 pixels apart) until it finds some.
+#define FILL_MAX_STEP 8
+
+vec4 history_filled(ivec2 p) {
+    vec4 h = texelFetch(uHistory, p, 0);
+    if (h.a > 0.0) return h;
+
+    int id = primary_hits[pixel_index(p)].id;
+    for (int step = 1; step <= FILL_MAX_STEP; step *= 2) {
+        vec4 same = vec4(0.0), other = vec4(0.0);
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                ivec2 q = p + ivec2(dx, dy) * step;
+                if (any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, ivec2(WINDOW)))) continue;
+                vec4 c = texelFetch(uHistory, q, 0);
+                if (c.a <= 0.0) continue;
+                if (primary_hits[pixel_index(q)].id == id)
+                    same += vec4(c.rgb, 1.0);
+                else
+                    other += vec4(c.rgb, 1.0);
+            }
+        }
+        vec4 s = (same.a > 0.0) ? same : other;
+        if (s.a > 0.0) return vec4(s.rgb / s.a, 1.0);
+    }
+    return h;
+}
+
+// ---------------- DENOISER ----------------
+// Edge-avoiding a-trous wavelet filter over the history (Dammertz et al.
+// 2010, with SVGF's variance guidance). PASS_DENOISE first estimates each
+// pixel's variance of the mean (uDenoiseStep 0): from the history's moments,
+// or from its 3x3 neighbourhood on the same sphere while the history is
+// shorter than DENOISE_MIN_HISTORY samples. Each further pass is one level of
+// the 5x5 B3-spline kernel with taps uDenoiseStep pixels apart, weighted down
+// across the primary hits' normals, planes and albedos and across luminance
+// differences large next to the pixel's noise; the variance is filtered
+// along in alpha. As the history converges the variance, and with it the
+// blur, fades out.
+#define PASS_DENOISE 7
+#define DENOISE_MIN_HISTORY 4.0
+#define DENOISE_NORMAL_POWER 128.0
+#define DENOISE_SIGMA_PLANE 0.01   // plane distance per unit of depth, per tap step
+#define DENOISE_SIGMA_ALBEDO 0.1
+
+uniform int uDenoiseStep;        // 0 = variance estimate, else tap spacing of this level
+uniform float uDenoiseSigmaLuminance;
+
+vec4 denoise_variance(ivec2 pixel) {
+    vec4 h = texelFetch(uHistory, pixel, 0);
+    float n = max(h.a, 1.0);
+    if (n >= DENOISE_MIN_HISTORY) {
+        float l = luminance(h.rgb);
+        float m2 = texelFetch(uHistoryMoments, pixel, 0).r;
+        return vec4(h.rgb, max(m2 - l * l, 0.0) / (n - 1.0));
+    }
+
+    int id = primary_hits[pixel_index(pixel)].id;
+    h = history_filled(pixel);
+    float sum = 0.0, sum2 = 0.0, count = 0.0;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            ivec2 q = pixel + ivec2(dx, dy);
+            if (any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, ivec2(WINDOW)))) continue;
+            if (primary_hits[pixel_index(q)].id != id) continue;
+            float l = luminance(history_filled(q).rgb);
+            sum += l;
+            sum2 += l * l;
+            count += 1.0;
+        }
+    }
+    float mean = sum / count;
+    return vec4(h.rgb, max(sum2 / count - mean * mean, 0.0));
+}
+
+vec4 denoise_level(ivec2 pixel) {
+    vec4 center = texelFetch(uDenoiseInput, pixel, 0);
+    PrimaryHit p = primary_hits[pixel_index(pixel)];
+    if (p.id < 0) return center;
+
+    const float kernel[3] = float[3](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+    float l = luminance(center.rgb);
+    float sigma_l = uDenoiseSigmaLuminance * sqrt(center.a) + 1e-4;
+    float sigma_plane = DENOISE_SIGMA_PLANE * p.depth * float(uDenoiseStep);
+
+    vec3 color = vec3(0.0);
+    float variance = 0.0;
+    float w_sum = 0.0;
+    for (int dy = -2; dy <= 2; dy++) {
+        for (int dx = -2; dx <= 2; dx++) {
+            ivec2 q = pixel + ivec2(dx, dy) * uDenoiseStep;
+            if (any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, ivec2(WINDOW)))) continue;
+            vec4 c = texelFetch(uDenoiseInput, q, 0);
+            float w = kernel[abs(dx)] * kernel[abs(dy)];
+            if (dx != 0 || dy != 0) {
+                PrimaryHit h = primary_hits[pixel_index(q)];
+                if (h.id < 0) continue;
+                w *= pow(max(dot(p.normal, h.normal), 0.0), DENOISE_NORMAL_POWER);
+                w *= exp(-abs(dot(h.pos - p.pos, p.normal)) / sigma_plane);
+                w *= exp(-length(h.albedo - p.albedo) / DENOISE_SIGMA_ALBEDO);
+                w *= exp(-abs(luminance(c.rgb) - l) / sigma_l);
+            }
+            color += c.rgb * w;
+            variance += c.a * w * w;
+            w_sum += w;
+        }
+    }
+    return vec4(color / w_sum, variance / (w_sum * w_sum));
+}
+
+// ---------------- UPSCALER ----------------
+// When tracing below the window's resolution, PASS_GUIDE traces only the
+// primary hit of every window pixel into display_hits, once per view. The
+// display pass then rebuilds each window pixel from the 2x2 traced pixels
+// around it: bilinear weights times how well their primary hits match the
+// window pixel's (same sphere, normal and depth, like the denoiser's edge
+// stops), so edges come out at the window's resolution rather than blurred
+// at the traced one. If none of the four match (a feature thinner than a
+// traced pixel), the best match in the surrounding 4x4 is used; failing
+// that, plain bilinear.
+#define PASS_GUIDE 9
+#define UPSCALE_NORMAL_POWER 32.0
+#define UPSCALE_SIGMA_DEPTH 0.05   // relative depth difference
+
+layout(std430, binding = 14) buffer DisplayHitBuffer { PrimaryHit display_hits[]; }; // window-sized
+
+uniform int uUpscale;              // 1 = edge-adaptive upscaling (only when WINDOW < uDisplaySize)
+
+void upscale_guide(ivec2 q) {
+    uint seed = init_seed(uvec2(q), uFrame, 0u);
+    vec3 ro, rd;
+    camera_ray((vec2(q) + 0.5) * WINDOW / uDisplaySize, seed, ro, rd);
+    float t = 100000.0;
+    int hit_id = trace_closest(ro, rd, t);
+    display_hits[q.y * int(uDisplaySize.x) + q.x] = primary_hit(ro, rd, hit_id, t);
+}
+
+float upscale_weight(PrimaryHit a, PrimaryHit b) {
+    if (a.id != b.id) return 0.0;
+    if (a.id < 0) return 1.0;
+    float wn = pow(max(dot(a.normal, b.normal), 0.0), UPSCALE_NORMAL_POWER);
+    float wz = exp(-abs(a.depth - b.depth) / (UPSCALE_SIGMA_DEPTH * a.depth));
+    return wn * wz;
+}
+
+// Traced pixel p as displayed: denoised, or the history with holes filled
+vec3 display_color(ivec2 p) {
+    return (uDisplayDenoised == 1) ? texelFetch(uDenoiseInput, p, 0).rgb : history_filled(p).rgb;
+}
+
+vec3 upscale(ivec2 q) {
+    // Bilinear taps around the window pixel, in traced pixels
+    vec2 f = clamp((vec2(q) + 0.5) / uDisplaySize * WINDOW, vec2(0.5), WINDOW - 0.5) - 0.5;
+    ivec2 lo = ivec2(f);
+    ivec2 hi = min(lo + 1, ivec2(WINDOW) - 1);
+    vec2 w = f - vec2(lo);
+    ivec2 taps[4] = ivec2[4](lo, ivec2(hi.x, lo.y), ivec2(lo.x, hi.y), hi);
+    float bilinear[4] = float[4]((1.0 - w.x) * (1.0 - w.y), w.x * (1.0 - w.y), (1.0 - w.x) * w.y, w.x * w.y);
+
+    vec3 colors[4];
+    for (int i = 0; i < 4; i++) colors[i] = display_color(taps[i]);
+    vec3 plain = colors[0] * bilinear[0] + colors[1] * bilinear[1] + colors[2] * bilinear[2] + colors[3] * bilinear[3];
+    if (uUpscale == 0) return plain;
+
+    PrimaryHit g = display_hits[q.y * int(uDisplaySize.x) + q.x];
+    vec3 sum = vec3(0.0);
+    float w_sum = 0.0;
+    for (int i = 0; i < 4; i++) {
+        // A floor on the bilinear weight, so a matching tap the window pixel
+        // sits far from still counts when the near ones do not match
+        float k = max(bilinear[i], 0.01) * upscale_weight(g, primary_hits[pixel_index(taps[i])]);
+        sum += colors[i] * k;
+        w_sum += k;
+    }
+    if (w_sum > 1e-4) return sum / w_sum;
+
+    float best = 0.0;
+    ivec2 best_p = lo;
+    for (int dy = -1; dy <= 2; dy++) {
+        for (int dx = -1; dx <= 2; dx++) {
+            ivec2 p = clamp(lo + ivec2(dx, dy), ivec2(0), ivec2(WINDOW) - 1);
+            float k = upscale_weight(g, primary_hits[pixel_index(p)]);
+            if (k > best) {
+                best = k;
+                best_p = p;
+            }
+        }
+    }
+    return (best > 1e-4) ? display_color(best_p) : plain;
+}
+
+// ---------------- PRESENTATION ----------------
+// The display pass runs every frame at the refresh rate, whether or not a
+// sample finished. While a sample is still traced (in tiles) with an older
+// camera, the image is warped to the current one: each window pixel's ray
+// is projected into the sample's view as if it saw the sky, then again at
+// the distance of what the sample saw there. Turns are exact, moves close
+// for the surfaces in view. Rays outside the sample's view take its edge.
+// The present camera is latched late, just before this pass is drawn, into
+// a uniform buffer (Game::PresentCamera mirrors the layout).
+layout(std140, binding = 0) uniform PresentCamera {
+    vec3 uPresentOrigin;
+    int uWarp;              // 1 = the current camera differs from the sample's
+    vec3 uPresentLookAt;
+};
+
+vec3 warp(ivec2 q) {
+    vec3 w = normalize(uPresentOrigin - uPresentLookAt);
+    vec3 u = normalize(cross(uUp, w));
+    vec3 v = cross(w, u);
+    vec2 half_size = tan(radians(uFOV) * 0.5) * vec2(WINDOW.x / WINDOW.y, 1.0);
+    vec2 ndc = (vec2(q) + 0.5) / uDisplaySize * 2.0 - 1.0;
+    vec3 rd = normalize(ndc.x * half_size.x * u + ndc.y * half_size.y * v - w);
+
+    vec2 p = project_to_screen(uPresentOrigin + rd * GI_SKY_DISTANCE, uCameraOrigin, uLookAt);
+    p = clamp(p, vec2(0.5), WINDOW - 0.5);
+    PrimaryHit seen = primary_hits[pixel_index(ivec2(p))];
+    if (seen.id >= 0) {
+        vec2 near = project_to_screen(uPresentOrigin + rd * length(seen.pos - uPresentOrigin), uCameraOrigin, uLookAt);
+        if (all(greaterThanEqual(near, vec2(0.0))))
+            p = clamp(near, vec2(0.5), WINDOW - 0.5);
+    }
+
+    // Bilinear between the traced pixels around p
+    vec2 f = p - 0.5;
+    ivec2 lo = ivec2(f);
+    ivec2 hi = min(lo + 1, ivec2(WINDOW) - 1);
+    vec2 t = f - vec2(lo);
+    return mix(mix(display_color(lo), display_color(ivec2(hi.x, lo.y)), t.x),
+               mix(display_color(ivec2(lo.x, hi.y)), display_color(hi), t.x), t.y);
+}
+
+// ---------------- QUALITY TIERS ----------------
+// Cheap shading for a moving camera; the host picks the tier per sample.
+// Limited-depth GI and full quality are path tracing, at a lower or the
+// full uMaxDepth.
+#define TIER_ALBEDO 0 // albedo lit by a headlight, emitters and sky as is
+#define TIER_AO 1     // albedo under a white ambient, one occlusion ray
+uniform int uTier;
+
+#define AO_RADIUS 0.5
+
+vec3 preview_shade(vec3 ro, vec3 rd, int hit_id, float t, inout uint seed) {
+    if (hit_id < 0) return sky_radiance(rd);
+    if (spheres[hit_id].material == MAT_DIFFUSE_LIGHT) return spheres[hit_id].emission;
+
+    vec3 p = ro + rd * t;
+    vec3 n = normalize(p - spheres[hit_id].center);
+    if (dot(n, rd) > 0.0) n = -n;
+    vec3 albedo = (spheres[hit_id].material == MAT_DIELECTRIC) ? vec3(1.0) : spheres[hit_id].albedo;
+    if (uTier == TIER_ALBEDO)
+        return albedo * (0.25 + 0.75 * dot(n, -rd));
+
+    vec3 dir = n + random_unit_vector(seed); // cosine-distributed
+    dir = (dot(dir, dir) > 1e-8) ? normalize(dir) : n;
+    return occluded(p + n * 0.001, dir, AO_RADIUS) ? vec3(0.0) : albedo;
+}
+
+// ---------------- MAIN ----------------
+void main()
+{
+    // Initialize seed: Screen Coordinate + Time/Frame variation from C++.
+    // The camera stream is shared by both ReSTIR passes so they see the same ray.
+    uvec2 pixel = uvec2(gl_FragCoord.xy);
+
+    if (uPass == PASS_DENOISE) {
+        FragColor = (uDenoiseStep == 0) ? denoise_variance(ivec2(pixel)) : denoise_level(ivec2(pixel));
+        return;
+    }
+    if (uPass == PASS_DISPLAY) {
+        vec3 color = (uWarp == 1) ? warp(ivec2(pixel)) : upscale(ivec2(pixel));
+        FragColor = vec4(gamma_correct(color), 1.0);
+        return;
+    }
+    if (uPass == PASS_GUIDE) {
+        upscale_guide(ivec2(pixel));
+        FragColor = vec4(0.0);
+        return;
+    }
+    if (uPass == PASS_ERROR) {
+        vec4 history = texelFetch(uHistory, ivec2(pixel), 0);
+        float n = max(history.a, 2.0);
+        float l = luminance(history.rgb);
+        float m2 = texelFetch(uHistoryMoments, ivec2(pixel), 0).r;
+        float variance = max(m2 - l * l, 0.0) * n / (n - 1.0);
+        FragColor = vec4(variance / n / (l * l + 0.01), 0.0, 0.0, 1.0);
+        return;
+    }
+
+    // Both cache passes are drawn at a quarter of the window size. The
+    // resolve pass spreads the sampled cells over its fragments; in the
+    // update pass each fragment traces for one pixel of its 4x4 tile, a
+    // different one every frame.
+    if (uPass == PASS_CACHE_RESOLVE) {
+        uvec2 size = (uvec2(WINDOW) + 3u) / 4u;
+        for (uint i = pixel.y * size.x + pixel.x; i < dirty_count; i += size.x * size.y)
+            cache_resolve(dirty[i]);
+        FragColor = vec4(0.0);
+        return;
+    }
+    if (uPass == PASS_CACHE_UPDATE)
+        pixel = pixel * 4u + uvec2(uFrame % 4u, (uFrame / 4u) % 4u);
+
+    // The shading passes draw over the interleave pattern's packed viewport;
+    // pixels foveation or adaptive sampling skip return at once
+    bool shading = (uPass == PASS_PATH || uPass == PASS_RESTIR_INITIAL || uPass == PASS_RESTIR_SHADE);
+    if (shading) {
+        pixel = uvec2(interleave_pixel(ivec2(pixel)));
+        if (any(greaterThanEqual(pixel, uvec2(WINDOW))) || !fovea_traced(ivec2(pixel)) ||
+            !adaptive_traced(ivec2(pixel))) {
+            FragColor = vec4(0.0);
+            return;
+        }
+    }
+
+    uint cam_seed = init_seed(pixel, uFrame, 0u);
+    uint seed = init_seed(pixel, uFrame, uint(1 + uPass));
+
+    // The shading passes jitter their rays over the pixel (anti-aliasing);
+    // the other passes take its centre
+    vec3 ro, rd;
+    int cell = pixel_cell(0, uSamplesPerFrame);
+    vec2 jitter = shading ? pixel_jitter(pixel, cell, uSamplesPerFrame, cam_seed) : vec2(0.5);
+    camera_ray(vec2(pixel) + jitter, cam_seed, ro, rd);
+
+    if (uPass == PASS_TEMPORAL) {
+        temporal_resolve(ivec2(pixel), ro, rd);
+        return;
+    }
+
+    if (uPass == PASS_CACHE_UPDATE) {
+        cache_update = true;
+        trace_path(ro, rd, seed, uMaxDepth, VERTEX_NONE, 0.0, HIT_UNKNOWN, 0.0);
+        FragColor = vec4(0.0);
+        return;
+    }
+    cache_query = (uCache == 1);
+
+    if (uPass == PASS_RESTIR_INITIAL) {
+        restir_initial(ivec2(pixel), cell, ro, rd, seed);
+        FragColor = vec4(0.0);
+        return;
+    }
+
+    // Both shading passes record the primary hit (of the first ray), which
+    // PASS_TEMPORAL and the denoiser need. The output is the mean radiance and
+    // mean squared luminance of the pixel's rays.
+    vec3 color_sum = vec3(0.0);
+    float l2_sum = 0.0;
+    int hit_id;
+    float t = 100000.0;
+    int count = (uPass == PASS_RESTIR_SHADE) ? 1 : uSamplesPerFrame;
+    for (int s = 0; s < count; s++) {
+        vec3 sro = ro, srd = rd;
+        int scell = cell;
+        if (s > 0) {
+            scell = pixel_cell(s, count);
+            camera_ray(vec2(pixel) + pixel_jitter(pixel, scell, count, cam_seed), cam_seed, sro, srd);
+        }
+
+        vec3 c;
+        if (uPass == PASS_RESTIR_SHADE) {
+            Reservoir r = restir_initial_buf[pixel_index(ivec2(pixel))];
+            hit_id = r.hit_id;
+            t = length(r.pos - ro);
+            c = restir_shade(ivec2(pixel), ro, rd, seed);
+        } else {
+            float st = 100000.0;
+            int sid = camera_hit(ivec2(pixel), scell, sro, srd, st);
+            if (s == 0) {
+                hit_id = sid;
+                t = st;
+            }
+            if (uTier <= TIER_AO)
+                c = preview_shade(sro, srd, sid, st, seed);
+            else
+                c = trace_path(sro, srd, seed, uMaxDepth, VERTEX_NONE, 0.0, sid, st);
+        }
+
+        // One NaN or infinite sample would stay in the history for good
+        if (any(isnan(c)) || any(isinf(c)))
+            c = vec3(0.0);
+        color_sum += c;
+        l2_sum += luminance(c) * luminance(c);
+    }
+    primary_hits[pixel_index(ivec2(pixel))] = primary_hit(ro, rd, hit_id, t);
+    FragColor = vec4(color_sum, l2_sum) / float(count);
+}
@@ -0,0 +1,38 @@
+#version 430 core
+// Hybrid mode: the sphere of impostor_vertex.glsl's quad ray-cast for this
+// pixel's camera ray. The depth test (reversed, 1 / (1 + t) with GL_GREATER)
+// keeps the nearest, so the target ends up with the sphere each camera ray
+// hits first, or the clear value -1 for sky.
+layout(location = 0) out int PrimaryId;
+
+uniform vec2 WINDOW;
+uniform vec3 uCameraOrigin;
+uniform vec3 uLookAt;
+uniform vec3 uUp;
+uniform float uFOV;
+uniform vec2 uCameraJitter; // position in the pixel, as the shading passes take it
+
+flat in int vSphere;
+flat in vec4 vSphereBounds;
+
+void main() {
+    vec3 w = normalize(uCameraOrigin - uLookAt);
+    vec3 u = normalize(cross(uUp, w));
+    vec3 v = cross(w, u);
+    vec2 half_size = tan(radians(uFOV) * 0.5) * vec2(WINDOW.x / WINDOW.y, 1.0);
+    vec2 ndc = (floor(gl_FragCoord.xy) + uCameraJitter) / WINDOW * 2.0 - 1.0;
+    vec3 rd = normalize(ndc.x * half_size.x * u + ndc.y * half_size.y * v - w);
+
+    // hit_sphere() in fragment.glsl, for a unit direction
+    vec3 oc = uCameraOrigin - vSphereBounds.xyz;
+    float b = dot(oc, rd);
+    float disc = b * b - (dot(oc, oc) - vSphereBounds.w * vSphereBounds.w);
+    if (disc < 0.0) discard;
+    float sqrtD = sqrt(disc);
+    float t = -b - sqrtD;
+    if (t <= 0.001) t = -b + sqrtD;
+    if (t <= 0.001) discard;
+
+    gl_FragDepth = 1.0 / (1.0 + t);
+    PrimaryId = vSphere;
+}
@@ -0,0 +1,68 @@
+#version 430 core
+// Hybrid mode: primary visibility rasterized. One instance per sphere, a
+// quad over the screen bounds of its bounding cube, which
+// impostor_fragment.glsl ray-casts against the sphere. The camera is the
+// one camera_ray() in fragment.glsl builds, without defocus blur.
+
+uniform vec2 WINDOW;       // traced resolution
+uniform vec3 uCameraOrigin;
+uniform vec3 uLookAt;
+uniform vec3 uUp;
+uniform float uFOV;
+
+// Layout matches fragment.glsl and GpuSphere (binding 0)
+struct Sphere {
+    vec3 center;   float radius;
+    vec3 albedo;   float fuzz;
+    vec3 emission; float ref_idx;
+    int material;
+    uint trail_lo;
+    uint trail_hi;
+    int pad;
+};
+layout(std430, binding = 0) readonly buffer SphereBuffer { Sphere spheres[]; };
+
+flat out int vSphere;
+flat out vec4 vSphereBounds; // centre, radius
+
+void main() {
+    Sphere s = spheres[gl_InstanceID];
+    vSphere = gl_InstanceID;
+    vSphereBounds = vec4(s.center, s.radius);
+
+    vec3 w = normalize(uCameraOrigin - uLookAt);
+    vec3 u = normalize(cross(uUp, w));
+    vec3 v = cross(w, u);
+    vec2 half_size = tan(radians(uFOV) * 0.5) * vec2(WINDOW.x / WINDOW.y, 1.0);
+
+    // View space: x right, y up, z distance in front of the camera
+    vec3 c = s.center - uCameraOrigin;
+    vec3 view = vec3(dot(c, u), dot(c, v), -dot(c, w));
+    if (view.z + s.radius <= 0.0) {
+        gl_Position = vec4(2.0, 2.0, 0.0, 1.0); // wholly behind: off screen
+        return;
+    }
+
+    // Projected corners of the bounding cube bound the sphere's projection;
+    // a corner at or behind the eye leaves the whole screen
+    vec2 lo = vec2(-1.0), hi = vec2(1.0);
+    bool in_front = true;
+    vec2 cube_lo = vec2(1e30), cube_hi = vec2(-1e30);
+    for (int i = 0; i < 8 && in_front; i++) {
+        vec3 corner = view + s.radius * vec3((i & 1) != 0 ? 1.0 : -1.0,
+                                             (i & 2) != 0 ? 1.0 : -1.0,
+                                             (i & 4) != 0 ? 1.0 : -1.0);
+        in_front = corner.z > 1e-4;
+        vec2 ndc = corner.xy / (corner.z * half_size);
+        cube_lo = min(cube_lo, ndc);
+        cube_hi = max(cube_hi, ndc);
+    }
+    if (in_front) {
+        lo = max(cube_lo, vec2(-1.0));
+        hi = min(cube_hi, vec2(1.0));
+    }
+
+    // Triangle strip corners 0..3: (lo.x, lo.y), (hi.x, lo.y), (lo.x, hi.y), (hi.x, hi.y)
+    vec2 t = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    gl_Position = vec4(mix(lo, hi, t), 0.0, 1.0);
+}
@@ -0,0 +1,454 @@
+// Bidirectional path tracing for CpuTracer (integrator = INTEGRATOR_BDPT).
+//
+// Follows Veach's formulation as laid out in pbrt: every vertex stores the
+// area density with which its own subpath sampled it (pdfFwd) and with which
+// the opposite subpath would have (pdfRev), so the MIS weight of any
+// strategy is a product of density ratios along the path. Glass and metal
+// vertices are treated as specular: never connected to, their direction
+// densities remapped to 1 in the ratios.
+#include <algorithm>
+#include <cmath>
+#include "cpu_tracer.h"
+#include "sampling.h"
+
+namespace
+{
+const int MAX_BDPT_VERTICES = 34; // per subpath; maxDepth is clamped to fit
+
+enum
+{
+    CAMERA_VERTEX,
+    LIGHT_VERTEX, // light subpath origin on an emitter
+    SURFACE_VERTEX,
+};
+
+float remap0(float f) { return f != 0.0f ? f : 1.0f; }
+bool isBlack(const vec3 &c) { return c.x == 0.0f && c.y == 0.0f && c.z == 0.0f; }
+} // namespace
+
+struct CpuTracer::PathVertex
+{
+    int type = SURFACE_VERTEX;
+    int sphere = -1;
+    vec3 p;
+    vec3 n;    // outward sphere normal; view direction for the camera
+    vec3 wo;   // toward the previous vertex of its own subpath
+    vec3 beta; // subpath throughput up to this vertex
+    bool delta = false;
+    float pdfFwd = 0.0f; // area density, sampled by its own subpath
+    float pdfRev = 0.0f; // area density, sampled from the other end
+};
+
+// Pinhole camera for one film size. Rays are uniform over the image plane,
+// so the importance / direction density is 1 / (area * cos^3).
+struct CpuTracer::CameraFrame
+{
+    vec3 origin, u, v, forward;
+    float tanHalf = 1.0f;
+    float aspect = 1.0f;
+    float imageArea = 1.0f; // image plane at distance 1
+    int width = 0;
+    int height = 0;
+
+    float pdf(const vec3 &w) const
+    {
+        float px, py;
+        if (!raster(w, px, py)) return 0.0f;
+        float c = dot(w, forward);
+        return 1.0f / (imageArea * c * c * c);
+    }
+
+    // Film position (pixels from the top-left) of direction w
+    bool raster(const vec3 &w, float &px, float &py) const
+    {
+        float c = dot(w, forward);
+        if (c <= 0.0f) return false;
+        float sx = dot(w, u) / c / (2.0f * tanHalf * aspect);
+        float sy = dot(w, v) / c / (2.0f * tanHalf);
+        if (std::fabs(sx) >= 0.5f || std::fabs(sy) >= 0.5f) return false;
+        px = (sx + 0.5f) * width;
+        py = (0.5f - sy) * height;
+        return true;
+    }
+
+    vec3 direction(float px, float py) const
+    {
+        float sx = px / width - 0.5f, sy = 0.5f - py / height;
+        return normalize(forward + u * (sx * 2.0f * tanHalf * aspect) + v * (sy * 2.0f * tanHalf));
+    }
+};
+
+bool CpuTracer::connectible(const PathVertex &v) const
+{
+    return v.type != SURFACE_VERTEX || scene.material[v.sphere] == MAT_LAMBERTIAN;
+}
+
+// BSDF (or emission profile for a light origin) toward unit direction wi
+vec3 CpuTracer::vertexBsdf(const PathVertex &v, const vec3 &wi) const
+{
+    if (v.type == LIGHT_VERTEX) return dot(wi, v.n) > 0.0f ? vec3(1.0f, 1.0f, 1.0f) : vec3();
+    if (v.type != SURFACE_VERTEX || scene.material[v.sphere] != MAT_LAMBERTIAN) return vec3();
+    bool same_side = (dot(wi, v.n) > 0.0f) == (dot(v.wo, v.n) > 0.0f);
+    return same_side ? scene.albedo[v.sphere] * (1.0f / (float)M_PI) : vec3();
+}
+
+float CpuTracer::lightOriginPdf(const PathVertex &v) const
+{
+    float r = scene.radii[v.sphere];
+    return lightPmf(v.sphere) / (4.0f * (float)M_PI * r * r);
+}
+
+// Area density at next of v sampling it, having arrived from prev (nullptr:
+// use the stored incoming direction)
+float CpuTracer::vertexPdf(const CameraFrame &cam, const PathVertex &v, const PathVertex *prev,
+                           const PathVertex &next) const
+{
+    vec3 d = next.p - v.p;
+    float dist2 = dot(d, d);
+    if (dist2 <= 0.0f) return 0.0f;
+    vec3 w = d * (1.0f / std::sqrt(dist2));
+
+    float pdf;
+    if (v.type == CAMERA_VERTEX)
+        pdf = cam.pdf(w);
+    else if (v.type == LIGHT_VERTEX || scene.material[v.sphere] == MAT_DIFFUSE_LIGHT)
+        pdf = std::max(dot(w, v.n), 0.0f) / (float)M_PI;
+    else if (scene.material[v.sphere] == MAT_LAMBERTIAN)
+    {
+        vec3 wo = prev ? normalize(prev->p - v.p) : v.wo;
+        float cw = dot(w, v.n), co = dot(wo, v.n);
+        pdf = ((cw > 0.0f) == (co > 0.0f)) ? std::fabs(cw) / (float)M_PI : 0.0f;
+    }
+    else
+        return 0.0f;
+
+    pdf /= dist2;
+    if (next.type != CAMERA_VERTEX) pdf *= std::fabs(dot(next.n, w));
+    return pdf;
+}
+
+// Extend path[0] by up to maxVertices - 1 scattering vertices. The camera
+// subpath also collects sky light (escapes and environment NEE) into sky.
+int CpuTracer::randomWalk(vec3 ro, vec3 rd, vec3 beta, float pdfDir, bool fromCamera, Rng &rng, PathVertex *path,
+                          int maxVertices, vec3 &sky) const
+{
+    int count = 1;
+    bool prev_lambertian = false;
+    while (count < maxVertices)
+    {
+        float t = 100000.0f;
+        int hit = intersect(ro, rd, t);
+        if (hit < 0)
+        {
+            if (fromCamera)
+            {
+                float w = 1.0f;
+                if (!envTexels.empty() && prev_lambertian) w = powerHeuristic(pdfDir, envPdf(rd));
+                sky += mul(beta, skyRadiance(rd)) * w;
+            }
+            break;
+        }
+
+        PathVertex &prev = path[count - 1];
+        PathVertex &v = path[count];
+        v = PathVertex();
+        v.sphere = hit;
+        v.p = ro + rd * t;
+        v.n = normalize(v.p - scene.centers[hit]);
+        v.wo = rd * -1.0f;
+        v.beta = beta;
+        vec3 d = v.p - prev.p;
+        v.pdfFwd = pdfDir / dot(d, d) * std::fabs(dot(v.n, rd));
+
+        int m = scene.material[hit];
+        if (m == MAT_DIFFUSE_LIGHT)
+        {
+            if (fromCamera) ++count; // only useful as the s = 0 strategy's light end
+            break;
+        }
+        ++count;
+
+        vec3 wi;
+        float pdf_fwd, pdf_rev;
+        if (m == MAT_LAMBERTIAN)
+        {
+            vec3 n = dot(rd, v.n) < 0.0f ? v.n : v.n * -1.0f;
+            const vec3 &albedo = scene.albedo[hit];
+            if (fromCamera) sky += mul(beta, sampleEnvDirect(v.p, n, albedo, -1, rng));
+
+            wi = cosineDirection(n, rng);
+            float cos_o = dot(wi, n);
+            if (cos_o <= 0.0f) break;
+            pdf_fwd = cos_o / (float)M_PI;
+            pdf_rev = dot(v.wo, n) / (float)M_PI;
+            beta = mul(beta, albedo); // f * cos / pdf
+            prev_lambertian = true;
+        }
+        else
+        {
+            vec3 weight;
+            if (!scatterSpecular(hit, v.p, rd, rng, wi, weight)) break;
+            v.delta = true;
+            pdf_fwd = pdf_rev = 0.0f;
+            beta = mul(beta, weight);
+            prev_lambertian = false;
+        }
+
+        // Density of this vertex sampling the previous one, for the reverse direction
+        prev.pdfRev = pdf_rev / dot(d, d);
+        if (prev.type != CAMERA_VERTEX) prev.pdfRev *= std::fabs(dot(prev.n, d * (1.0f / length(d))));
+
+        pdfDir = pdf_fwd;
+        ro = v.p + wi * 0.001f;
+        rd = wi;
+    }
+    return count;
+}
+
+// Power-heuristic weight of the strategy using s light and t camera
+// vertices, against every other (s', t') producing the same path.
+// sampled replaces the light origin (s == 1) or camera (t == 1) endpoint.
+float CpuTracer::misWeight(const CameraFrame &cam, const PathVertex *light, int s, const PathVertex *eye, int t,
+                           const PathVertex &sampled) const
+{
+    if (s + t == 2) return 1.0f;
+
+    float eye_fwd[MAX_BDPT_VERTICES], eye_rev[MAX_BDPT_VERTICES];
+    float light_fwd[MAX_BDPT_VERTICES], light_rev[MAX_BDPT_VERTICES];
+    bool eye_delta[MAX_BDPT_VERTICES], light_delta[MAX_BDPT_VERTICES];
+    for (int i = 0; i < t; ++i)
+    {
+        eye_fwd[i] = eye[i].pdfFwd;
+        eye_rev[i] = eye[i].pdfRev;
+        eye_delta[i] = eye[i].delta;
+    }
+    for (int i = 0; i < s; ++i)
+    {
+        light_fwd[i] = light[i].pdfFwd;
+        light_rev[i] = light[i].pdfRev;
+        light_delta[i] = light[i].delta;
+    }
+
+    // Connection endpoints and their neighbours
+    const PathVertex &pt = t == 1 ? sampled : eye[t - 1];
+    const PathVertex *pt_minus = t > 1 ? &eye[t - 2] : nullptr;
+    const PathVertex *qs = s > 0 ? ((s == 1 && t > 1) ? &sampled : &light[s - 1]) : nullptr;
+    const PathVertex *qs_minus = s > 1 ? &light[s - 2] : nullptr;
+    if (s == 1 && t > 1) light_fwd[0] = sampled.pdfFwd;
+
+    eye_rev[t - 1] = qs ? vertexPdf(cam, *qs, qs_minus, pt) : lightOriginPdf(pt);
+    eye_delta[t - 1] = false;
+    if (pt_minus) eye_rev[t - 2] = vertexPdf(cam, pt, qs, *pt_minus);
+    if (qs)
+    {
+        light_rev[s - 1] = vertexPdf(cam, pt, pt_minus, *qs);
+        light_delta[s - 1] = false;
+    }
+    if (qs_minus) light_rev[s - 2] = vertexPdf(cam, *qs, &pt, *qs_minus);
+
+    // Strategies with fewer camera vertices, then with fewer light vertices
+    float sum = 0.0f, ri = 1.0f;
+    for (int i = t - 1; i > 0; --i)
+    {
+        float r = remap0(eye_rev[i]) / remap0(eye_fwd[i]);
+        ri *= r * r;
+        if (!eye_delta[i] && !eye_delta[i - 1]) sum += ri;
+    }
+    ri = 1.0f;
+    for (int i = s - 1; i >= 0; --i)
+    {
+        float r = remap0(light_rev[i]) / remap0(light_fwd[i]);
+        ri *= r * r;
+        bool delta_before = i > 0 ? light_delta[i - 1] : false;
+        if (!light_delta[i] && !delta_before) sum += ri;
+    }
+    return 1.0f / (1.0f + sum);
+}
+
+// Weighted contribution of strategy (s, t). Light tracing (t == 1) goes to
+// splats instead, at the pixel the light vertex projects to.
+vec3 CpuTracer::connect(const CameraFrame &cam, const PathVertex *light, int s, const PathVertex *eye, int t, Rng &rng,
+                        std::vector<vec3> &splats) const
+{
+    PathVertex sampled;
+    vec3 L;
+    if (s == 0)
+    {
+        // Camera subpath hit an emitter
+        const PathVertex &pt = eye[t - 1];
+        if (pt.type != SURFACE_VERTEX || scene.material[pt.sphere] != MAT_DIFFUSE_LIGHT) return vec3();
+        if (dot(pt.wo, pt.n) <= 0.0f) return vec3();
+        L = mul(pt.beta, scene.emission[pt.sphere]);
+    }
+    else if (t == 1)
+    {
+        // Light subpath vertex seen by the camera
+        const PathVertex &qs = light[s - 1];
+        if (!connectible(qs)) return vec3();
+        vec3 d = cam.origin - qs.p;
+        float dist = length(d);
+        vec3 wi = d * (1.0f / dist);
+        float px, py;
+        if (!cam.raster(wi * -1.0f, px, py)) return vec3();
+
+        float c = dot(wi * -1.0f, cam.forward);
+        sampled.type = CAMERA_VERTEX;
+        sampled.p = cam.origin;
+        sampled.n = cam.forward;
+        float importance = 1.0f / (cam.imageArea * c * c * c * dist * dist);
+        sampled.beta = vec3(importance, importance, importance);
+
+        L = mul(mul(qs.beta, vertexBsdf(qs, wi)), sampled.beta) * std::fabs(dot(wi, qs.n));
+        if (isBlack(L) || occluded(qs.p + wi * 0.001f, wi, dist - 0.002f)) return vec3();
+
+        L = L * misWeight(cam, light, s, eye, t, sampled);
+        if (std::isfinite(L.x) && std::isfinite(L.y) && std::isfinite(L.z))
+        {
+            int x = std::min((int)px, cam.width - 1), y = std::min((int)py, cam.height - 1);
+            splats[(size_t)y * cam.width + x] += L;
+        }
+        return vec3();
+    }
+    else if (s == 1)
+    {
+        // Next-event estimation: a fresh point on an emitter
+        const PathVertex &pt = eye[t - 1];
+        if (!connectible(pt)) return vec3();
+        float pmf;
+        int ls = pickLight(rng.uniform(), pmf);
+        vec3 wi;
+        float dist, pdf_dir;
+        if (ls < 0 || !sampleSphereLight(ls, pt.p, rng, wi, dist, pdf_dir)) return vec3();
+
+        sampled.type = LIGHT_VERTEX;
+        sampled.sphere = ls;
+        sampled.p = pt.p + wi * dist;
+        sampled.n = normalize(sampled.p - scene.centers[ls]);
+        sampled.beta = scene.emission[ls] * (1.0f / (pmf * pdf_dir));
+        sampled.pdfFwd = lightOriginPdf(sampled);
+        if (dot(wi, sampled.n) >= 0.0f) return vec3();
+
+        L = mul(mul(pt.beta, vertexBsdf(pt, wi)), sampled.beta) * std::fabs(dot(wi, pt.n));
+        if (isBlack(L) || occluded(pt.p + wi * 0.001f, wi, dist - 0.002f)) return vec3();
+    }
+    else
+    {
+        // Join the two subpaths
+        const PathVertex &qs = light[s - 1];
+        const PathVertex &pt = eye[t - 1];
+        if (!connectible(qs) || !connectible(pt)) return vec3();
+        vec3 d = pt.p - qs.p;
+        float dist2 = dot(d, d);
+        float dist = std::sqrt(dist2);
+        vec3 w = d * (1.0f / dist);
+        float g = std::fabs(dot(w, qs.n)) * std::fabs(dot(w, pt.n)) / dist2;
+        L = mul(mul(qs.beta, vertexBsdf(qs, w)), mul(vertexBsdf(pt, w * -1.0f), pt.beta)) * g;
+        if (isBlack(L) || occluded(qs.p + w * 0.001f, w, dist - 0.002f)) return vec3();
+    }
+    return L * misWeight(cam, light, s, eye, t, sampled);
+}
+
+vec3 CpuTracer::bdptSample(const CameraFrame &cam, int x, int y, Rng &rng, std::vector<vec3> &splats) const
+{
+    int depth = std::min(maxDepth, MAX_BDPT_VERTICES - 2);
+    PathVertex eye[MAX_BDPT_VERTICES], light[MAX_BDPT_VERTICES];
+
+    // Camera subpath
+    vec3 rd = cam.direction(x + rng.uniform(), y + rng.uniform());
+    eye[0].type = CAMERA_VERTEX;
+    eye[0].p = cam.origin;
+    eye[0].n = cam.forward;
+    eye[0].beta = vec3(1.0f, 1.0f, 1.0f);
+    vec3 sky;
+    int eye_count = randomWalk(cam.origin, rd, eye[0].beta, cam.pdf(rd), true, rng, eye, depth + 1, sky);
+
+    // Light subpath from an emitter picked by power
+    int light_count = 0;
+    float pmf;
+    int ls = pickLight(rng.uniform(), pmf);
+    if (ls >= 0)
+    {
+        float r = scene.radii[ls];
+        vec3 n = randomUnitVector(rng);
+        light[0].type = LIGHT_VERTEX;
+        light[0].sphere = ls;
+        light[0].p = scene.centers[ls] + n * r;
+        light[0].n = n;
+        light[0].pdfFwd = lightOriginPdf(light[0]);
+        light[0].beta = scene.emission[ls] * (1.0f / light[0].pdfFwd);
+
+        vec3 wi = cosineDirection(n, rng);
+        float pdf_dir = std::max(dot(wi, n), 0.0f) / (float)M_PI;
+        if (pdf_dir > 0.0f)
+        {
+            vec3 beta = light[0].beta * (float)M_PI; // Le cos / (pdf_origin * cos / pi)
+            vec3 unused;
+            light_count = randomWalk(light[0].p + wi * 0.001f, wi, beta, pdf_dir, false, rng, light, depth, unused);
+        }
+        else
+            light_count = 1;
+    }
+
+    // Every strategy with at most maxDepth edges. An emitter seen directly
+    // is counted by (s=0, t=2) alone: (1, 1) would splat the same one-edge
+    // path again, and misWeight() gives both weight 1.
+    vec3 L = sky;
+    for (int t = 1; t <= eye_count; ++t)
+        for (int s = 0; s <= light_count; ++s)
+        {
+            int edges = s + t - 1;
+            if (edges < 1 || edges > depth || (s == 1 && t == 1)) continue;
+            L += connect(cam, light, s, eye, t, rng, splats);
+        }
+    return L;
+}
+
+void CpuTracer::renderPassBdpt(Film &film, uint32_t pass) const
+{
+    CameraFrame cam;
+    cam.origin = camera.origin;
+    vec3 w = normalize(camera.origin - camera.lookAt);
+    cam.u = normalize(cross(camera.up, w));
+    cam.v = cross(w, cam.u);
+    cam.forward = w * -1.0f;
+    cam.tanHalf = std::tan(camera.fov * (float)M_PI / 180.0f * 0.5f);
+    cam.width = film.width;
+    cam.height = film.height;
+    cam.aspect = (float)film.width / film.height;
+    cam.imageArea = 4.0f * cam.tanHalf * cam.tanHalf * cam.aspect;
+
+    // One light subpath per pixel, so splats need no further scaling. The
+    // buffers are allocated with the film's first pass, not every pass.
+    size_t pixels = (size_t)film.width * film.height;
+    size_t workers = (size_t)workerCount(film.height, threadCount);
+    if (film.splats.size() != workers || film.splats[0].size() != pixels)
+        film.splats.assign(workers, std::vector<vec3>(pixels));
+    parallelRowsWithWorker(film.height, threadCount, [&](int y, int worker) {
+        for (int x = 0; x < film.width; ++x)
+        {
+            uint64_t pixel = (uint64_t)y * film.width + x;
+            Rng rng(pixel * 0x9E3779B97F4A7C15ULL, pass);
+            vec3 c = bdptSample(cam, x, y, rng, film.splats[worker]);
+            if (std::isfinite(c.x) && std::isfinite(c.y) && std::isfinite(c.z))
+                film.splats[worker][pixel] += c;
+        }
+    });
+
+    // Merge row by row in parallel, clearing the buffers for the next pass.
+    // A pixel's sample is its camera subpath estimate plus every splat it
+    // got, so the film's variance (and the error budget) covers both.
+    parallelRows(film.height, threadCount, [&](int y) {
+        size_t begin = (size_t)y * film.width, end = begin + film.width;
+        for (size_t i = begin; i < end; ++i)
+        {
+            vec3 c;
+            for (std::vector<vec3> &buffer : film.splats)
+            {
+                c += buffer[i];
+                buffer[i] = vec3();
+            }
+            film.add(i, c);
+        }
+    });
+    film.spp++;
+}
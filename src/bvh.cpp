@@ -0,0 +1,161 @@
+#include "bvh.h"
+#include <algorithm>
+#include <cfloat>
+
+namespace
+{
+const int BIN_COUNT = 12;
+const int MAX_LEAF_SIZE = 4;
+
+struct Aabb
+{
+    vec3 bmin = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+    vec3 bmax = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    void grow(const vec3 &p)
+    {
+        bmin = vec3(std::min(bmin.x, p.x), std::min(bmin.y, p.y), std::min(bmin.z, p.z));
+        bmax = vec3(std::max(bmax.x, p.x), std::max(bmax.y, p.y), std::max(bmax.z, p.z));
+    }
+    void grow(const Aabb &b)
+    {
+        if (b.bmin.x > b.bmax.x) return;
+        grow(b.bmin);
+        grow(b.bmax);
+    }
+    float area() const
+    {
+        if (bmin.x > bmax.x) return 0.0f;
+        vec3 e = bmax - bmin;
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+};
+
+float axis(const vec3 &v, int a) { return a == 0 ? v.x : (a == 1 ? v.y : v.z); }
+
+struct Builder
+{
+    const Scene &scene;
+    Bvh &bvh;
+    std::vector<Aabb> boxes;
+    std::vector<vec3> centroids;
+
+    Builder(const Scene &s, Bvh &b) : scene(s), bvh(b) {}
+
+    int makeLeaf(int node, int start, int end)
+    {
+        bvh.nodes[node].left_first = start;
+        bvh.nodes[node].count = end - start;
+        return node;
+    }
+
+    int build(int start, int end)
+    {
+        int node = (int)bvh.nodes.size();
+        bvh.nodes.push_back(BvhNode());
+
+        Aabb bounds, cbounds;
+        for (int i = start; i < end; ++i)
+        {
+            bounds.grow(boxes[bvh.prim_indices[i]]);
+            cbounds.grow(centroids[bvh.prim_indices[i]]);
+        }
+        BvhNode &n = bvh.nodes[node];
+        n.bmin[0] = bounds.bmin.x; n.bmin[1] = bounds.bmin.y; n.bmin[2] = bounds.bmin.z;
+        n.bmax[0] = bounds.bmax.x; n.bmax[1] = bounds.bmax.y; n.bmax[2] = bounds.bmax.z;
+
+        int count = end - start;
+        if (count <= 1)
+            return makeLeaf(node, start, end);
+
+        // Binned SAH over the axis with the widest centroid spread
+        int best_axis = -1, best_split = -1;
+        float best_cost = FLT_MAX;
+        for (int a = 0; a < 3; ++a)
+        {
+            float lo = axis(cbounds.bmin, a), hi = axis(cbounds.bmax, a);
+            if (hi - lo < 1e-6f) continue;
+
+            Aabb bins[BIN_COUNT];
+            int counts[BIN_COUNT] = {0};
+            float scale = BIN_COUNT / (hi - lo);
+            for (int i = start; i < end; ++i)
+            {
+                int p = bvh.prim_indices[i];
+                int b = std::min(BIN_COUNT - 1, (int)((axis(centroids[p], a) - lo) * scale));
+                bins[b].grow(boxes[p]);
+                counts[b]++;
+            }
+
+            for (int s = 1; s < BIN_COUNT; ++s)
+            {
+                Aabb left, right;
+                int nl = 0, nr = 0;
+                for (int b = 0; b < s; ++b) { left.grow(bins[b]); nl += counts[b]; }
+                for (int b = s; b < BIN_COUNT; ++b) { right.grow(bins[b]); nr += counts[b]; }
+                if (nl == 0 || nr == 0) continue;
+                float cost = nl * left.area() + nr * right.area();
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = a;
+                    best_split = s;
+                }
+            }
+        }
+
+        float leaf_cost = count * bounds.area();
+        if (count <= MAX_LEAF_SIZE && (best_axis < 0 || best_cost >= leaf_cost))
+            return makeLeaf(node, start, end);
+
+        int mid;
+        if (best_axis < 0)
+        {
+            // All centroids coincide: split the list in half
+            mid = start + count / 2;
+        }
+        else
+        {
+            float lo = axis(cbounds.bmin, best_axis), hi = axis(cbounds.bmax, best_axis);
+            float scale = BIN_COUNT / (hi - lo);
+            int *first = bvh.prim_indices.data() + start;
+            int *last = bvh.prim_indices.data() + end;
+            int *split = std::partition(first, last, [&](int p) {
+                int b = std::min(BIN_COUNT - 1, (int)((axis(centroids[p], best_axis) - lo) * scale));
+                return b < best_split;
+            });
+            mid = (int)(split - bvh.prim_indices.data());
+        }
+
+        build(start, mid);
+        int right = build(mid, end);
+        bvh.nodes[node].left_first = right;
+        bvh.nodes[node].count = 0;
+        return node;
+    }
+};
+} // namespace
+
+void buildBvh(const Scene &scene, Bvh &bvh)
+{
+    bvh.nodes.clear();
+    bvh.prim_indices.clear();
+
+    int n = scene.count();
+    if (n == 0) return;
+
+    Builder builder(scene, bvh);
+    builder.boxes.resize(n);
+    builder.centroids.resize(n);
+    for (int i = 0; i < n; ++i)
+    {
+        vec3 r(scene.radii[i], scene.radii[i], scene.radii[i]);
+        builder.boxes[i].grow(scene.centers[i] - r);
+        builder.boxes[i].grow(scene.centers[i] + r);
+        builder.centroids[i] = scene.centers[i];
+        bvh.prim_indices.push_back(i);
+    }
+
+    bvh.nodes.reserve(2 * n);
+    builder.build(0, n);
+}
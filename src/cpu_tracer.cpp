@@ -0,0 +1,840 @@
+#include "cpu_tracer.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include "sampling.h"
+
+namespace
+{
+const int BVH_STACK_SIZE = 64;
+const int MAX_GUIDED_VERTICES = 32;
+const size_t PIXEL_CHUNK = 256; // pixels per work item of a pass
+const int BUDGET_MIN_SAMPLES = 16; // passes before an error estimate is trusted
+
+// Same vertex kinds as trace_path() in fragment.glsl
+const int VERTEX_NONE = 0; // camera or specular: emitter and sky hits count fully
+const int VERTEX_NEE = 1;  // Lambertian with next-event estimation: MIS
+
+float axisOf(const vec3 &v, int a) { return a == 0 ? v.x : (a == 1 ? v.y : v.z); }
+
+float hitSphere(const vec3 &center, float radius, const vec3 &ro, const vec3 &rd)
+{
+    vec3 oc = ro - center;
+    float a = dot(rd, rd);
+    float b = 2.0f * dot(oc, rd);
+    float c = dot(oc, oc) - radius * radius;
+    float disc = b * b - 4.0f * a * c;
+    if (disc < 0.0f) return -1.0f;
+
+    float sqrtD = std::sqrt(disc);
+    float t1 = (-b - sqrtD) / (2.0f * a);
+    if (t1 > 0.001f) return t1;
+    float t2 = (-b + sqrtD) / (2.0f * a);
+    if (t2 > 0.001f) return t2;
+    return -1.0f;
+}
+
+float hitAabb(const BvhNode &n, const vec3 &ro, const vec3 &inv, float tmax)
+{
+    float tnear = 0.0f, tfar = tmax;
+    for (int a = 0; a < 3; ++a)
+    {
+        float o = axisOf(ro, a), i = axisOf(inv, a);
+        float t0 = (n.bmin[a] - o) * i, t1 = (n.bmax[a] - o) * i;
+        if (t0 > t1) std::swap(t0, t1);
+        tnear = std::max(tnear, t0);
+        tfar = std::min(tfar, t1);
+    }
+    return tnear <= tfar ? tnear : -1.0f;
+}
+
+vec3 safeInverse(const vec3 &d)
+{
+    return vec3(std::fabs(d.x) > 1e-8f ? 1.0f / d.x : 1e8f, std::fabs(d.y) > 1e-8f ? 1.0f / d.y : 1e8f,
+                std::fabs(d.z) > 1e-8f ? 1.0f / d.z : 1e8f);
+}
+
+// Equirectangular mapping of env_direction()/env_uv() in fragment.glsl
+vec3 envDirection(float u, float v)
+{
+    float phi = 2.0f * (float)M_PI * u, theta = (float)M_PI * v;
+    return vec3(-std::cos(phi) * std::sin(theta), std::cos(theta), std::sin(phi) * std::sin(theta));
+}
+} // namespace
+
+// -------------------
+// FILM
+// -------------------
+void Film::resize(int w, int h)
+{
+    width = w;
+    height = h;
+    sum.resize((size_t)w * h);
+    samples.resize(sum.size());
+    mean.resize(sum.size());
+    m2.resize(sum.size());
+    clear();
+}
+
+void Film::clear()
+{
+    std::fill(sum.begin(), sum.end(), vec3());
+    std::fill(samples.begin(), samples.end(), 0);
+    std::fill(mean.begin(), mean.end(), 0.0f);
+    std::fill(m2.begin(), m2.end(), 0.0f);
+    active.resize(sum.size());
+    for (size_t i = 0; i < active.size(); ++i) active[i] = (uint32_t)i;
+    spp = 0;
+}
+
+void Film::add(size_t pixel, const vec3 &c)
+{
+    sum[pixel] += c;
+    int n = ++samples[pixel];
+    float l = luminance(c);
+    float delta = l - mean[pixel];
+    mean[pixel] += delta / n;
+    m2[pixel] += delta * (l - mean[pixel]);
+}
+
+std::vector<vec3> Film::image() const
+{
+    std::vector<vec3> out(sum.size());
+    for (size_t i = 0; i < sum.size(); ++i) out[i] = samples[i] > 0 ? sum[i] * (1.0f / samples[i]) : vec3();
+    return out;
+}
+
+float Film::error(size_t pixel) const
+{
+    int n = samples[pixel];
+    if (n < 2) return FLT_MAX;
+    float variance = m2[pixel] / (n - 1);
+    return variance / n / (mean[pixel] * mean[pixel] + 0.01f);
+}
+
+float Film::meanError() const
+{
+    double total = 0.0;
+    for (size_t i = 0; i < sum.size(); ++i)
+    {
+        float e = error(i);
+        if (e == FLT_MAX) return FLT_MAX;
+        total += e;
+    }
+    return sum.empty() ? 0.0f : (float)(total / sum.size());
+}
+
+size_t Film::updateActive(float threshold, int minSamples)
+{
+    std::vector<uint8_t> open(sum.size());
+    for (size_t i = 0; i < sum.size(); ++i) open[i] = samples[i] < minSamples || error(i) > threshold;
+
+    active.clear();
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            bool any = false;
+            for (int dy = -1; dy <= 1 && !any; ++dy)
+                for (int dx = -1; dx <= 1 && !any; ++dx)
+                {
+                    int nx = x + dx, ny = y + dy;
+                    any = nx >= 0 && ny >= 0 && nx < width && ny < height && open[(size_t)ny * width + nx];
+                }
+            if (any) active.push_back((uint32_t)((size_t)y * width + x));
+        }
+    return active.size();
+}
+
+std::vector<vec3> Film::sampleMap() const
+{
+    int most = 1;
+    for (int n : samples) most = std::max(most, n);
+    std::vector<vec3> out(samples.size());
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        // Squared so that writePpm's gamma spreads the ramp evenly
+        float t = 3.0f * samples[i] / most;
+        vec3 c(std::min(t, 1.0f), std::clamp(t - 1.0f, 0.0f, 1.0f), std::clamp(t - 2.0f, 0.0f, 1.0f));
+        out[i] = mul(c, c);
+    }
+    return out;
+}
+
+int workerCount(int rows, int count)
+{
+    if (count <= 0) count = (int)std::max(1u, std::thread::hardware_concurrency());
+    return std::max(1, std::min(count, rows));
+}
+
+void parallelRows(int rows, int count, const std::function<void(int)> &fn)
+{
+    parallelRowsWithWorker(rows, count, [&](int row, int) { fn(row); });
+}
+
+void parallelRowsWithWorker(int rows, int count, const std::function<void(int, int)> &fn)
+{
+    count = workerCount(rows, count);
+
+    std::atomic<int> next(0);
+    auto worker = [&](int index) {
+        for (int row = next++; row < rows; row = next++) fn(row, index);
+    };
+    std::vector<std::thread> pool;
+    for (int i = 1; i < count; ++i) pool.emplace_back(worker, i);
+    worker(0);
+    for (std::thread &t : pool) t.join();
+}
+
+// -------------------
+// TRACER
+// -------------------
+CpuTracer::CpuTracer(const Scene &s, const Environment *env) : scene(s), environment(env)
+{
+    buildBvh(scene, bvh);
+
+    // Emitters chosen in proportion to power, as the light BVH's phi
+    float total = 0.0f;
+    lightPmfs.assign(scene.count(), 0.0f);
+    for (int i = 0; i < scene.count(); ++i)
+    {
+        if (scene.material[i] != MAT_DIFFUSE_LIGHT) continue;
+        const vec3 &le = scene.emission[i];
+        float phi = scene.radii[i] * scene.radii[i] * std::max(le.x, std::max(le.y, le.z));
+        if (phi <= 0.0f) continue;
+        lights.push_back(i);
+        total += phi;
+        lightCdf.push_back(total);
+    }
+    for (size_t k = 0; k < lights.size(); ++k)
+    {
+        float prev = k > 0 ? lightCdf[k - 1] : 0.0f;
+        lightPmfs[lights[k]] = (lightCdf[k] - prev) / total;
+        lightCdf[k] /= total;
+    }
+
+    if (environment && !environment->empty())
+        buildEnvironmentTexels(*environment, envTexels);
+
+    // Photon sources by flux: emitters emit pi * Le per unit area, the sky
+    // sends its integrated radiance through each specular sphere's cross-section
+    float light_flux = 0.0f, cross_section = 0.0f;
+    for (int s : lights)
+        light_flux += luminance(scene.emission[s]) * 4.0f * (float)(M_PI * M_PI) * scene.radii[s] * scene.radii[s];
+    for (int i = 0; i < scene.count(); ++i)
+    {
+        if (!isSpecular(i)) continue;
+        cross_section += (float)M_PI * scene.radii[i] * scene.radii[i];
+        specular.push_back(i);
+        specularCdf.push_back(cross_section);
+    }
+    for (float &c : specularCdf) c /= cross_section;
+
+    float sky_power = 0.0f; // integral of sky luminance over the sphere
+    if (!envTexels.empty())
+    {
+        int w = environment->width, h = environment->height;
+        for (int y = 0; y < h; ++y)
+        {
+            float d_omega = 2.0f * (float)(M_PI * M_PI) / (w * h) * std::sin(((float)y + 0.5f) / h * (float)M_PI);
+            for (int x = 0; x < w; ++x)
+            {
+                const EnvTexel &t = envTexels[(size_t)y * w + x];
+                sky_power += luminance(vec3(t.radiance[0], t.radiance[1], t.radiance[2])) * d_omega;
+            }
+        }
+        sky_power *= scene.sky_intensity;
+    }
+    else
+    {
+        const int steps = 64;
+        for (int i = 0; i < steps; ++i)
+            sky_power += luminance(skyRadiance(vec3(0.0f, 1.0f - 2.0f * (i + 0.5f) / steps, 0.0f)));
+        sky_power *= 4.0f * (float)M_PI / steps; // the gradient only depends on d.y
+    }
+    float sky_flux = specular.empty() ? 0.0f : sky_power * cross_section;
+    if (sky_flux + light_flux > 0.0f) skyPhotonFraction = sky_flux / (sky_flux + light_flux);
+
+    vec3 lo, hi;
+    bounds(lo, hi);
+    sceneExtent = length(hi - lo);
+}
+
+void CpuTracer::bounds(vec3 &lo, vec3 &hi) const
+{
+    lo = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+    hi = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int i = 0; i < scene.count(); ++i)
+    {
+        float r = scene.radii[i];
+        if (r > 100.0f) continue;
+        const vec3 &c = scene.centers[i];
+        lo = vec3(std::min(lo.x, c.x - r), std::min(lo.y, c.y - r), std::min(lo.z, c.z - r));
+        hi = vec3(std::max(hi.x, c.x + r), std::max(hi.y, c.y + r), std::max(hi.z, c.z + r));
+    }
+    if (lo.x > hi.x)
+    {
+        lo = vec3(-1.0f, -1.0f, -1.0f);
+        hi = vec3(1.0f, 1.0f, 1.0f);
+    }
+}
+
+int CpuTracer::intersect(const vec3 &ro, const vec3 &rd, float &t) const
+{
+    int hit = -1;
+    if (bvh.nodes.empty()) return hit;
+
+    vec3 inv = safeInverse(rd);
+    int stack[BVH_STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0)
+    {
+        int node = stack[--sp];
+        const BvhNode &n = bvh.nodes[node];
+        if (hitAabb(n, ro, inv, t) < 0.0f) continue;
+
+        if (n.count > 0)
+        {
+            for (int i = 0; i < n.count; ++i)
+            {
+                int s = bvh.prim_indices[n.left_first + i];
+                float ts = hitSphere(scene.centers[s], scene.radii[s], ro, rd);
+                if (ts > 0.001f && ts < t)
+                {
+                    t = ts;
+                    hit = s;
+                }
+            }
+        }
+        else if (sp + 2 <= BVH_STACK_SIZE)
+        {
+            // Near child on top
+            int a = node + 1, b = n.left_first;
+            float ta = hitAabb(bvh.nodes[a], ro, inv, t), tb = hitAabb(bvh.nodes[b], ro, inv, t);
+            if (ta >= 0.0f && tb >= 0.0f && tb < ta) std::swap(a, b);
+            stack[sp++] = b;
+            stack[sp++] = a;
+        }
+    }
+    return hit;
+}
+
+bool CpuTracer::occluded(const vec3 &ro, const vec3 &rd, float tmax) const
+{
+    if (bvh.nodes.empty()) return false;
+
+    vec3 inv = safeInverse(rd);
+    int stack[BVH_STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0)
+    {
+        int node = stack[--sp];
+        const BvhNode &n = bvh.nodes[node];
+        if (hitAabb(n, ro, inv, tmax) < 0.0f) continue;
+
+        if (n.count > 0)
+        {
+            for (int i = 0; i < n.count; ++i)
+            {
+                int s = bvh.prim_indices[n.left_first + i];
+                float ts = hitSphere(scene.centers[s], scene.radii[s], ro, rd);
+                if (ts > 0.001f && ts < tmax) return true;
+            }
+        }
+        else if (sp + 2 <= BVH_STACK_SIZE)
+        {
+            stack[sp++] = n.left_first;
+            stack[sp++] = node + 1;
+        }
+    }
+    return false;
+}
+
+// --- Sky ---
+vec3 CpuTracer::skyRadiance(const vec3 &d) const
+{
+    if (!envTexels.empty())
+    {
+        float phi = std::atan2(d.z, -d.x);
+        if (phi < 0.0f) phi += 2.0f * (float)M_PI;
+        float theta = std::acos(std::min(1.0f, std::max(-1.0f, d.y)));
+        int x = std::min((int)(phi / (2.0f * (float)M_PI) * environment->width), environment->width - 1);
+        int y = std::min((int)(theta / (float)M_PI * environment->height), environment->height - 1);
+        const EnvTexel &t = envTexels[(size_t)y * environment->width + x];
+        return vec3(t.radiance[0], t.radiance[1], t.radiance[2]) * scene.sky_intensity;
+    }
+
+    float t = 0.5f * (d.y + 1.0f);
+    return (vec3(1.0f, 1.0f, 1.0f) * (1.0f - t) + vec3(0.5f, 0.7f, 1.0f) * t) * scene.sky_intensity;
+}
+
+float CpuTracer::envPdf(const vec3 &d) const
+{
+    float sin_theta = std::sqrt(std::max(0.0f, 1.0f - d.y * d.y));
+    if (envTexels.empty() || sin_theta <= 0.0f) return 0.0f;
+
+    float phi = std::atan2(d.z, -d.x);
+    if (phi < 0.0f) phi += 2.0f * (float)M_PI;
+    float theta = std::acos(std::min(1.0f, std::max(-1.0f, d.y)));
+    int w = environment->width, h = environment->height;
+    int x = std::min((int)(phi / (2.0f * (float)M_PI) * w), w - 1);
+    int y = std::min((int)(theta / (float)M_PI * h), h - 1);
+    return envTexels[(size_t)y * w + x].pmf * (float)(w * h) / (2.0f * (float)(M_PI * M_PI) * sin_theta);
+}
+
+bool CpuTracer::sampleEnv(Rng &rng, vec3 &wi, float &pdf) const
+{
+    int w = environment->width, h = environment->height;
+    int count = w * h;
+    int i = std::min((int)(rng.uniform() * count), count - 1);
+    if (rng.uniform() >= envTexels[i].q) i = envTexels[i].alias;
+
+    float u = ((i % w) + rng.uniform()) / w;
+    float v = ((i / w) + rng.uniform()) / h;
+    wi = envDirection(u, v);
+    float sin_theta = std::sin((float)M_PI * v);
+    if (sin_theta <= 0.0f) return false;
+    pdf = envTexels[i].pmf * (float)count / (2.0f * (float)(M_PI * M_PI) * sin_theta);
+    return pdf > 0.0f;
+}
+
+// --- Emissive spheres ---
+int CpuTracer::pickLight(float u, float &pmf) const
+{
+    if (lights.empty()) return -1;
+    size_t k = std::lower_bound(lightCdf.begin(), lightCdf.end(), u) - lightCdf.begin();
+    k = std::min(k, lights.size() - 1);
+    pmf = lightPmfs[lights[k]];
+    return lights[k];
+}
+
+float CpuTracer::lightPmf(int sphere) const { return lightPmfs[sphere]; }
+
+float CpuTracer::sphereSolidAnglePdf(int s, const vec3 &p) const
+{
+    vec3 d = scene.centers[s] - p;
+    float r = scene.radii[s];
+    float sin2_max = r * r / dot(d, d);
+    if (sin2_max >= 1.0f) return 0.0f;
+    float one_minus_cos = (sin2_max < 0.00068523f) ? 0.5f * sin2_max : 1.0f - std::sqrt(1.0f - sin2_max);
+    return 1.0f / (2.0f * (float)M_PI * one_minus_cos);
+}
+
+bool CpuTracer::sampleSphereLight(int s, const vec3 &p, Rng &rng, vec3 &wi, float &dist, float &pdf) const
+{
+    pdf = sphereSolidAnglePdf(s, p);
+    if (pdf <= 0.0f) return false;
+    float one_minus_cos = 1.0f / (2.0f * (float)M_PI * pdf);
+
+    vec3 axis = normalize(scene.centers[s] - p);
+    float cos_t = 1.0f - rng.uniform() * one_minus_cos;
+    float sin_t = std::sqrt(std::max(0.0f, 1.0f - cos_t * cos_t));
+    float phi = 2.0f * (float)M_PI * rng.uniform();
+
+    vec3 t1 = normalize(std::fabs(axis.x) > 0.9f ? cross(axis, vec3(0.0f, 1.0f, 0.0f)) : cross(axis, vec3(1.0f, 0.0f, 0.0f)));
+    vec3 t2 = cross(axis, t1);
+    wi = normalize(t1 * (sin_t * std::cos(phi)) + t2 * (sin_t * std::sin(phi)) + axis * cos_t);
+
+    dist = hitSphere(scene.centers[s], scene.radii[s], p, wi);
+    if (dist < 0.0f) dist = length(scene.centers[s] - p) - scene.radii[s]; // grazing
+    return true;
+}
+
+float CpuTracer::bouncePdf(int leaf, const vec3 &n, const vec3 &wi) const
+{
+    float pdf_bsdf = std::max(dot(wi, n), 0.0f) / (float)M_PI;
+    if (leaf < 0) return pdf_bsdf;
+    float a = guide->bsdfFraction;
+    return a * pdf_bsdf + (1.0f - a) * guide->pdf(leaf, wi);
+}
+
+// NEE of one emissive sphere and (if present) the environment, each
+// MIS-weighted against the bounce density actually used at this vertex
+vec3 CpuTracer::sampleDirect(const vec3 &p, const vec3 &n, const vec3 &albedo, int leaf, Rng &rng) const
+{
+    vec3 result;
+    float pmf;
+    int s = pickLight(rng.uniform(), pmf);
+    vec3 wi;
+    float dist, pdf_dir;
+    if (s >= 0 && sampleSphereLight(s, p, rng, wi, dist, pdf_dir))
+    {
+        float cos_i = dot(wi, n);
+        if (cos_i > 0.0f && !occluded(p + wi * 0.001f, wi, dist - 0.002f))
+        {
+            float pdf_light = pmf * pdf_dir;
+            float w = powerHeuristic(pdf_light, bouncePdf(leaf, n, wi));
+            result += mul(albedo, scene.emission[s]) * (cos_i / (float)M_PI * w / pdf_light);
+        }
+    }
+
+    return result + sampleEnvDirect(p, n, albedo, leaf, rng);
+}
+
+vec3 CpuTracer::sampleEnvDirect(const vec3 &p, const vec3 &n, const vec3 &albedo, int leaf, Rng &rng) const
+{
+    vec3 wi;
+    float pdf_env;
+    if (envTexels.empty() || !sampleEnv(rng, wi, pdf_env)) return vec3();
+
+    float cos_i = dot(wi, n);
+    if (cos_i <= 0.0f || occluded(p + wi * 0.001f, wi, 100000.0f)) return vec3();
+    float w = powerHeuristic(pdf_env, bouncePdf(leaf, n, wi));
+    return mul(albedo, skyRadiance(wi)) * (cos_i / (float)M_PI * w / pdf_env);
+}
+
+// Glass or metal bounce, as in the shader: new direction and its weight
+// (the BSDF over the sampling density). False when the sample is absorbed.
+bool CpuTracer::scatterSpecular(int s, const vec3 &p, const vec3 &rd, Rng &rng, vec3 &wo, vec3 &weight) const
+{
+    vec3 geom_normal = normalize(p - scene.centers[s]);
+    if (scene.material[s] == MAT_METAL)
+    {
+        wo = normalize(reflectVec(rd, geom_normal) + randomUnitVector(rng) * scene.fuzz[s]);
+        weight = scene.albedo[s];
+        return dot(wo, geom_normal) > 0.0f;
+    }
+
+    bool front_face = dot(rd, geom_normal) < 0.0f;
+    vec3 outward = front_face ? geom_normal : geom_normal * -1.0f;
+    float ri = front_face ? 1.0f / scene.ref_idx[s] : scene.ref_idx[s];
+    float cos_theta = std::min(dot(rd * -1.0f, outward), 1.0f);
+    float sin_theta = std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+    if (ri * sin_theta > 1.0f || rng.uniform() < schlick(cos_theta, ri))
+        wo = reflectVec(rd, outward);
+    else
+        wo = refractVec(rd, outward, ri);
+    wo = normalize(wo);
+    weight = vec3(1.0f, 1.0f, 1.0f);
+    return true;
+}
+
+// --- Caustic photons ---
+bool CpuTracer::isSpecular(int s) const
+{
+    return scene.material[s] == MAT_DIELECTRIC || scene.material[s] == MAT_METAL;
+}
+
+// Trace one photon; it is kept only if it reaches a Lambertian surface
+// after at least one specular bounce
+void CpuTracer::emitPhoton(int count, Rng &rng, std::vector<Photon> &out) const
+{
+    vec3 ro, rd, power;
+    int target = -1; // sky photons must enter the sphere they were aimed at
+    if (rng.uniform() < skyPhotonFraction)
+    {
+        size_t k = std::lower_bound(specularCdf.begin(), specularCdf.end(), rng.uniform()) - specularCdf.begin();
+        k = std::min(k, specular.size() - 1);
+        target = specular[k];
+        float pmf = specularCdf[k] - (k > 0 ? specularCdf[k - 1] : 0.0f);
+
+        vec3 w;
+        float pdf_dir;
+        if (!envTexels.empty())
+        {
+            if (!sampleEnv(rng, w, pdf_dir)) return;
+        }
+        else
+        {
+            w = randomUnitVector(rng);
+            pdf_dir = 1.0f / (4.0f * (float)M_PI);
+        }
+
+        // Uniform point on the sphere's cross-section disk, moved outside the scene
+        float r = scene.radii[target];
+        float dr = r * std::sqrt(rng.uniform()), da = 2.0f * (float)M_PI * rng.uniform();
+        vec3 t1 = normalize(std::fabs(w.x) > 0.9f ? cross(w, vec3(0.0f, 1.0f, 0.0f)) : cross(w, vec3(1.0f, 0.0f, 0.0f)));
+        vec3 t2 = cross(w, t1);
+        vec3 disk = scene.centers[target] + t1 * (dr * std::cos(da)) + t2 * (dr * std::sin(da));
+        ro = disk + w * (sceneExtent + r);
+        rd = w * -1.0f;
+        power = skyRadiance(w) * ((float)M_PI * r * r / (pmf * pdf_dir * skyPhotonFraction * count));
+    }
+    else
+    {
+        float pmf;
+        int s = pickLight(rng.uniform(), pmf);
+        if (s < 0) return;
+        float r = scene.radii[s];
+        vec3 n = randomUnitVector(rng);
+        ro = scene.centers[s] + n * r;
+        rd = cosineDirection(n, rng);
+        power = scene.emission[s] * (4.0f * (float)(M_PI * M_PI) * r * r / (pmf * (1.0f - skyPhotonFraction) * count));
+    }
+
+    int bounces = 0;
+    for (int depth = 0; depth < maxDepth; ++depth)
+    {
+        float t = 100000.0f;
+        int hit = intersect(ro, rd, t);
+        if (hit < 0 || (depth == 0 && target >= 0 && hit != target)) return;
+
+        vec3 p = ro + rd * t;
+        if (!isSpecular(hit))
+        {
+            if (scene.material[hit] == MAT_LAMBERTIAN && bounces > 0) out.push_back({p, rd, power});
+            return;
+        }
+
+        vec3 scattered, weight;
+        if (!scatterSpecular(hit, p, rd, rng, scattered, weight)) return;
+        power = mul(power, weight);
+        ++bounces;
+        rd = scattered;
+        ro = p + rd * 0.001f;
+    }
+}
+
+void CpuTracer::emitCausticPhotons(int count, uint32_t pass, std::vector<Photon> &out) const
+{
+    out.clear();
+    if (count <= 0 || (lights.empty() && specular.empty())) return;
+    if (lights.empty() && skyPhotonFraction <= 0.0f) return;
+
+    // Fixed chunks with their own streams: the result is independent of the thread count
+    const int chunk_size = 4096;
+    int chunks = (count + chunk_size - 1) / chunk_size;
+    std::vector<std::vector<Photon>> parts(chunks);
+    parallelRows(chunks, threadCount, [&](int c) {
+        Rng rng((uint64_t)(c + 1) * 0xD1B54A32D192ED03ULL, pass);
+        int n = std::min(chunk_size, count - c * chunk_size);
+        for (int i = 0; i < n; ++i) emitPhoton(count, rng, parts[c]);
+    });
+
+    size_t total = 0;
+    for (const auto &part : parts) total += part.size();
+    out.reserve(total);
+    for (const auto &part : parts) out.insert(out.end(), part.begin(), part.end());
+}
+
+// --- Camera ---
+void CpuTracer::cameraRay(float px, float py, int width, int height, Rng &rng, vec3 &ro, vec3 &rd) const
+{
+    float aspect = (float)width / height;
+    float h = std::tan(camera.fov * (float)M_PI / 180.0f * 0.5f);
+    float fd = std::max(camera.focusDist, 0.1f);
+    float viewport_height = 2.0f * h * fd;
+    float viewport_width = viewport_height * aspect;
+
+    vec3 w = normalize(camera.origin - camera.lookAt);
+    vec3 u = normalize(cross(camera.up, w));
+    vec3 v = cross(w, u);
+
+    // px, py in pixels from the top-left corner
+    float sx = px / width - 0.5f, sy = 0.5f - py / height;
+    vec3 focus = camera.origin - w * fd + u * (sx * viewport_width) + v * (sy * viewport_height);
+
+    ro = camera.origin;
+    if (camera.defocusAngle > 0.0f)
+    {
+        float radius = fd * std::tan(camera.defocusAngle * (float)M_PI / 180.0f * 0.5f);
+        float r = std::sqrt(rng.uniform()), a = 2.0f * (float)M_PI * rng.uniform();
+        ro = ro + u * (radius * r * std::cos(a)) + v * (radius * r * std::sin(a));
+    }
+    rd = normalize(focus - ro);
+}
+
+// --- Integrator ---
+vec3 CpuTracer::radiance(vec3 ro, vec3 rd, Rng &rng, const PhotonMap *caustics) const
+{
+    vec3 throughput(1.0f, 1.0f, 1.0f);
+    vec3 color;
+
+    // Caustic photons are gathered at every diffuse vertex; light reached
+    // from one through specular bounces only is theirs, not the path's
+    bool gather = caustics && !caustics->empty();
+    int specular_run = -1; // specular bounces since the last diffuse vertex, -1 = not gathering
+
+    int prev_vertex = VERTEX_NONE;
+    vec3 prev_p;
+    float prev_pdf = 0.0f;
+
+    // Lambertian vertices whose incident radiance feeds the guide
+    struct GuideRecord
+    {
+        int leaf;
+        vec3 dir;
+        float pdf;
+        vec3 throughput; // path throughput just after this vertex's bounce
+        vec3 incident;
+    };
+    GuideRecord records[MAX_GUIDED_VERTICES];
+    int record_count = 0;
+    bool recording = guide && recordGuide;
+
+    auto add = [&](const vec3 &c) {
+        color += c;
+        for (int i = 0; i < record_count; ++i)
+        {
+            const vec3 &t = records[i].throughput;
+            records[i].incident += vec3(t.x > 0.0f ? c.x / t.x : 0.0f, t.y > 0.0f ? c.y / t.y : 0.0f,
+                                        t.z > 0.0f ? c.z / t.z : 0.0f);
+        }
+    };
+
+    for (int depth = 0; depth < maxDepth; ++depth)
+    {
+        float t = 100000.0f;
+        int hit = intersect(ro, rd, t);
+
+        if (hit < 0)
+        {
+            if (specular_run > 0) break;
+            float w = 1.0f;
+            if (!envTexels.empty() && prev_vertex == VERTEX_NEE) w = powerHeuristic(prev_pdf, envPdf(rd));
+            add(mul(throughput, skyRadiance(rd)) * w);
+            break;
+        }
+
+        vec3 p = ro + rd * t;
+        vec3 geom_normal = normalize(p - scene.centers[hit]);
+        int m = scene.material[hit];
+        const vec3 &albedo = scene.albedo[hit];
+
+        if (m == MAT_DIFFUSE_LIGHT)
+        {
+            if (dot(rd, geom_normal) < 0.0f && specular_run <= 0)
+            {
+                float w = 1.0f;
+                if (prev_vertex == VERTEX_NEE)
+                    w = powerHeuristic(prev_pdf, lightPmf(hit) * sphereSolidAnglePdf(hit, prev_p));
+                add(mul(throughput, scene.emission[hit]) * w);
+            }
+            break;
+        }
+
+        vec3 scattered;
+        vec3 attenuation = albedo;
+        prev_vertex = VERTEX_NONE;
+
+        if (m == MAT_LAMBERTIAN)
+        {
+            vec3 n = dot(rd, geom_normal) < 0.0f ? geom_normal : geom_normal * -1.0f;
+            int leaf = (guide && (guide->ready() || recording)) ? guide->leafAt(p) : -1;
+            int sample_leaf = (guide && guide->ready()) ? leaf : -1;
+
+            add(mul(throughput, sampleDirect(p, n, albedo, sample_leaf, rng)));
+            if (gather)
+            {
+                add(mul(throughput, mul(albedo, caustics->irradiance(p, n))) * (1.0f / (float)M_PI));
+                specular_run = 0;
+            }
+
+            // One-sample MIS between the cosine lobe and the learned distribution
+            float guide_pdf;
+            if (sample_leaf >= 0 && rng.uniform() >= guide->bsdfFraction)
+                scattered = guide->sample(sample_leaf, rng, guide_pdf);
+            else
+                scattered = cosineDirection(n, rng);
+
+            float cos_o = dot(scattered, n);
+            if (cos_o <= 0.0f) break;
+            float pdf = bouncePdf(sample_leaf, n, scattered);
+            if (pdf <= 0.0f) break;
+            attenuation = albedo * (cos_o / (float)M_PI / pdf);
+
+            prev_vertex = VERTEX_NEE;
+            prev_p = p;
+            prev_pdf = pdf;
+
+            if (recording && record_count < MAX_GUIDED_VERTICES)
+            {
+                throughput = mul(throughput, attenuation);
+                records[record_count++] = {leaf, scattered, pdf, throughput, vec3()};
+                ro = p + scattered * 0.001f;
+                rd = scattered;
+                continue;
+            }
+        }
+        else if (m == MAT_METAL || m == MAT_DIELECTRIC)
+        {
+            if (specular_run >= 0) ++specular_run;
+            if (!scatterSpecular(hit, p, rd, rng, scattered, attenuation)) break;
+        }
+        else
+        {
+            break;
+        }
+
+        throughput = mul(throughput, attenuation);
+        ro = p + scattered * 0.001f;
+        rd = scattered;
+    }
+
+    for (int i = 0; i < record_count; ++i)
+        guide->record(records[i].leaf, records[i].dir, luminance(records[i].incident) / records[i].pdf);
+    return color;
+}
+
+void CpuTracer::renderPass(Film &film, uint32_t pass) const
+{
+    if (integrator == INTEGRATOR_BDPT)
+    {
+        renderPassBdpt(film, pass);
+        return;
+    }
+
+    PhotonMap caustics;
+    if (causticPhotons > 0)
+    {
+        std::vector<Photon> photons;
+        emitCausticPhotons(causticPhotons, pass, photons);
+        // Radius shrinking as in probabilistic PPM (Knaus and Zwicker 2011), alpha = 2/3
+        float radius = causticRadius * std::pow((float)(film.spp + 1), -1.0f / 6.0f);
+        caustics.build(std::move(photons), radius, threadCount);
+    }
+
+    if (adaptiveThreshold > 0.0f) film.updateActive(adaptiveThreshold, adaptiveMinSamples);
+
+    // Work queue over chunks of the active pixels
+    int w = film.width, h = film.height;
+    int chunks = (int)((film.active.size() + PIXEL_CHUNK - 1) / PIXEL_CHUNK);
+    parallelRows(chunks, threadCount, [&](int chunk) {
+        size_t begin = (size_t)chunk * PIXEL_CHUNK, end = std::min(film.active.size(), begin + PIXEL_CHUNK);
+        for (size_t i = begin; i < end; ++i)
+        {
+            uint64_t pixel = film.active[i];
+            int x = (int)(pixel % w), y = (int)(pixel / w);
+            Rng rng(pixel * 0x9E3779B97F4A7C15ULL, pass);
+            vec3 ro, rd;
+            cameraRay(x + rng.uniform(), y + rng.uniform(), w, h, rng, ro, rd);
+            vec3 c = radiance(ro, rd, rng, &caustics);
+            film.add(pixel, std::isfinite(c.x) && std::isfinite(c.y) && std::isfinite(c.z) ? c : vec3());
+        }
+    });
+    film.spp++;
+}
+
+RenderReport CpuTracer::renderToBudget(Film &film, const RenderBudget &budget, uint32_t firstPass) const
+{
+    using clock = std::chrono::steady_clock;
+    clock::time_point start = clock::now();
+    auto elapsed = [&]() { return std::chrono::duration<double>(clock::now() - start).count(); };
+
+    double lastPass = 0.0;
+    for (uint32_t pass = firstPass;; ++pass)
+    {
+        if (budget.spp > 0 && film.spp >= budget.spp) break;
+        if (budget.seconds > 0.0 && pass > firstPass && elapsed() + lastPass > budget.seconds) break;
+        if (budget.error > 0.0f && film.spp >= BUDGET_MIN_SAMPLES && film.meanError() <= budget.error) break;
+        // Adaptive sampling has nothing left to sample
+        if (adaptiveThreshold > 0.0f && pass > firstPass && film.active.empty()) break;
+
+        double t0 = elapsed();
+        renderPass(film, pass);
+        lastPass = elapsed() - t0;
+    }
+
+    RenderReport report;
+    report.spp = film.spp;
+    report.seconds = elapsed();
+    report.error = film.meanError();
+    double n = 0.0;
+    for (int s : film.samples) n += s;
+    report.samples = film.samples.empty() ? 0.0 : n / film.samples.size();
+    return report;
+}
@@ -0,0 +1,256 @@
+#include "environment.h"
+#include "image_io.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace
+{
+float luminance(const vec3 &c) { return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z; }
+
+std::string extension(const std::string &path)
+{
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) return "";
+    std::string ext = path.substr(dot + 1);
+    for (char &c : ext) c = (char)std::tolower((unsigned char)c);
+    return ext;
+}
+
+vec3 rgbeToFloat(const unsigned char *rgbe)
+{
+    if (rgbe[3] == 0) return vec3(0.0f, 0.0f, 0.0f);
+    float f = std::ldexp(1.0f, (int)rgbe[3] - (128 + 8));
+    return vec3((rgbe[0] + 0.5f) * f, (rgbe[1] + 0.5f) * f, (rgbe[2] + 0.5f) * f);
+}
+
+// One scanline of RGBE quads, either flat or new-style run-length encoded
+// (each of the four components stored as its own run-length stream)
+bool readHdrScanline(std::ifstream &in, int width, std::vector<unsigned char> &line)
+{
+    line.resize((size_t)width * 4);
+    unsigned char head[4];
+    if (!in.read(reinterpret_cast<char *>(head), 4)) return false;
+
+    bool rle = width >= 8 && width < 0x8000 && head[0] == 2 && head[1] == 2 && !(head[2] & 0x80);
+    if (!rle)
+    {
+        std::memcpy(line.data(), head, 4);
+        return (bool)in.read(reinterpret_cast<char *>(line.data() + 4), (size_t)(width - 1) * 4);
+    }
+    if (((int)head[2] << 8 | head[3]) != width) return false;
+
+    for (int c = 0; c < 4; ++c)
+    {
+        int x = 0;
+        while (x < width)
+        {
+            int count = in.get();
+            if (count == EOF) return false;
+            if (count > 128)
+            {
+                count -= 128;
+                int value = in.get();
+                if (value == EOF || x + count > width) return false;
+                for (int i = 0; i < count; ++i) line[(size_t)(x++) * 4 + c] = (unsigned char)value;
+            }
+            else
+            {
+                if (count == 0 || x + count > width) return false;
+                for (int i = 0; i < count; ++i)
+                {
+                    int value = in.get();
+                    if (value == EOF) return false;
+                    line[(size_t)(x++) * 4 + c] = (unsigned char)value;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool loadHdr(std::ifstream &in, Environment &env)
+{
+    std::string line;
+    std::getline(in, line);
+    if (line.rfind("#?", 0) != 0) return false;
+
+    // Header lines up to a blank line; only 32-bit RGBE is supported
+    while (std::getline(in, line) && !line.empty())
+    {
+        if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe")
+            return false;
+    }
+
+    // Resolution: standard orientation is "-Y height +X width" (top row first)
+    std::getline(in, line);
+    char ysign, yaxis, xsign, xaxis;
+    std::istringstream res(line);
+    res >> ysign >> yaxis >> env.height >> xsign >> xaxis >> env.width;
+    if (!res || yaxis != 'Y' || xaxis != 'X' || env.width <= 0 || env.height <= 0) return false;
+
+    env.pixels.resize((size_t)env.width * env.height);
+    std::vector<unsigned char> scan;
+    for (int y = 0; y < env.height; ++y)
+    {
+        if (!readHdrScanline(in, env.width, scan)) return false;
+        int row = (ysign == '-') ? y : env.height - 1 - y;
+        for (int x = 0; x < env.width; ++x)
+        {
+            int col = (xsign == '+') ? x : env.width - 1 - x;
+            env.pixels[(size_t)row * env.width + col] = rgbeToFloat(&scan[(size_t)x * 4]);
+        }
+    }
+    return true;
+}
+
+bool loadRaw(std::ifstream &in, Environment &env)
+{
+    in.seekg(0, std::ios::end);
+    size_t bytes = (size_t)in.tellg();
+    in.seekg(0, std::ios::beg);
+
+    // 3 floats per texel, width = 2 * height
+    env.height = (int)std::lround(std::sqrt(bytes / (double)(2 * 3 * sizeof(float))));
+    env.width = 2 * env.height;
+    if (env.height <= 0 || (size_t)env.width * env.height * 3 * sizeof(float) != bytes) return false;
+
+    std::vector<float> data((size_t)env.width * env.height * 3);
+    if (!in.read(reinterpret_cast<char *>(data.data()), bytes)) return false;
+
+    env.pixels.resize((size_t)env.width * env.height);
+    for (size_t i = 0; i < env.pixels.size(); ++i)
+        env.pixels[i] = vec3(data[3 * i], data[3 * i + 1], data[3 * i + 2]);
+    return true;
+}
+} // namespace
+
+bool loadEnvironment(const std::string &path, Environment &env)
+{
+    env = Environment();
+
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "Environment: cannot open " << path << "\n";
+        return false;
+    }
+
+    std::string ext = extension(path);
+    bool ok = false;
+    if (ext == "pfm")
+        ok = readPfm(path, env.width, env.height, env.pixels);
+    else if (ext == "hdr" || ext == "pic")
+        ok = loadHdr(in, env);
+    else if (ext == "raw" || ext == "f32")
+        ok = loadRaw(in, env);
+    else
+        std::cerr << "Environment: unknown format '" << ext << "' (use .pfm, .hdr or .raw)\n";
+
+    if (!ok)
+    {
+        std::cerr << "Environment: failed to read " << path << "\n";
+        env = Environment();
+        return false;
+    }
+
+    // Negative or NaN texels would break the sampling weights
+    for (vec3 &p : env.pixels)
+    {
+        p.x = (p.x > 0.0f) ? p.x : 0.0f;
+        p.y = (p.y > 0.0f) ? p.y : 0.0f;
+        p.z = (p.z > 0.0f) ? p.z : 0.0f;
+    }
+
+    std::cout << "Environment: " << path << " (" << env.width << "x" << env.height << ")\n";
+    return true;
+}
+
+void buildSunSky(Environment &env, int width)
+{
+    env.width = width;
+    env.height = width / 2;
+    env.pixels.resize((size_t)env.width * env.height);
+
+    // Sun 35 degrees up, 0.5 degree angular radius
+    float sun_elevation = 35.0f * (float)M_PI / 180.0f;
+    float sun_azimuth = 0.6f * (float)M_PI;
+    vec3 sun_dir(-std::cos(sun_azimuth) * std::cos(sun_elevation), std::sin(sun_elevation),
+                 std::sin(sun_azimuth) * std::cos(sun_elevation));
+    float cos_sun = std::cos(0.5f * (float)M_PI / 180.0f);
+    vec3 sun_radiance(20000.0f, 18000.0f, 15000.0f);
+
+    for (int y = 0; y < env.height; ++y)
+    {
+        float theta = (y + 0.5f) / env.height * (float)M_PI;
+        for (int x = 0; x < env.width; ++x)
+        {
+            float phi = (x + 0.5f) / env.width * 2.0f * (float)M_PI;
+            vec3 d(-std::cos(phi) * std::sin(theta), std::cos(theta), std::sin(phi) * std::sin(theta));
+
+            float t = 0.5f * (d.y + 1.0f);
+            vec3 sky = vec3(1.0f, 1.0f, 1.0f) * (1.0f - t) + vec3(0.5f, 0.7f, 1.0f) * t;
+            env.pixels[(size_t)y * env.width + x] = dot(d, sun_dir) >= cos_sun ? sun_radiance : sky;
+        }
+    }
+}
+
+void buildEnvironmentTexels(const Environment &env, std::vector<EnvTexel> &texels)
+{
+    size_t n = env.pixels.size();
+    texels.assign(n, EnvTexel());
+    if (n == 0) return;
+
+    // Texel weights: luminance times the texel's share of the sphere
+    std::vector<double> weight(n);
+    double total = 0.0;
+    for (int y = 0; y < env.height; ++y)
+    {
+        double sin_theta = std::sin((y + 0.5) / env.height * M_PI);
+        for (int x = 0; x < env.width; ++x)
+        {
+            size_t i = (size_t)y * env.width + x;
+            weight[i] = luminance(env.pixels[i]) * sin_theta;
+            total += weight[i];
+        }
+    }
+
+    // Black map: fall back to uniform over texels
+    for (size_t i = 0; i < n; ++i)
+    {
+        const vec3 &p = env.pixels[i];
+        texels[i].radiance[0] = p.x; texels[i].radiance[1] = p.y; texels[i].radiance[2] = p.z;
+        texels[i].pmf = (float)(total > 0.0 ? weight[i] / total : 1.0 / n);
+        texels[i].alias = (int)i;
+        texels[i].q = 1.0f;
+    }
+
+    // Vose's alias method: pair each under-full entry with an over-full one
+    std::vector<double> scaled(n);
+    std::vector<size_t> small, large;
+    for (size_t i = 0; i < n; ++i)
+    {
+        scaled[i] = texels[i].pmf * (double)n;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty())
+    {
+        size_t s = small.back(); small.pop_back();
+        size_t l = large.back(); large.pop_back();
+        texels[s].q = (float)scaled[s];
+        texels[s].alias = (int)l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        (scaled[l] < 1.0 ? small : large).push_back(l);
+    }
+    // Leftovers are full up to rounding error
+    for (size_t i : small) texels[i].q = 1.0f;
+    for (size_t i : large) texels[i].q = 1.0f;
+}
@@ -1,9 +1,15 @@
 #include "game.h"
 #include "shader_util.h"
+#include "bvh.h"
+#include "light_bvh.h"
+#include "image_io.h"
 #include <iostream>
 #include <random>
+#include <string>
 #include <vector>
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <ctime> // For initializing random seed
 
 // Ensure Math constants are defined
@@ -24,9 +30,58 @@ float defocusAngle = 0.0f; // Slight blur by default (try 0.0 for sharp)
 int maxDepth = 6;          // Start lower for better FPS, increase to 8 or 12 for quality
 // float threshold = 0.001;
 
-#define MAT_LAMBERTIAN 0
-#define MAT_METAL 1
-#define MAT_DIELECTRIC 2
+// Dynamic resolution: the share of a frame the GPU may take (the rest is the
+// CPU and presentation), the step the scale moves in, and how fast the
+// measured cost follows new timings
+const float RESOLUTION_HEADROOM = 0.9f;
+const float RESOLUTION_STEP = 1.0f / 16.0f;
+const float FRAME_COST_SMOOTHING = 0.25f;
+
+// Presentation: the share of a refresh interval a sample's tiles may trace
+// for by default (the rest is the display pass and the swap), and the
+// refresh rate assumed when the display reports none
+const float PRESENT_TRACE_SHARE = 0.75f;
+const float DEFAULT_REFRESH_RATE = 60.0f;
+
+// Tiled dispatch: tile size in traced pixels (a multiple of the interleave
+// and foveation patterns), and how fast the measured tile cost follows new
+// timings
+const int TILE_SIZE = 128;
+const float TILE_COST_SMOOTHING = 0.25f;
+
+// Idle: the longest the loop blocks on events before it runs again (the
+// status line keeps ticking)
+const int IDLE_WAIT_MS = 100;
+
+// Simulation: the fixed camera timestep, and how far behind it may fall
+// before the lost time is dropped rather than replayed
+const Uint64 SIM_STEP_NS = 1000000000ull / 240;
+const int SIM_MAX_STEPS = 60;
+
+// Late latch: the longest to wait for the GPU to release a present camera slot
+const Uint64 PRESENT_FENCE_TIMEOUT_NS = 1000000000ull;
+
+// Vertical field of view in degrees (~20 for a zoomed look)
+const float CAMERA_FOV = 20.0f;
+
+// Hybrid mode: the camera ray positions in the pixel repeat every this many frames
+const unsigned int HYBRID_JITTER_PERIOD = 16;
+
+// Quality tiers: still samples before moving a tier up, and the path depth
+// of the limited GI tier (the camera hit and one bounce)
+const int TIER_PROMOTE_SAMPLES = 4;
+const int TIER_GI_DEPTH = 2;
+static const char *TIER_NAMES[] = {"albedo", "AO", "GI", "full"};
+
+// Accumulation: samples between error estimates, and the fewest samples an
+// error estimate is trusted at (as BUDGET_MIN_SAMPLES in cpu_tracer.cpp)
+const int ERROR_INTERVAL = 16;
+const int ERROR_MIN_SAMPLES = 16;
+
+// Without a render budget, a still view stops being traced (and the app
+// idles) once its estimated relative MSE is this low, or at this many samples
+const float SETTLED_ERROR = 1e-4f;
+const int SETTLED_MAX_SAMPLES = 4096;
 
 // Full-screen quad (2D positions only)
 float vertices[] = {
@@ -37,6 +92,65 @@ float vertices[] = {
 
 unsigned int indices[] = {0, 1, 2, 2, 3, 0};
 
+// std430 layout of the Sphere struct in fragment.glsl
+struct GpuSphere
+{
+    float center[3];
+    float radius;
+    float albedo[3];
+    float fuzz;
+    float emission[3];
+    float ref_idx;
+    int material;
+    unsigned int trail_lo;
+    unsigned int trail_hi;
+    int pad;
+};
+
+// (Re)fill a shader storage buffer and bind it to its binding point.
+// Empty arrays still get a small allocation so the binding stays valid.
+static void uploadStorageBuffer(GLuint &buffer, GLuint binding, const void *data, size_t bytes)
+{
+    if (buffer == 0)
+        glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, bytes > 0 ? bytes : 64, bytes > 0 ? data : nullptr, GL_STATIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+}
+
+// Unit view direction for yaw and pitch in degrees
+static vec3 lookDirection(float yaw, float pitch)
+{
+    float yawRad = yaw * M_PI / 180.0f;
+    float pitchRad = pitch * M_PI / 180.0f;
+    return vec3(cosf(yawRad) * cosf(pitchRad), sinf(pitchRad), sinf(yawRad) * cosf(pitchRad));
+}
+
+// Radical inverse of index in base (the Halton sequence)
+static float halton(unsigned int index, unsigned int base)
+{
+    float result = 0.0f, f = 1.0f;
+    for (; index > 0; index /= base)
+    {
+        f /= (float)base;
+        result += f * (float)(index % base);
+    }
+    return result;
+}
+
+// (Re)allocate a float render target texture; the display pass filters it
+static void createRenderTexture(GLuint &texture, GLenum format, int width, int height, bool mipmapped)
+{
+    if (texture == 0)
+        glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
 Game::Game(int W_W, int W_H)
 {
     WINDOW_W = W_W;
@@ -45,7 +159,7 @@ Game::Game(int W_W, int W_H)
     srand(static_cast<unsigned int>(time(0)));
 }
 
-Game::~Game() {}
+Game::~Game() { stopSimulation(); }
 
 bool Game::init(const char *title)
 {
@@ -55,7 +169,8 @@ bool Game::init(const char *title)
         return false;
     }
 
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    // 4.3 for shader storage buffers (scene, BVHs)
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
 
@@ -69,6 +184,15 @@ bool Game::init(const char *title)
     context = SDL_GL_CreateContext(window);
     SDL_GL_MakeCurrent(window, context);
 
+    // Present at the display's refresh rate (adaptive vsync where supported);
+    // tracing fits in between, in tiles
+    if (!SDL_GL_SetSwapInterval(-1))
+        SDL_GL_SetSwapInterval(1);
+    const SDL_DisplayMode *mode = SDL_GetCurrentDisplayMode(SDL_GetDisplayForWindow(window));
+    refreshRate = (mode && mode->refresh_rate > 0.0f) ? mode->refresh_rate : DEFAULT_REFRESH_RATE;
+    if (tileBudgetMs <= 0.0f)
+        tileBudgetMs = PRESENT_TRACE_SHARE * 1000.0f / refreshRate;
+
     if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress))
     {
         std::cerr << "Failed to initialize GLAD\n";
@@ -90,72 +214,182 @@ bool Game::init(const char *title)
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
     glEnableVertexAttribArray(0);
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
     // Load Shaders (Ensure these paths are correct relative to your executable)
     shader = LoadShader("shaders/vertex.glsl", "shaders/fragment.glsl");
+    impostorShader = LoadShader("shaders/impostor_vertex.glsl", "shaders/impostor_fragment.glsl");
+    initPresentCamera();
 
     // Capture mouse for camera look
     SDL_SetWindowRelativeMouseMode(window, true);
 
     // Build the final random scene once (deterministic)
-    buildFinalScene();
+    loadScene(0);
+    resizeRenderTargets();
+
+    // A file given on the command line lights the scene from the start;
+    // otherwise E switches between the gradient and a procedural sun sky
+    if (!envPath.empty() && loadEnvironment(envPath, environment))
+        envEnabled = true;
+    else
+        buildSunSky(environment, 1024);
+    uploadEnvironment();
 
     lastTime = SDL_GetTicks();
     frameCount = 0;
+    startSimulation();
     isRunning = true;
     return true;
 }
 
 void Game::handleEvent()
 {
+    // Idle: block until an event arrives (or a while passes) instead of
+    // spinning; any event then gets a frame rendered for it
     SDL_Event e;
-    while (SDL_PollEvent(&e))
+    bool pending = idle() ? SDL_WaitEventTimeout(&e, IDLE_WAIT_MS) : SDL_PollEvent(&e);
+    for (; pending; pending = SDL_PollEvent(&e))
     {
+        presentPending = true;
         if (e.type == SDL_EVENT_QUIT)
         {
             isRunning = false;
         }
+        if (e.type == SDL_EVENT_WINDOW_MINIMIZED || e.type == SDL_EVENT_WINDOW_HIDDEN ||
+            e.type == SDL_EVENT_WINDOW_OCCLUDED)
+            windowHidden = true;
+        if (e.type == SDL_EVENT_WINDOW_RESTORED || e.type == SDL_EVENT_WINDOW_SHOWN ||
+            e.type == SDL_EVENT_WINDOW_EXPOSED)
+            windowHidden = false;
+        if (e.type == SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED)
+        {
+            WINDOW_W = e.window.data1;
+            WINDOW_H = e.window.data2;
+            resizeRenderTargets();
+        }
 
-        // Mouse look
+        // Mouse look (applied by the simulation)
         if (e.type == SDL_EVENT_MOUSE_MOTION)
         {
-            float xoffset = e.motion.xrel * mouseSensitivity;
-            float yoffset = -e.motion.yrel * mouseSensitivity; // invert Y
-
-            yaw += xoffset;
-            pitch += yoffset;
-
-            if (pitch > 89.0f)
-                pitch = 89.0f;
-            if (pitch < -89.0f)
-                pitch = -89.0f;
+            input.lookX += e.motion.xrel;
+            input.lookY += e.motion.yrel;
+            if (pendingInputNS == 0)
+                pendingInputNS = e.motion.timestamp;
         }
+        if ((e.type == SDL_EVENT_KEY_DOWN || e.type == SDL_EVENT_KEY_UP) && !e.key.repeat &&
+            (e.key.key == SDLK_W || e.key.key == SDLK_A || e.key.key == SDLK_S || e.key.key == SDLK_D) &&
+            pendingInputNS == 0)
+            pendingInputNS = e.key.timestamp;
         if (e.type == SDL_EVENT_KEY_DOWN)
         {
-            switch (e.key.key)
+            // Bindings that change the converged image drop the history;
+            // camera movement is reprojected instead, and the rest only
+            // change how it is traced or shown
+            SDL_Keycode k = e.key.key;
+            switch (k)
             {
             case SDLK_UP:
                 focusDist += 0.5f; // CORRECTED: Float increment
+                accumDirty = true;
                 break;
             case SDLK_DOWN:
                 focusDist -= 0.5f; // CORRECTED: Float decrement
                 if (focusDist < 0.1f) focusDist = 0.1f; // Prevent negative focus
+                accumDirty = true;
                 break;
             case SDLK_LEFT:
                 defocusAngle -= 0.1f;
                 if (defocusAngle < 0.0f) defocusAngle = 0.0f;
+                accumDirty = true;
                 break;
             case SDLK_RIGHT:
                 defocusAngle += 0.1f;
+                accumDirty = true;
                 break;
             case SDLK_O:
                 maxDepth += 1;
+                accumDirty = true;
                 break;
             case SDLK_P:
                 maxDepth -= 1;
                 if (maxDepth < 1) maxDepth = 1;
+                accumDirty = true;
+                break;
+            case SDLK_1:
+                loadScene(0);
+                accumDirty = true;
+                break;
+            case SDLK_2:
+                loadScene(1);
+                accumDirty = true;
+                break;
+            case SDLK_3:
+                loadScene(2);
+                accumDirty = true;
+                break;
+            case SDLK_L:
+                lightSampling = 1 - lightSampling;
+                accumDirty = true;
+                break;
+            case SDLK_R:
+                restirDI = !restirDI;
+                restirHistory = false;
+                accumDirty = true;
+                break;
+            case SDLK_G:
+                restirGI = !restirGI;
+                restirHistory = false;
+                accumDirty = true;
+                break;
+            case SDLK_E:
+                envEnabled = !envEnabled;
+                restirHistory = false;
+                clearRadianceCache();
+                accumDirty = true;
+                break;
+            case SDLK_C:
+                cacheEnabled = !cacheEnabled;
+                accumDirty = true;
+                break;
+            case SDLK_N:
+                denoiseEnabled = !denoiseEnabled;
+                break;
+            case SDLK_K:
+                interleave = (interleave == 4) ? 1 : interleave * 2;
+                break;
+            case SDLK_V:
+                foveation.enabled = !foveation.enabled;
+                break;
+            case SDLK_U:
+                upscaleEnabled = !upscaleEnabled;
+                break;
+            case SDLK_T:
+                tiledDispatch = !tiledDispatch;
+                break;
+            case SDLK_H:
+                primaryCacheEnabled = !primaryCacheEnabled;
+                break;
+            case SDLK_I:
+                hybridEnabled = !hybridEnabled;
+                break;
+            case SDLK_F1:
+            case SDLK_F2:
+            case SDLK_F3:
+            case SDLK_F4:
+                qualityTier = TIER_ALBEDO + (int)(k - SDLK_F1);
+                break;
+            case SDLK_M:
+                autoTier = !autoTier;
+                break;
+            case SDLK_LEFTBRACKET:
+                foveation.radius = std::max(foveation.radius * 0.8f, 0.05f);
+                break;
+            case SDLK_RIGHTBRACKET:
+                foveation.radius = std::min(foveation.radius * 1.25f, 2.0f);
+                break;
+            case SDLK_F:
+                dynamicResolution = !dynamicResolution;
+                if (!dynamicResolution)
+                    setResolutionScale(fixedResolutionScale);
                 break;
             // case SDLK_H:
             //     seedX -= threshold;
@@ -179,228 +413,1109 @@ void Game::handleEvent()
             }
         }
     }
+
+    publishInput();
 }
 
-void Game::update()
+// Hand the simulation what is held now and the look so far, waking it if
+// that changed
+void Game::publishInput()
 {
     const bool *keys = SDL_GetKeyboardState(NULL);
-    float deltaTime = 0.016f;
-    static Uint64 prevTime = SDL_GetTicks();
-    Uint64 currentTime = SDL_GetTicks();
-    deltaTime = (currentTime - prevTime) / 1000.0f;
-    prevTime = currentTime;
+    InputState last = input;
+    input.held = (keys[SDL_SCANCODE_W] ? MOVE_FORWARD : 0) | (keys[SDL_SCANCODE_S] ? MOVE_BACK : 0) |
+                 (keys[SDL_SCANCODE_A] ? MOVE_LEFT : 0) | (keys[SDL_SCANCODE_D] ? MOVE_RIGHT : 0);
+    inputState.publish(input);
+    if (input.held != last.held || input.lookX != last.lookX || input.lookY != last.lookY)
+    {
+        {
+            std::lock_guard<std::mutex> lock(simMutex);
+            simWoken = true;
+        }
+        simWake.notify_one();
+    }
+}
 
-    float velocity = moveSpeed * deltaTime;
-    float yawRad = yaw * M_PI / 180.0f;
-    float pitchRad = pitch * M_PI / 180.0f;
+// The simulation thread moves the camera in fixed steps of wall time,
+// however long the frames take, and publishes each new state for the
+// render thread to pick up. SDL events stay on the main thread (it must
+// pump them), which forwards the input through inputState. With no key held
+// the thread sleeps until publishInput() has something new.
+void Game::startSimulation()
+{
+    CameraState cam;
+    cam.pos = cameraPos;
+    cam.yaw = yaw;
+    cam.pitch = pitch;
+    cameraState.reset(cam);
+    inputState.reset(input);
+    simRunning = true;
+    simThread = std::thread(&Game::simulate, this, cam, input);
+}
+
+void Game::stopSimulation()
+{
+    {
+        std::lock_guard<std::mutex> lock(simMutex);
+        simRunning = false;
+    }
+    simWake.notify_one();
+    if (simThread.joinable())
+        simThread.join();
+}
+
+void Game::simulate(CameraState cam, InputState applied)
+{
+    Uint64 next = SDL_GetTicksNS();
+    while (simRunning)
+    {
+        Uint64 now = SDL_GetTicksNS();
+        if (now < next)
+        {
+            SDL_DelayPrecise(next - now);
+            continue;
+        }
+        if (now - next > SIM_MAX_STEPS * SIM_STEP_NS)
+            next = now;
+
+        // Look is applied as it arrives, movement a step at a time
+        CameraState before = cam;
+        const InputState &in = inputState.latest();
+        cam.yaw += (float)(in.lookX - applied.lookX) * mouseSensitivity;
+        cam.pitch -= (float)(in.lookY - applied.lookY) * mouseSensitivity; // invert Y
+        cam.pitch = std::clamp(cam.pitch, -89.0f, 89.0f);
+        cam.lookX = in.lookX;
+        cam.lookY = in.lookY;
+        applied = in;
+        for (; next <= now; next += SIM_STEP_NS)
+            step(cam, in.held, SIM_STEP_NS * 1e-9f);
+
+        if (cam.pos.x != before.pos.x || cam.pos.y != before.pos.y || cam.pos.z != before.pos.z ||
+            cam.yaw != before.yaw || cam.pitch != before.pitch || cam.lookX != before.lookX ||
+            cam.lookY != before.lookY)
+            cameraState.publish(cam);
+
+        // Nothing moves the camera until new input: sleep, and simulate
+        // from when it arrives
+        if (applied.held == 0)
+        {
+            std::unique_lock<std::mutex> lock(simMutex);
+            simWake.wait(lock, [&] { return simWoken || !simRunning; });
+            simWoken = false;
+            next = SDL_GetTicksNS();
+        }
+    }
+}
+
+// Move `seconds` worth with the movement keys `held`
+void Game::step(CameraState &cam, unsigned held, float seconds) const
+{
+    float velocity = moveSpeed * seconds;
+    float yawRad = cam.yaw * M_PI / 180.0f;
+    float pitchRad = cam.pitch * M_PI / 180.0f;
 
     float frontX = cosf(yawRad) * cosf(pitchRad);
     float frontY = sinf(pitchRad);
     float frontZ = sinf(yawRad) * cosf(pitchRad);
 
-    // Keyboard movement
-    if (keys[SDL_SCANCODE_W])
+    if (held & MOVE_FORWARD)
     {
-        cameraPos.x += frontX * velocity;
-        cameraPos.y += frontY * velocity;
-        cameraPos.z += frontZ * velocity;
+        cam.pos.x += frontX * velocity;
+        cam.pos.y += frontY * velocity;
+        cam.pos.z += frontZ * velocity;
     }
-    if (keys[SDL_SCANCODE_S])
+    if (held & MOVE_BACK)
     {
-        cameraPos.x -= frontX * velocity;
-        cameraPos.y -= frontY * velocity;
-        cameraPos.z -= frontZ * velocity;
+        cam.pos.x -= frontX * velocity;
+        cam.pos.y -= frontY * velocity;
+        cam.pos.z -= frontZ * velocity;
     }
-    if (keys[SDL_SCANCODE_A])
+    if (held & MOVE_LEFT)
     {
         // Strafe Left
-        cameraPos.x += cosf(yawRad - M_PI_2) * velocity;
-        cameraPos.z += sinf(yawRad - M_PI_2) * velocity;
+        cam.pos.x += cosf(yawRad - M_PI_2) * velocity;
+        cam.pos.z += sinf(yawRad - M_PI_2) * velocity;
     }
-    if (keys[SDL_SCANCODE_D])
+    if (held & MOVE_RIGHT)
     {
         // Strafe Right
-        cameraPos.x -= cosf(yawRad - M_PI_2) * velocity;
-        cameraPos.z -= sinf(yawRad - M_PI_2) * velocity;
+        cam.pos.x -= cosf(yawRad - M_PI_2) * velocity;
+        cam.pos.z -= sinf(yawRad - M_PI_2) * velocity;
+    }
+}
+
+// Present cameras in a uniform buffer of PRESENT_CAMERA_SLOTS, persistently
+// mapped where buffer storage is available (GL 4.4), so the latch is a plain
+// store; each slot is fenced until the display pass that read it is done
+void Game::initPresentCamera()
+{
+    GLint align = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+    presentCameraStride = ((GLsizeiptr)sizeof(PresentCamera) + align - 1) / align * align;
+    GLsizeiptr bytes = presentCameraStride * PRESENT_CAMERA_SLOTS;
+    glGenBuffers(1, &presentCameraBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, presentCameraBuffer);
+    if (GLAD_GL_VERSION_4_4)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_UNIFORM_BUFFER, bytes, nullptr, flags | GL_DYNAMIC_STORAGE_BIT);
+        presentCameraMap = (unsigned char *)glMapBufferRange(GL_UNIFORM_BUFFER, 0, bytes, flags);
+    }
+    else
+        glBufferData(GL_UNIFORM_BUFFER, bytes, nullptr, GL_DYNAMIC_DRAW);
+}
+
+// Late latch: the present camera from the freshest input, just before the
+// display pass. Mouse motion that arrived while the frame was traced is
+// drained now and applied on top of the simulation's newest step.
+void Game::latchPresentCamera()
+{
+    SDL_PumpEvents();
+    SDL_Event motion[16];
+    int count;
+    while ((count = SDL_PeepEvents(motion, 16, SDL_GETEVENT, SDL_EVENT_MOUSE_MOTION, SDL_EVENT_MOUSE_MOTION)) > 0)
+        for (int i = 0; i < count; ++i)
+        {
+            input.lookX += motion[i].motion.xrel;
+            input.lookY += motion[i].motion.yrel;
+            if (pendingInputNS == 0)
+                pendingInputNS = motion[i].motion.timestamp;
+        }
+    publishInput();
+
+    const CameraState &cam = cameraState.latest();
+    float latchYaw = cam.yaw + (float)(input.lookX - cam.lookX) * mouseSensitivity;
+    float latchPitch = std::clamp(cam.pitch - (float)(input.lookY - cam.lookY) * mouseSensitivity, -89.0f, 89.0f);
+    vec3 target = cam.pos + lookDirection(latchYaw, latchPitch);
+
+    PresentCamera present;
+    present.origin[0] = cam.pos.x;
+    present.origin[1] = cam.pos.y;
+    present.origin[2] = cam.pos.z;
+    present.warp = cam.pos.x != sampleCameraPos.x || cam.pos.y != sampleCameraPos.y ||
+                   cam.pos.z != sampleCameraPos.z || target.x != sampleCameraTarget.x ||
+                   target.y != sampleCameraTarget.y || target.z != sampleCameraTarget.z;
+    present.lookAt[0] = target.x;
+    present.lookAt[1] = target.y;
+    present.lookAt[2] = target.z;
+    present.pad = 0.0f;
+
+    presentCameraSlot = (presentCameraSlot + 1) % PRESENT_CAMERA_SLOTS;
+    GLintptr offset = presentCameraSlot * presentCameraStride;
+    GLsync &fence = presentCameraFences[presentCameraSlot];
+    if (fence)
+    {
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, PRESENT_FENCE_TIMEOUT_NS);
+        glDeleteSync(fence);
+        fence = nullptr;
     }
+    if (presentCameraMap)
+        std::memcpy(presentCameraMap + offset, &present, sizeof(present));
+    else
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, presentCameraBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(present), &present);
+    }
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, presentCameraBuffer, offset, sizeof(present));
+    latchedInputNS = pendingInputNS;
+    pendingInputNS = 0;
+}
+
+void Game::update()
+{
+    // The camera moves on the simulation thread; take its newest state
+    const CameraState &cam = cameraState.latest();
+    cameraPos = cam.pos;
+    yaw = cam.yaw;
+    pitch = cam.pitch;
+    Uint64 currentTime = SDL_GetTicks();
 
     // FPS counter
     frameCount++;
     static Uint64 fpsTimer = currentTime;
     if (currentTime - fpsTimer >= 1000)
     {
+        // Mean input-to-present latency over the interval (and the worst)
+        std::string latency = "-";
+        if (latencyCount > 0)
+            latency = std::to_string((int)std::lround(latencySumMs / latencyCount)) + " ms (max " +
+                      std::to_string((int)std::lround(latencyMaxMs)) + ")";
         std::cout << "FPS: " << frameCount
                   << " | Cam: " << cameraPos.x << "," << cameraPos.y << "," << cameraPos.z
                   << " | Focus: " << focusDist 
                   << " | Blur: " << defocusAngle 
                   << " | Depth: " << maxDepth 
+                  << " | Lights: " << lightCount << (lightSampling ? " (BVH)" : " (uniform)")
+                  << " | ReSTIR DI: " << (restirDI ? "on" : "off")
+                  << " | ReSTIR GI: " << (restirGI ? "on" : "off")
+                  << " | Sky: " << (envEnabled ? "environment map" : "gradient")
+                  << " | Cache: " << (cacheEnabled ? "on" : "off")
+                  << " | Denoise: " << (denoiseEnabled ? "on" : "off")
+                  << " | Res: " << renderW << "x" << renderH << (dynamicResolution ? " (dynamic)" : "")
+                  << " | Upscale: " << (upscaleEnabled ? "edge-adaptive" : "bilinear")
+                  << " | Tiles: " << (tiledDispatch ? std::to_string(tileCount) : "off")
+                  << " | Tier: " << TIER_NAMES[activeTier] << (autoTier ? " (auto)" : "")
+                  << " | Primary: " << (sampleHybrid ? "raster" : "traced")
+                  << " | Hit cache: " << (samplePrimaryCache ? "on" : (primaryCacheEnabled ? "idle" : "off"))
+                  << " | Traced: "
+                  << (int)std::lround(100.0 * foveaTracedFraction(foveation, renderW, renderH) / interleave) << "%"
+                  << " | Adaptive: " << (adaptiveThreshold > 0.0f ? (sampleAdaptive ? "on" : "waiting") : "off")
+                  << " | Rays/px: " << frameSamples << (autoSamples ? " (auto)" : "")
+                  << " | Latency: " << latency
+                  << " | Samples: " << accumSamples
+                  << " | Error: " << accumError
                   << " | SEEDX: "<<seedX
                   << " | SEEDY: "<<seedY<< 
                   "\n";
         frameCount = 0;
+        latencySumMs = 0.0;
+        latencyMaxMs = 0.0;
+        latencyCount = 0;
         fpsTimer = currentTime;
     }
 }
 
+// Nothing to trace or show: the window cannot be seen, or the image is done
+// (budget met or settled) and nothing happened since the last frame (no
+// event, no camera key held, no camera step unseen)
+bool Game::idle() const
+{
+    if (windowHidden)
+        return true;
+    return accumulationDone() && !presentPending && !sampleInProgress() && !cameraState.fresh() && input.held == 0;
+}
+
 void Game::render()
 {
+    if (idle())
+        return;
+    presentPending = false;
+    Uint64 frameStart = SDL_GetTicksNS();
+    bool newSample = !sampleInProgress();
+    if (newSample)
+        updateResolution();
+
     glClear(GL_COLOR_BUFFER_BIT);
     glUseProgram(shader);
     glBindVertexArray(vao);
 
-    // Upload cached scene
-    int send_count = scene_count;
-    if (send_count > 512)
-        send_count = 512; // match shader MAX_SPHERES
-
-    glUniform1i(glGetUniformLocation(shader, "sphere_count"), send_count);
-    
-    // Send vectors
-    if (send_count > 0) {
-        glUniform3fv(glGetUniformLocation(shader, "sphere_centers"), send_count, reinterpret_cast<const float *>(scene_centers.data()));
-        glUniform1fv(glGetUniformLocation(shader, "sphere_radii"), send_count, scene_radii.data());
-        glUniform1iv(glGetUniformLocation(shader, "sphere_material"), send_count, scene_material.data());
-        glUniform3fv(glGetUniformLocation(shader, "sphere_albedo"), send_count, reinterpret_cast<const float *>(scene_albedo.data()));
-        glUniform1fv(glGetUniformLocation(shader, "sphere_fuzz"), send_count, scene_fuzz.data());
-        glUniform1fv(glGetUniformLocation(shader, "sphere_ref_idx"), send_count, scene_ref_idx.data());
-    }
+    glUniform1i(glGetUniformLocation(shader, "light_count"), lightCount);
+    glUniform1i(glGetUniformLocation(shader, "uLightSampling"), lightSampling);
+    glUniform1f(glGetUniformLocation(shader, "uSkyIntensity"), scene.sky_intensity);
+    glUniform1i(glGetUniformLocation(shader, "uEnvMap"), envEnabled ? 1 : 0);
+    glUniform2i(glGetUniformLocation(shader, "uEnvSize"), environment.width, environment.height);
 
     // --- Camera uniforms ---
-    float yawRad = yaw * M_PI / 180.0f;
-    float pitchRad = pitch * M_PI / 180.0f;
-    vec3 forward;
-    forward.x = cosf(yawRad) * cosf(pitchRad);
-    forward.y = sinf(pitchRad);
-    forward.z = sinf(yawRad) * cosf(pitchRad);
-
-    vec3 cameraTarget = cameraPos + forward;
+    // A sample traced in tiles keeps the camera it started with; the display
+    // pass warps it to the current one (latched just before it is drawn)
+    if (newSample)
+    {
+        sampleCameraPos = cameraPos;
+        sampleCameraTarget = cameraPos + lookDirection(yaw, pitch);
+    }
+    const vec3 &cameraTarget = sampleCameraTarget;
 
     glUniform3f(glGetUniformLocation(shader, "uCameraOrigin"),
-                cameraPos.x, cameraPos.y, cameraPos.z);
+                sampleCameraPos.x, sampleCameraPos.y, sampleCameraPos.z);
 
     glUniform3f(glGetUniformLocation(shader, "uLookAt"),
                 cameraTarget.x, cameraTarget.y, cameraTarget.z);
 
     glUniform3f(glGetUniformLocation(shader, "uUp"), 0.0f, 1.0f, 0.0f);
 
-    glUniform1f(glGetUniformLocation(shader, "uFOV"), 20.0f); // Default ~20 deg for zoom look
+    glUniform1f(glGetUniformLocation(shader, "uFOV"), CAMERA_FOV);
     glUniform1f(glGetUniformLocation(shader, "uFocusDist"), focusDist);
     glUniform1f(glGetUniformLocation(shader, "uDefocusAngle"), defocusAngle);
 
-    // --- CORRECTED: Dynamic Seed Generation ---
-    // This ensures the noise pattern changes every frame
-    // float r1 = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-    // float r2 = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
-    
-    // Scale it up so dot product in shader varies significantly
-    glUniform2f(glGetUniformLocation(shader, "uSeed"), 0.1, 0.1);
+    // --- Frame index: decorrelates the per-pixel random streams ---
+    glUniform1ui(glGetUniformLocation(shader, "uFrame"), frameIndex);
+
+    // Traced resolution (WINDOW to the shader), last frame's, and the window's
+    glUniform2f(glGetUniformLocation(shader, "WINDOW"), (float)renderW, (float)renderH);
+    glUniform2f(glGetUniformLocation(shader, "uPrevWindow"), (float)prevRenderW, (float)prevRenderH);
+    glUniform2f(glGetUniformLocation(shader, "uDisplaySize"), (float)WINDOW_W, (float)WINDOW_H);
+
+    // --- ReSTIR: last frame's camera for reprojecting reservoirs ---
+    glUniform3f(glGetUniformLocation(shader, "uPrevCameraOrigin"), prevCameraPos.x, prevCameraPos.y, prevCameraPos.z);
+    glUniform3f(glGetUniformLocation(shader, "uPrevLookAt"), prevCameraTarget.x, prevCameraTarget.y, prevCameraTarget.z);
+    glUniform1i(glGetUniformLocation(shader, "uRestirDI"), restirDI ? 1 : 0);
+    glUniform1i(glGetUniformLocation(shader, "uRestirGI"), restirGI ? 1 : 0);
+    glUniform1i(glGetUniformLocation(shader, "uRestirHistory"), restirHistory ? 1 : 0);
+    glUniform1i(glGetUniformLocation(shader, "uRestirCandidates"), restirCandidates);
+    glUniform1i(glGetUniformLocation(shader, "uRestirSpatialSamples"), restirSpatialSamples);
+    glUniform1f(glGetUniformLocation(shader, "uRestirRadius"), restirRadius);
+
+    // --- Radiance cache ---
+    glUniform1i(glGetUniformLocation(shader, "uCache"), cacheEnabled ? 1 : 0);
+    glUniform1ui(glGetUniformLocation(shader, "uCacheCells"), cacheCells);
+    glUniform1f(glGetUniformLocation(shader, "uCacheCellSize"), cacheCellSize);
+    glUniform1f(glGetUniformLocation(shader, "uCacheMinSamples"), cacheMinSamples);
+    glUniform1f(glGetUniformLocation(shader, "uCacheMaxSamples"), cacheMaxSamples);
+    glUniform1ui(glGetUniformLocation(shader, "uCacheMaxAge"), cacheMaxAge);
+
+    // A moving camera (or a new traced resolution) reprojects the history
+    // and restarts the budget; anything else that changes the image starts
+    // over. Decided once per sample.
+    bool budget = renderBudget();
+    if (newSample)
+    {
+        bool viewMoved = sampleCameraPos.x != prevCameraPos.x || sampleCameraPos.y != prevCameraPos.y ||
+                         sampleCameraPos.z != prevCameraPos.z || cameraTarget.x != prevCameraTarget.x ||
+                         cameraTarget.y != prevCameraTarget.y || cameraTarget.z != prevCameraTarget.z;
+        sampleCameraMoved = viewMoved || renderW != prevRenderW || renderH != prevRenderH;
+
+        // Quality tier: with auto tiers, the motion tier while the camera
+        // moves, then one up every few still samples (render budgets always
+        // take full quality). A new tier keeps the history, counted as one
+        // sample, so the new tier's samples soon take over (and the budget
+        // restarts as after a move); only a render budget starts over, to
+        // leave no preview in the result. ReSTIR's reservoirs carry over
+        // from a tier that resampled.
+        int tier = qualityTier;
+        if (budget)
+            tier = TIER_FULL;
+        else if (autoTier && viewMoved)
+            tier = std::min(qualityTier, motionTier);
+        else if (autoTier)
+            tier = std::min(qualityTier, activeTier + (tierSamples >= TIER_PROMOTE_SAMPLES ? 1 : 0));
+        sampleTierChanged = tier != activeTier && !budget;
+        if (tier != activeTier)
+        {
+            if (activeTier < TIER_GI)
+                restirHistory = false;
+            if (budget)
+                accumDirty = true;
+            activeTier = tier;
+            tierSamples = 0;
+        }
+        tierSamples = viewMoved ? 0 : tierSamples + 1;
+        sampleHistoryValid = !accumDirty;
 
-    glUniform1i(glGetUniformLocation(shader, "uMaxDepth"), maxDepth);
+        // Hybrid mode traces one camera ray per pixel, at a position shared
+        // by all pixels that follows the Halton (2, 3) points
+        sampleHybrid = hybridEnabled && defocusAngle <= 0.0f;
+        unsigned int jitterIndex = frameIndex % HYBRID_JITTER_PERIOD + 1;
+        cameraJitter[0] = sampleHybrid ? halton(jitterIndex, 2) : 0.5f;
+        cameraJitter[1] = sampleHybrid ? halton(jitterIndex, 3) : 0.5f;
+        frameSamples = (resampling() || sampleHybrid) ? 1 : samplesPerFrame;
 
-    // Frame and Window
-    glUniform2f(glGetUniformLocation(shader, "WINDOW"), (float)WINDOW_W, (float)WINDOW_H);
+        // Otherwise camera rays keep their first hits while the view holds
+        // still. The cache starts empty after any change, and fills as the
+        // fixed rays are first traced.
+        samplePrimaryCache = primaryCacheEnabled && !sampleHybrid && defocusAngle <= 0.0f && !sampleCameraMoved;
+        if (samplePrimaryCache && (primaryCacheDirty || !sampleHistoryValid))
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, primaryCacheBuffer);
+            glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+            primaryCacheDirty = false;
+        }
+        else if (!samplePrimaryCache)
+        {
+            primaryCacheDirty = true;
+        }
+
+        // Converged pixels are judged by the last error estimate, so only
+        // once this view has one
+        sampleAdaptive = adaptiveThreshold > 0.0f && sampleHistoryValid && !sampleCameraMoved &&
+                         !sampleTierChanged && accumError >= 0.0f;
+    }
+    glUniform1i(glGetUniformLocation(shader, "uTier"), activeTier);
+    glUniform1i(glGetUniformLocation(shader, "uMaxDepth"),
+                activeTier == TIER_GI ? std::min(maxDepth, TIER_GI_DEPTH) : maxDepth);
+    glUniform1i(glGetUniformLocation(shader, "uSamplesPerFrame"), frameSamples);
+    glUniform1i(glGetUniformLocation(shader, "uPrimaryCache"), samplePrimaryCache ? 1 : 0);
+    glUniform1i(glGetUniformLocation(shader, "uHybrid"), sampleHybrid ? 1 : 0);
+    glUniform2f(glGetUniformLocation(shader, "uCameraJitter"), cameraJitter[0], cameraJitter[1]);
+    glUniform1i(glGetUniformLocation(shader, "uPrimaryIds"), 4);
+    glUniform1i(glGetUniformLocation(shader, "uHistoryValid"), sampleHistoryValid ? 1 : 0);
+    glUniform1i(glGetUniformLocation(shader, "uCameraMoved"), sampleCameraMoved ? 1 : 0);
+    glUniform1i(glGetUniformLocation(shader, "uTierChanged"), sampleTierChanged ? 1 : 0);
+    int pattern = budget ? 1 : interleave;
+    glUniform1i(glGetUniformLocation(shader, "uInterleave"), pattern);
+    glUniform1i(glGetUniformLocation(shader, "uFovea"), (foveation.enabled && !budget) ? 1 : 0);
+    glUniform2f(glGetUniformLocation(shader, "uFoveaCenter"), foveation.x, foveation.y);
+    glUniform1f(glGetUniformLocation(shader, "uFoveaRadius"), foveation.radius);
+    glUniform1f(glGetUniformLocation(shader, "uAdaptive"), sampleAdaptive ? adaptiveThreshold : 0.0f);
+    if (newSample && (accumDirty || sampleCameraMoved || sampleTierChanged))
+    {
+        accumDirty = false;
+        accumSamples = 0;
+        accumError = -1.0f;
+        accumStart = SDL_GetTicks();
+        lastSampleTicks = accumStart;
+        budgetReached = false;
+        accumSettled = false;
+        guideDirty = true;
+    }
 
     // Draw fullscreen quad
+    GLint passLoc = glGetUniformLocation(shader, "uPass");
+    bool traced = !accumulationDone();
+    bool sampleDone = false;
+    if (traced)
+    {
+        if (newSample)
+            beginSample();
+        sampleDone = traceTiles(pattern, frameStart);
+    }
+    if (sampleDone)
+    {
+        prevRenderW = renderW;
+        prevRenderH = renderH;
+        accumSamples += frameSamples;
+
+        // Budgets. The time budget stops before a sample that would overrun
+        // it, judged by the last one. ReSTIR's temporal reuse correlates the
+        // frames, so with it on the error estimate is optimistic.
+        Uint64 now = SDL_GetTicks();
+        double elapsed = (now - accumStart) / 1000.0;
+        double sampleSeconds = (now - lastSampleTicks) / 1000.0;
+        lastSampleTicks = now;
+        if (accumSamples / ERROR_INTERVAL != (accumSamples - frameSamples) / ERROR_INTERVAL)
+            accumError = estimateError();
+        bool timeUp = timeBudget > 0.0 && elapsed + sampleSeconds > timeBudget;
+        bool converged = errorBudget > 0.0f && accumSamples >= ERROR_MIN_SAMPLES && accumError >= 0.0f &&
+                         accumError <= errorBudget;
+        bool filled = sampleBudget > 0 && accumSamples >= sampleBudget;
+        if (timeUp || converged || filled)
+            finishBudget(elapsed);
+        if (!budget && accumSamples >= ERROR_MIN_SAMPLES &&
+            ((accumError >= 0.0f && accumError <= SETTLED_ERROR) || accumSamples >= SETTLED_MAX_SAMPLES))
+            accumSettled = true;
+    }
+
+    // Display pass: the running mean, denoised if on, gamma corrected, to the window
+    if (denoiseEnabled)
+    {
+        GLuint denoised = denoise();
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, denoised);
+        glActiveTexture(GL_TEXTURE0);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, WINDOW_W, WINDOW_H);
+    bool upscale = upscaleEnabled && (renderW < WINDOW_W || renderH < WINDOW_H);
+    if (upscale && guideDirty)
+    {
+        // Pass 9: the window pixels' primary hits, which guide the upscaler
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glUniform1i(passLoc, 9);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        guideDirty = false;
+    }
+    glUniform1i(glGetUniformLocation(shader, "uUpscale"), upscale ? 1 : 0);
+    bindHistory(historyIndex);
+    glUniform1i(glGetUniformLocation(shader, "uDenoiseInput"), 2);
+    glUniform1i(glGetUniformLocation(shader, "uDisplayDenoised"), denoiseEnabled ? 1 : 0);
+    latchPresentCamera();
+    glUniform1i(passLoc, 5);
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    if (presentCameraMap)
+        presentCameraFences[presentCameraSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
     SDL_GL_SwapWindow(window);
+    if (latchedInputNS != 0)
+    {
+        double ms = (SDL_GetTicksNS() - latchedInputNS) / 1e6;
+        latencySumMs += ms;
+        latencyMaxMs = std::max(latencyMaxMs, ms);
+        latencyCount++;
+        latchedInputNS = 0;
+    }
+
+    if (!sampleInProgress())
+    {
+        prevCameraPos = sampleCameraPos;
+        prevCameraTarget = sampleCameraTarget;
+        frameIndex++;
+    }
 }
 
-// Build the final random world once
-void Game::buildFinalScene()
+// Start a sample: the other history pair is written, reading the newest.
+// In tiles it starts as a copy of the newest, so the display shows the
+// finished tiles over the last sample's image. The radiance cache is
+// updated for the whole sample first.
+void Game::beginSample()
 {
-    scene_centers.clear();
-    scene_radii.clear();
-    scene_material.clear();
-    scene_albedo.clear();
-    scene_fuzz.clear();
-    scene_ref_idx.clear();
+    GLint passLoc = glGetUniformLocation(shader, "uPass");
+    historyIndex = 1 - historyIndex;
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, primaryHitBuffer[historyIndex]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, primaryHitBuffer[1 - historyIndex]);
+
+    int tileSize = tiledDispatch ? TILE_SIZE : std::max(renderW, renderH);
+    tileColumns = (renderW + tileSize - 1) / tileSize;
+    tileCount = tileColumns * ((renderH + tileSize - 1) / tileSize);
+    tilesDone = 0;
+    if (tileCount > 1)
+    {
+        int newest = 1 - historyIndex;
+        glCopyImageSubData(historyTexture[newest], GL_TEXTURE_2D, 0, 0, 0, 0, historyTexture[historyIndex],
+                           GL_TEXTURE_2D, 0, 0, 0, 0, WINDOW_W, WINDOW_H, 1);
+        glCopyImageSubData(momentsTexture[newest], GL_TEXTURE_2D, 0, 0, 0, 0, momentsTexture[historyIndex],
+                           GL_TEXTURE_2D, 0, 0, 0, 0, WINDOW_W, WINDOW_H, 1);
+        glBindBuffer(GL_COPY_READ_BUFFER, primaryHitBuffer[newest]);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, primaryHitBuffer[historyIndex]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                            (size_t)WINDOW_W * WINDOW_H * 12 * sizeof(float));
+    }
 
-    std::mt19937 rng(1337); // fixed seed => deterministic layout
-    std::uniform_real_distribution<float> rnd01(0.0f, 1.0f);
+    // GPU time of the sample's setup (cache passes, raster) counts with its first batch
+    SampleTimer &timer = sampleTimers[timerCount % 3];
+    timer.used = 0;
+    timer.scale = resolutionScale;
+    timer.samples = frameSamples;
+    timerCount++;
+    beginTimer();
+    if (sampleHybrid)
+        rasterizePrimary();
+    if (cacheEnabled && activeTier >= TIER_GI)
+    {
+        // Pass 3: full-length paths for one pixel in 16 add samples to the
+        // cache; pass 4 folds them into the cells' means. Both draw over a
+        // quarter-size viewport (no color), so every fragment has work.
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glViewport(0, 0, (renderW + 3) / 4, (renderH + 3) / 4);
+        glUniform1i(passLoc, 3);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glUniform1i(passLoc, 4);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 
-    // 1. Large Ground Sphere
-    scene_centers.emplace_back(0.0f, -1000.0f, 0.0f);
-    scene_radii.push_back(1000.0f);
-    scene_material.push_back(MAT_LAMBERTIAN);
-    scene_albedo.emplace_back(0.5f, 0.5f, 0.5f);
-    scene_fuzz.push_back(0.0f);
-    scene_ref_idx.push_back(0.0f);
+        // Empty the list of sampled cells for the next frame
+        GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, cacheDirtyBuffer);
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    }
+}
 
-    // 2. Small Random Spheres
-    for (int a = -11; a < 11; ++a)
+// Start timing a batch of the sample in progress (if not already)
+void Game::beginTimer()
+{
+    if (timerOpen)
+        return;
+    SampleTimer &timer = sampleTimers[(timerCount - 1) % 3];
+    if (timer.used == (int)timer.queries.size())
     {
-        for (int b = -11; b < 11; ++b)
-        {
-            float choose_mat = rnd01(rng);
-            float cx = a + 0.9f * rnd01(rng);
-            float cz = b + 0.9f * rnd01(rng);
-            vec3 center(cx, 0.2f, cz);
+        GLuint query = 0;
+        glGenQueries(1, &query);
+        timer.queries.push_back(query);
+    }
+    glBeginQuery(GL_TIME_ELAPSED, timer.queries[timer.used++]);
+    timerOpen = true;
+}
 
-            // Avoid intersecting the big 3 spheres in the center
-            if (length(center - vec3(4.0f, 0.2f, 0.0f)) <= 0.9f) continue;
-            if (length(center - vec3(0.0f, 0.2f, 0.0f)) <= 0.9f) continue;
-            if (length(center - vec3(-4.0f, 0.2f, 0.0f)) <= 0.9f) continue;
+void Game::endTimer()
+{
+    if (!timerOpen)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    timerOpen = false;
+}
 
-            if (choose_mat < 0.8f)
-            {
-                // Diffuse
-                scene_material.push_back(MAT_LAMBERTIAN);
-                vec3 acol(rnd01(rng) * rnd01(rng), rnd01(rng) * rnd01(rng), rnd01(rng) * rnd01(rng));
-                scene_albedo.push_back(acol);
-                scene_fuzz.push_back(0.0f);
-                scene_ref_idx.push_back(0.0f);
-                scene_centers.push_back(center);
-                scene_radii.push_back(0.2f);
-            }
-            else if (choose_mat < 0.95f)
+// Hybrid mode: an instanced quad per sphere, ray-cast in the fragment
+// shader and depth tested, leaves every traced pixel's first sphere in
+// primaryIdTexture (texture unit 4) for the shading passes to start from
+void Game::rasterizePrimary()
+{
+    glUseProgram(impostorShader);
+    glUniform2f(glGetUniformLocation(impostorShader, "WINDOW"), (float)renderW, (float)renderH);
+    glUniform3f(glGetUniformLocation(impostorShader, "uCameraOrigin"),
+                sampleCameraPos.x, sampleCameraPos.y, sampleCameraPos.z);
+    glUniform3f(glGetUniformLocation(impostorShader, "uLookAt"),
+                sampleCameraTarget.x, sampleCameraTarget.y, sampleCameraTarget.z);
+    glUniform3f(glGetUniformLocation(impostorShader, "uUp"), 0.0f, 1.0f, 0.0f);
+    glUniform1f(glGetUniformLocation(impostorShader, "uFOV"), CAMERA_FOV);
+    glUniform2f(glGetUniformLocation(impostorShader, "uCameraJitter"), cameraJitter[0], cameraJitter[1]);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, impostorFbo);
+    glViewport(0, 0, renderW, renderH);
+    GLint sky = -1;
+    GLfloat farthest = 0.0f;
+    glClearBufferiv(GL_COLOR, 0, &sky);
+    glClearBufferfv(GL_DEPTH, 0, &farthest);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_GREATER);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, scene.count());
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(shader);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, primaryIdTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// Trace tiles of the sample in progress, bottom row first, until it is done
+// or the frame's trace budget is spent; returns whether it is done. Tiles go
+// in batches sized by their measured cost, with a glFinish after each batch
+// to check the time (one tile at least per frame). ReSTIR's spatial reuse
+// sees last sample's reservoirs across the borders of tiles not traced yet.
+bool Game::traceTiles(int pattern, Uint64 frameStart)
+{
+    GLint passLoc = glGetUniformLocation(shader, "uPass");
+    int tileSize = (tileCount > 1) ? TILE_SIZE : std::max(renderW, renderH);
+    // The shading passes draw the pattern's packed viewport
+    int packX = (pattern == 1) ? 1 : 2;
+    int packY = (pattern == 4) ? 2 : 1;
+    auto elapsedMs = [&]() { return (SDL_GetTicksNS() - frameStart) / 1e6f; };
+
+    bindHistory(1 - historyIndex);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, sampleTexture);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_2D, errorTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(glGetUniformLocation(shader, "uSamples"), 3);
+    glUniform1i(glGetUniformLocation(shader, "uConvergence"), 5);
+    glEnable(GL_SCISSOR_TEST);
+    while (sampleInProgress())
+    {
+        beginTimer();
+        int batch = 1;
+        if (tileCount > 1 && tileMs > 0.0f)
+            batch = std::clamp((int)((tileBudgetMs - elapsedMs()) / tileMs), 1, tileCount - tilesDone);
+        float batchStart = elapsedMs();
+        for (int i = 0; i < batch; ++i, ++tilesDone)
+        {
+            int x0 = (tilesDone % tileColumns) * tileSize;
+            int y0 = (tilesDone / tileColumns) * tileSize;
+
+            glBindFramebuffer(GL_FRAMEBUFFER, sampleFbo);
+            glViewport(0, 0, (renderW + packX - 1) / packX, (renderH + packY - 1) / packY);
+            glScissor(x0 / packX, y0 / packY, tileSize / packX, tileSize / packY);
+            if (resampling())
             {
-                // Metal
-                scene_material.push_back(MAT_METAL);
-                vec3 acol(0.5f + 0.5f * rnd01(rng), 0.5f + 0.5f * rnd01(rng), 0.5f + 0.5f * rnd01(rng));
-                scene_albedo.push_back(acol);
-                scene_fuzz.push_back(0.5f * rnd01(rng));
-                scene_ref_idx.push_back(0.0f);
-                scene_centers.push_back(center);
-                scene_radii.push_back(0.2f);
+                // Pass 1: candidates + temporal reuse into the reservoir buffers (no color)
+                glUniform1i(passLoc, 1);
+                glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+                // Pass 2: spatial reuse, visibility of the surviving samples, shading
+                glUniform1i(passLoc, 2);
+                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
             }
             else
             {
-                // Glass
-                scene_material.push_back(MAT_DIELECTRIC);
-                scene_albedo.push_back(vec3(1.0f, 1.0f, 1.0f));
-                scene_fuzz.push_back(0.0f);
-                scene_ref_idx.push_back(1.5f);
-                scene_centers.push_back(center);
-                scene_radii.push_back(0.2f);
+                glUniform1i(passLoc, 0);
+                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
             }
+
+            // Pass 8: blend the samples into the history over the tile;
+            // pixels the pattern skipped carry theirs over
+            glBindFramebuffer(GL_FRAMEBUFFER, historyFbo[historyIndex]);
+            glViewport(0, 0, renderW, renderH);
+            glScissor(x0, y0, tileSize, tileSize);
+            glUniform1i(passLoc, 8);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
         }
+        endTimer();
+        if (tileCount == 1)
+            break;
+
+        glFinish();
+        float cost = (elapsedMs() - batchStart) / batch;
+        tileMs = (tileMs > 0.0f) ? tileMs + TILE_COST_SMOOTHING * (cost - tileMs) : cost;
+        if (elapsedMs() >= tileBudgetMs)
+            break;
     }
+    glDisable(GL_SCISSOR_TEST);
+    // The error pass draws into it
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    if (sampleInProgress())
+        return false;
+    if (resampling())
+        restirHistory = true;
+    return true;
+}
+
+// Mean relative MSE over the image: the error pass writes each pixel's
+// estimate and the mip chain averages them down to one texel. Below window
+// size the rest of the target is cleared and the mean scaled back up.
+float Game::estimateError()
+{
+    GLint passLoc = glGetUniformLocation(shader, "uPass");
+    float zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    glBindFramebuffer(GL_FRAMEBUFFER, errorFbo);
+    glClearBufferfv(GL_COLOR, 0, zero);
+    glViewport(0, 0, renderW, renderH);
+    bindHistory(historyIndex);
+    glUniform1i(passLoc, 6);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+
+    int levels = 1;
+    for (int size = std::max(WINDOW_W, WINDOW_H); size > 1; size /= 2)
+        levels++;
+    float error = 0.0f;
+    glBindTexture(GL_TEXTURE_2D, errorTexture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glGetTexImage(GL_TEXTURE_2D, levels - 1, GL_RED, GL_FLOAT, &error);
+    return error * ((float)WINDOW_W * WINDOW_H) / ((float)renderW * renderH);
+}
+
+// Variance estimate, then one a-trous level per pass, ping-ponging between
+// the two denoise targets. Returns the texture holding the result.
+GLuint Game::denoise()
+{
+    GLint stepLoc = glGetUniformLocation(shader, "uDenoiseStep");
+    glUniform1i(glGetUniformLocation(shader, "uPass"), 7);
+    glUniform1i(glGetUniformLocation(shader, "uDenoiseInput"), 2);
+    glUniform1f(glGetUniformLocation(shader, "uDenoiseSigmaLuminance"), denoiseSigmaLuminance);
+    bindHistory(historyIndex);
+
+    int out = 0;
+    glBindFramebuffer(GL_FRAMEBUFFER, denoiseFbo[out]);
+    glViewport(0, 0, renderW, renderH);
+    glUniform1i(stepLoc, 0);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    glActiveTexture(GL_TEXTURE2);
+    for (int level = 0; level < denoiseLevels; ++level)
+    {
+        glBindTexture(GL_TEXTURE_2D, denoiseTexture[out]);
+        out = 1 - out;
+        glBindFramebuffer(GL_FRAMEBUFFER, denoiseFbo[out]);
+        glUniform1i(stepLoc, 1 << level);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    return denoiseTexture[out];
+}
+
+// The newest primary hits' albedo, normal and depth as <basePath>_albedo.pfm,
+// _normal.pfm and _depth.pfm. One jittered hit per pixel, not an average.
+void Game::writeAovs(const std::string &basePath)
+{
+    size_t pixels = (size_t)renderW * renderH;
+    std::vector<float> hits(pixels * 12);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, primaryHitBuffer[historyIndex]);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, hits.size() * sizeof(float), hits.data());
+
+    // std430 PrimaryHit: pos, id | normal, depth | albedo, pad; rows bottom-up
+    std::vector<vec3> albedo(pixels), normal(pixels), depth(pixels);
+    for (int y = 0; y < renderH; ++y)
+        for (int x = 0; x < renderW; ++x)
+        {
+            const float *h = &hits[((size_t)(renderH - 1 - y) * renderW + x) * 12];
+            size_t i = (size_t)y * renderW + x;
+            normal[i] = vec3(h[4], h[5], h[6]);
+            depth[i] = vec3(h[7], h[7], h[7]);
+            albedo[i] = vec3(h[8], h[9], h[10]);
+        }
 
-    // 3. Three Main Big Spheres
-    
-    // Middle: Glass
-    scene_centers.push_back(vec3(0.0f, 1.0f, 0.0f));
-    scene_radii.push_back(1.0f);
-    scene_material.push_back(MAT_DIELECTRIC);
-    scene_albedo.push_back(vec3(1.0f, 1.0f, 1.0f));
-    scene_fuzz.push_back(0.0f);
-    scene_ref_idx.push_back(1.5f);
-
-    // Left: Lambertian (Matte)
-    scene_centers.push_back(vec3(-4.0f, 1.0f, 0.0f));
-    scene_radii.push_back(1.0f);
-    scene_material.push_back(MAT_LAMBERTIAN);
-    scene_albedo.push_back(vec3(0.4f, 0.2f, 0.1f));
-    scene_fuzz.push_back(0.0f);
-    scene_ref_idx.push_back(0.0f);
-
-    // Right: Metal
-    scene_centers.push_back(vec3(4.0f, 1.0f, 0.0f));
-    scene_radii.push_back(1.0f);
-    scene_material.push_back(MAT_METAL);
-    scene_albedo.push_back(vec3(0.7f, 0.6f, 0.5f));
-    scene_fuzz.push_back(0.0f);
-    scene_ref_idx.push_back(0.0f);
-
-    scene_count = (int)scene_centers.size();
-}
\ No newline at end of file
+    const char *names[] = {"_albedo.pfm", "_normal.pfm", "_depth.pfm"};
+    const std::vector<vec3> *images[] = {&albedo, &normal, &depth};
+    for (int i = 0; i < 3; ++i)
+        if (!writePfm(basePath + names[i], renderW, renderH, *images[i]))
+            std::cerr << "Could not write " << basePath + names[i] << "\n";
+}
+
+// Dynamic resolution: aim the rays traced per frame at the frame-time
+// target. The GPU time of a traced frame is read three traced frames later
+// (a ring of timer queries, so reading one never stalls) and, being roughly
+// proportional to the pixel count and the rays per pixel, scaled to a
+// smoothed cost of one ray per window pixel. The frame budget over that
+// cost is how many such rays fit. Below one, the scale follows its square
+// root; it moves in whole steps, and only when more than a step off, so it
+// settles. Above, the rays per pixel follow it (also at a fixed scale and
+// during render budgets), changing only when more than half a ray off.
+void Game::updateResolution()
+{
+    bool budget = renderBudget();
+    bool tuneScale = dynamicResolution && targetFps > 0.0f && !budget;
+    bool tuneSamples = autoSamples && targetFps > 0.0f;
+    if (!tuneScale)
+    {
+        float fixed = budget ? 1.0f : fixedResolutionScale;
+        if (resolutionScale != fixed)
+            setResolutionScale(fixed);
+    }
+    if (!tuneSamples && autoSamples)
+        samplesPerFrame = 1;
+    if ((!tuneScale && !tuneSamples) || timerCount < 3 || timerRead == timerCount)
+        return;
+
+    // Queries finish in order: the last batch's result means all are in
+    const SampleTimer &timer = sampleTimers[timerCount % 3];
+    GLint available = 0;
+    if (timer.used > 0)
+        glGetQueryObjectiv(timer.queries[timer.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (timer.used > 0 && !available)
+        return;
+    GLuint64 nanoseconds = 0;
+    for (int i = 0; i < timer.used; ++i)
+    {
+        GLuint64 batch = 0;
+        glGetQueryObjectui64v(timer.queries[i], GL_QUERY_RESULT, &batch);
+        nanoseconds += batch;
+    }
+    timerRead = timerCount;
+    if (nanoseconds == 0)
+        return;
+
+    float scale = timer.scale;
+    float cost = (float)nanoseconds * 1e-9f / (scale * scale * timer.samples);
+    frameCost = (frameCost > 0.0f) ? frameCost + FRAME_COST_SMOOTHING * (cost - frameCost) : cost;
+    float capacity = RESOLUTION_HEADROOM / targetFps / frameCost;
+    if (tuneScale)
+    {
+        float wanted = std::min(1.0f, std::max(minResolutionScale, std::sqrt(capacity)));
+        if (std::fabs(wanted - resolutionScale) > RESOLUTION_STEP)
+            setResolutionScale(std::round(wanted / RESOLUTION_STEP) * RESOLUTION_STEP);
+    }
+    if (tuneSamples)
+    {
+        float rays = capacity / (resolutionScale * resolutionScale);
+        if (std::fabs(rays - samplesPerFrame) > 0.5f)
+            samplesPerFrame = std::clamp((int)rays, 1, MAX_SAMPLES_PER_FRAME);
+    }
+}
+
+// Traced size for a scale of the window. The next frame reprojects its
+// history from the old size; ReSTIR's reservoirs are indexed by it, so they
+// start over.
+void Game::setResolutionScale(float scale)
+{
+    resolutionScale = scale;
+    renderW = std::max(1, (int)std::lround(WINDOW_W * scale));
+    renderH = std::max(1, (int)std::lround(WINDOW_H * scale));
+    restirHistory = false;
+}
+
+// History pair `index` as the shader's uHistory / uHistoryMoments
+void Game::bindHistory(int index)
+{
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, historyTexture[index]);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, momentsTexture[index]);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(glGetUniformLocation(shader, "uHistory"), 0);
+    glUniform1i(glGetUniformLocation(shader, "uHistoryMoments"), 1);
+}
+
+// Report a met budget once; write the image and quit if a file was asked for
+void Game::finishBudget(double seconds)
+{
+    budgetReached = true;
+    if (accumError < 0.0f && accumSamples >= 2)
+        accumError = estimateError();
+    std::cout << "Budget reached: " << accumSamples << " spp in " << seconds << " s, estimated relMSE "
+              << accumError << "\n";
+    if (outputPath.empty())
+        return;
+
+    // Rows come back bottom-up; image files start at the top. The traced
+    // pixels are the lower-left corner of the window-sized target.
+    std::vector<float> history((size_t)WINDOW_W * WINDOW_H * 4);
+    glBindTexture(GL_TEXTURE_2D, historyTexture[historyIndex]);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, history.data());
+    std::vector<vec3> image((size_t)renderW * renderH);
+    for (int y = 0; y < renderH; ++y)
+        for (int x = 0; x < renderW; ++x)
+        {
+            const float *p = &history[((size_t)(renderH - 1 - y) * WINDOW_W + x) * 4];
+            image[(size_t)y * renderW + x] = vec3(p[0], p[1], p[2]);
+        }
+
+    bool ppm = outputPath.size() >= 4 && outputPath.compare(outputPath.size() - 4, 4, ".ppm") == 0;
+    bool ok = ppm ? writePpm(outputPath, renderW, renderH, image) : writePfm(outputPath, renderW, renderH, image);
+    if (!ok)
+        std::cerr << "Could not write " << outputPath << "\n";
+    else
+        std::cout << "Wrote " << outputPath << "\n";
+    if (aovExport)
+        writeAovs(outputPath.substr(0, outputPath.find_last_of('.')));
+    isRunning = false;
+}
+
+void Game::loadScene(int index)
+{
+    sceneIndex = index;
+    restirHistory = false;
+    if (sceneIndex == 1)
+        buildLightsScene(scene);
+    else if (sceneIndex == 2)
+        buildGlassScene(scene);
+    else
+        buildFinalScene(scene);
+    uploadScene();
+    clearRadianceCache();
+}
+
+// Build the acceleration structures on the CPU and upload everything the
+// shader reads from storage buffers. Called only when the scene changes.
+void Game::uploadScene()
+{
+    Bvh bvh;
+    buildBvh(scene, bvh);
+
+    LightBvh lightBvh;
+    buildLightBvh(scene, lightBvh);
+    lightCount = (int)lightBvh.lights.size();
+
+    std::vector<GpuSphere> spheres(scene.count());
+    for (int i = 0; i < scene.count(); ++i)
+    {
+        GpuSphere &g = spheres[i];
+        g.center[0] = scene.centers[i].x; g.center[1] = scene.centers[i].y; g.center[2] = scene.centers[i].z;
+        g.radius = scene.radii[i];
+        g.albedo[0] = scene.albedo[i].x; g.albedo[1] = scene.albedo[i].y; g.albedo[2] = scene.albedo[i].z;
+        g.fuzz = scene.fuzz[i];
+        g.emission[0] = scene.emission[i].x; g.emission[1] = scene.emission[i].y; g.emission[2] = scene.emission[i].z;
+        g.ref_idx = scene.ref_idx[i];
+        g.material = scene.material[i];
+        g.trail_lo = (unsigned int)(lightBvh.trail[i] & 0xffffffffu);
+        g.trail_hi = (unsigned int)(lightBvh.trail[i] >> 32);
+        g.pad = 0;
+    }
+
+    uploadStorageBuffer(sphereBuffer, 0, spheres.data(), spheres.size() * sizeof(GpuSphere));
+    uploadStorageBuffer(bvhNodeBuffer, 1, bvh.nodes.data(), bvh.nodes.size() * sizeof(BvhNode));
+    uploadStorageBuffer(bvhIndexBuffer, 2, bvh.prim_indices.data(), bvh.prim_indices.size() * sizeof(int));
+    uploadStorageBuffer(lightNodeBuffer, 3, lightBvh.nodes.data(), lightBvh.nodes.size() * sizeof(LightBvhNode));
+    uploadStorageBuffer(lightListBuffer, 4, lightBvh.lights.data(), lightBvh.lights.size() * sizeof(int));
+}
+
+// Radiance and alias table of the environment map (binding 9)
+void Game::uploadEnvironment()
+{
+    std::vector<EnvTexel> texels;
+    buildEnvironmentTexels(environment, texels);
+    uploadStorageBuffer(envBuffer, 9, texels.data(), texels.size() * sizeof(EnvTexel));
+}
+
+// Per-pixel buffers that persist across frames. Sized for the window.
+void Game::resizeRenderTargets()
+{
+    // std430 Reservoir and GIReservoir in fragment.glsl: four vec4-sized rows each
+    size_t reservoirBytes = (size_t)WINDOW_W * WINDOW_H * 16 * sizeof(float);
+
+    GLuint *buffers[] = {&restirFinalBuffer, &restirInitialBuffer, &giFinalBuffer, &giInitialBuffer};
+    for (int i = 0; i < 4; ++i)
+    {
+        if (*buffers[i] == 0)
+            glGenBuffers(1, buffers[i]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, *buffers[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, reservoirBytes, nullptr, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5 + i, *buffers[i]);
+    }
+
+    // History pairs, their primary hits (std430 PrimaryHit in fragment.glsl:
+    // three vec4-sized rows), the denoiser's targets, the upscaler's window
+    // primary hits, the shading passes' sample target and the error image the
+    // budget check averages
+    for (int i = 0; i < 2; ++i)
+    {
+        createRenderTexture(historyTexture[i], GL_RGBA32F, WINDOW_W, WINDOW_H, false);
+        createRenderTexture(momentsTexture[i], GL_R32F, WINDOW_W, WINDOW_H, false);
+        if (historyFbo[i] == 0)
+            glGenFramebuffers(1, &historyFbo[i]);
+        glBindFramebuffer(GL_FRAMEBUFFER, historyFbo[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, historyTexture[i], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, momentsTexture[i], 0);
+        GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glDrawBuffers(2, drawBuffers);
+
+        if (primaryHitBuffer[i] == 0)
+            glGenBuffers(1, &primaryHitBuffer[i]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, primaryHitBuffer[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)WINDOW_W * WINDOW_H * 12 * sizeof(float), nullptr, GL_DYNAMIC_COPY);
+
+        createRenderTexture(denoiseTexture[i], GL_RGBA32F, WINDOW_W, WINDOW_H, false);
+        if (denoiseFbo[i] == 0)
+            glGenFramebuffers(1, &denoiseFbo[i]);
+        glBindFramebuffer(GL_FRAMEBUFFER, denoiseFbo[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, denoiseTexture[i], 0);
+    }
+    if (displayHitBuffer == 0)
+        glGenBuffers(1, &displayHitBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, displayHitBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)WINDOW_W * WINDOW_H * 12 * sizeof(float), nullptr, GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, displayHitBuffer);
+
+    // 16-bit first hit per pixel cell (PRIMARY_CACHE_GRID^2 = 16 per pixel)
+    if (primaryCacheBuffer == 0)
+        glGenBuffers(1, &primaryCacheBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, primaryCacheBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)WINDOW_W * WINDOW_H * 16 * sizeof(uint16_t), nullptr,
+                 GL_DYNAMIC_COPY);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, primaryCacheBuffer);
+    primaryCacheDirty = true;
+
+    // Hybrid mode's impostor pass target: first sphere and reversed depth
+    if (primaryIdTexture == 0)
+        glGenTextures(1, &primaryIdTexture);
+    glBindTexture(GL_TEXTURE_2D, primaryIdTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, WINDOW_W, WINDOW_H, 0, GL_RED_INTEGER, GL_INT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    if (impostorDepthTexture == 0)
+        glGenTextures(1, &impostorDepthTexture);
+    glBindTexture(GL_TEXTURE_2D, impostorDepthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, WINDOW_W, WINDOW_H, 0, GL_DEPTH_COMPONENT, GL_FLOAT,
+                 nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    if (impostorFbo == 0)
+        glGenFramebuffers(1, &impostorFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, impostorFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, primaryIdTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, impostorDepthTexture, 0);
+
+    createRenderTexture(sampleTexture, GL_RGBA32F, WINDOW_W, WINDOW_H, false);
+    if (sampleFbo == 0)
+        glGenFramebuffers(1, &sampleFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, sampleFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sampleTexture, 0);
+    createRenderTexture(errorTexture, GL_R32F, WINDOW_W, WINDOW_H, true);
+    if (errorFbo == 0)
+        glGenFramebuffers(1, &errorFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, errorFbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, errorTexture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // A sample in progress was being traced into the old targets; its
+    // time is dropped
+    endTimer();
+    if (sampleInProgress())
+        sampleTimers[(timerCount - 1) % 3].used = 0;
+    tileCount = tilesDone = 0;
+
+    restirHistory = false;
+    accumDirty = true;
+    setResolutionScale(resolutionScale);
+}
+
+// Empty the radiance cache (std430 CacheCell in fragment.glsl: three
+// vec4-sized rows) and its list of cells sampled this frame, which has room
+// for every cell. Cached radiance only holds for the scene and sky it was
+// gathered under.
+void Game::clearRadianceCache()
+{
+    if (cacheBuffer == 0)
+    {
+        size_t bytes[] = {(size_t)cacheCells * 12 * sizeof(float), ((size_t)cacheCells + 1) * sizeof(GLuint)};
+        GLuint *buffers[] = {&cacheBuffer, &cacheDirtyBuffer};
+        for (int i = 0; i < 2; ++i)
+        {
+            glGenBuffers(1, buffers[i]);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, *buffers[i]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, bytes[i], nullptr, GL_DYNAMIC_COPY);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10 + i, *buffers[i]);
+        }
+    }
+
+    GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cacheBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cacheDirtyBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+}
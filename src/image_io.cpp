@@ -0,0 +1,108 @@
+#include "image_io.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+bool hostIsLittleEndian()
+{
+    uint32_t one = 1;
+    unsigned char b;
+    std::memcpy(&b, &one, 1);
+    return b == 1;
+}
+
+float swapFloat(float f)
+{
+    unsigned char b[4], r[4];
+    std::memcpy(b, &f, 4);
+    r[0] = b[3]; r[1] = b[2]; r[2] = b[1]; r[3] = b[0];
+    std::memcpy(&f, r, 4);
+    return f;
+}
+} // namespace
+
+bool writePfm(const std::string &path, int width, int height, const std::vector<vec3> &pixels)
+{
+    std::ofstream out(path, std::ios::binary);
+    if (!out || (size_t)width * height != pixels.size()) return false;
+
+    // Native byte order; negative scale marks little-endian
+    out << "PF\n" << width << " " << height << "\n" << (hostIsLittleEndian() ? "-1.0" : "1.0") << "\n";
+
+    // PFM rows run bottom to top
+    std::vector<float> row((size_t)width * 3);
+    for (int y = height - 1; y >= 0; --y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            const vec3 &p = pixels[(size_t)y * width + x];
+            row[3 * x] = p.x; row[3 * x + 1] = p.y; row[3 * x + 2] = p.z;
+        }
+        out.write(reinterpret_cast<const char *>(row.data()), row.size() * sizeof(float));
+    }
+    return (bool)out;
+}
+
+bool readPfm(const std::string &path, int &width, int &height, std::vector<vec3> &pixels)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    std::string magic;
+    in >> magic;
+    int channels = (magic == "PF") ? 3 : (magic == "Pf" ? 1 : 0);
+    if (channels == 0) return false;
+
+    float scale = 0.0f;
+    in >> width >> height >> scale;
+    if (!in || width <= 0 || height <= 0) return false;
+    in.get(); // the single whitespace byte before the raster
+
+    std::vector<float> data((size_t)width * height * channels);
+    in.read(reinterpret_cast<char *>(data.data()), data.size() * sizeof(float));
+    if ((size_t)in.gcount() != data.size() * sizeof(float)) return false;
+
+    // Negative scale = little-endian data; |scale| multiplies every sample
+    bool fileLittle = scale < 0.0f;
+    float s = std::fabs(scale) > 0.0f ? std::fabs(scale) : 1.0f;
+    if (fileLittle != hostIsLittleEndian())
+        for (float &f : data) f = swapFloat(f);
+
+    pixels.resize((size_t)width * height);
+    for (int y = 0; y < height; ++y)
+    {
+        const float *row = data.data() + (size_t)(height - 1 - y) * width * channels;
+        for (int x = 0; x < width; ++x)
+        {
+            const float *p = row + (size_t)x * channels;
+            pixels[(size_t)y * width + x] =
+                channels == 3 ? vec3(p[0], p[1], p[2]) * s : vec3(p[0], p[0], p[0]) * s;
+        }
+    }
+    return true;
+}
+
+bool writePpm(const std::string &path, int width, int height, const std::vector<vec3> &pixels, float exposure)
+{
+    std::ofstream out(path, std::ios::binary);
+    if (!out || (size_t)width * height != pixels.size()) return false;
+
+    out << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<unsigned char> bytes(pixels.size() * 3);
+    for (size_t i = 0; i < pixels.size(); ++i)
+    {
+        const vec3 &p = pixels[i];
+        float c[3] = {p.x, p.y, p.z};
+        for (int k = 0; k < 3; ++k)
+        {
+            float v = std::sqrt(std::min(1.0f, std::max(0.0f, c[k] * exposure)));
+            bytes[3 * i + k] = (unsigned char)(v * 255.0f + 0.5f);
+        }
+    }
+    out.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    return (bool)out;
+}
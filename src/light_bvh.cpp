@@ -0,0 +1,235 @@
+#include "light_bvh.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace
+{
+const int BUCKET_COUNT = 12;
+const int MAX_SAOH_DEPTH = 40; // past this, split at the median so trails fit in 64 bits
+
+struct LightBounds
+{
+    vec3 bmin = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+    vec3 bmax = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    float phi = 0.0f;
+    vec3 w = vec3(0.0f, 0.0f, 1.0f);
+    float cos_theta_o = 1.0f;
+    float cos_theta_e = 1.0f;
+};
+
+float axis(const vec3 &v, int a) { return a == 0 ? v.x : (a == 1 ? v.y : v.z); }
+float safeAcos(float c) { return std::acos(std::min(1.0f, std::max(-1.0f, c))); }
+
+// Rotate v about the unit axis k by theta (Rodrigues)
+vec3 rotate(const vec3 &v, const vec3 &k, float theta)
+{
+    float c = std::cos(theta), s = std::sin(theta);
+    return v * c + cross(k, v) * s + k * (dot(k, v) * (1.0f - c));
+}
+
+// Smallest cone containing both cones (pbrt's DirectionCone Union)
+void unionCone(const vec3 &wa, float cos_a, const vec3 &wb, float cos_b, vec3 &w, float &cos_o)
+{
+    float theta_a = safeAcos(cos_a), theta_b = safeAcos(cos_b);
+    float theta_d = safeAcos(dot(wa, wb));
+    if (std::min(theta_d + theta_b, (float)M_PI) <= theta_a) { w = wa; cos_o = cos_a; return; }
+    if (std::min(theta_d + theta_a, (float)M_PI) <= theta_b) { w = wb; cos_o = cos_b; return; }
+
+    float theta_o = 0.5f * (theta_a + theta_d + theta_b);
+    vec3 wr = cross(wa, wb);
+    if (theta_o >= (float)M_PI || dot(wr, wr) == 0.0f)
+    {
+        w = wa;
+        cos_o = -1.0f; // whole sphere of directions
+        return;
+    }
+    w = rotate(wa, normalize(wr), theta_o - theta_a);
+    cos_o = std::cos(theta_o);
+}
+
+LightBounds unionBounds(const LightBounds &a, const LightBounds &b)
+{
+    if (a.phi == 0.0f) return b;
+    if (b.phi == 0.0f) return a;
+
+    LightBounds r;
+    r.bmin = vec3(std::min(a.bmin.x, b.bmin.x), std::min(a.bmin.y, b.bmin.y), std::min(a.bmin.z, b.bmin.z));
+    r.bmax = vec3(std::max(a.bmax.x, b.bmax.x), std::max(a.bmax.y, b.bmax.y), std::max(a.bmax.z, b.bmax.z));
+    r.phi = a.phi + b.phi;
+    unionCone(a.w, a.cos_theta_o, b.w, b.cos_theta_o, r.w, r.cos_theta_o);
+    r.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+    return r;
+}
+
+// Surface-area-orientation cost of a candidate child (pbrt's LightBVH EvaluateCost)
+float evaluateCost(const LightBounds &b, const LightBounds &parent, int dim)
+{
+    float theta_o = safeAcos(b.cos_theta_o), theta_e = safeAcos(b.cos_theta_e);
+    float theta_w = std::min(theta_o + theta_e, (float)M_PI);
+    float sin_theta_o = std::sqrt(std::max(0.0f, 1.0f - b.cos_theta_o * b.cos_theta_o));
+    float m_omega = 2.0f * (float)M_PI * (1.0f - b.cos_theta_o) +
+                    (float)M_PI / 2.0f * (2.0f * theta_w * sin_theta_o - std::cos(theta_o - 2.0f * theta_w) -
+                                          2.0f * theta_o * sin_theta_o + b.cos_theta_o);
+
+    vec3 pd = parent.bmax - parent.bmin;
+    float kr = std::max(pd.x, std::max(pd.y, pd.z)) / std::max(axis(pd, dim), 1e-6f);
+
+    vec3 d = b.bmax - b.bmin;
+    float area = 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    return b.phi * m_omega * kr * area;
+}
+
+struct Entry
+{
+    int sphere;
+    LightBounds bounds;
+    vec3 centroid;
+};
+
+struct Builder
+{
+    LightBvh &bvh;
+    std::vector<Entry> entries;
+
+    explicit Builder(LightBvh &b) : bvh(b) {}
+
+    void storeBounds(int node, const LightBounds &b)
+    {
+        LightBvhNode &n = bvh.nodes[node];
+        n.bmin[0] = b.bmin.x; n.bmin[1] = b.bmin.y; n.bmin[2] = b.bmin.z;
+        n.bmax[0] = b.bmax.x; n.bmax[1] = b.bmax.y; n.bmax[2] = b.bmax.z;
+        n.w[0] = b.w.x; n.w[1] = b.w.y; n.w[2] = b.w.z;
+        n.phi = b.phi;
+        n.cos_theta_o = b.cos_theta_o;
+        n.cos_theta_e = b.cos_theta_e;
+    }
+
+    int build(int start, int end, uint64_t trail, int depth)
+    {
+        int node = (int)bvh.nodes.size();
+        bvh.nodes.push_back(LightBvhNode());
+
+        LightBounds bounds;
+        LightBounds cbounds; // centroid extent only
+        for (int i = start; i < end; ++i)
+        {
+            bounds = unionBounds(bounds, entries[i].bounds);
+            const vec3 &c = entries[i].centroid;
+            cbounds.bmin = vec3(std::min(cbounds.bmin.x, c.x), std::min(cbounds.bmin.y, c.y), std::min(cbounds.bmin.z, c.z));
+            cbounds.bmax = vec3(std::max(cbounds.bmax.x, c.x), std::max(cbounds.bmax.y, c.y), std::max(cbounds.bmax.z, c.z));
+        }
+        storeBounds(node, bounds);
+
+        if (end - start == 1)
+        {
+            bvh.nodes[node].child_or_light = entries[start].sphere;
+            bvh.nodes[node].is_leaf = 1;
+            bvh.trail[entries[start].sphere] = trail;
+            return node;
+        }
+
+        int best_axis = -1, best_bucket = -1;
+        float best_cost = FLT_MAX;
+        if (depth < MAX_SAOH_DEPTH)
+        {
+            for (int a = 0; a < 3; ++a)
+            {
+                float lo = axis(cbounds.bmin, a), hi = axis(cbounds.bmax, a);
+                if (hi - lo < 1e-6f) continue;
+
+                LightBounds buckets[BUCKET_COUNT];
+                float scale = BUCKET_COUNT / (hi - lo);
+                for (int i = start; i < end; ++i)
+                {
+                    int b = std::min(BUCKET_COUNT - 1, (int)((axis(entries[i].centroid, a) - lo) * scale));
+                    buckets[b] = unionBounds(buckets[b], entries[i].bounds);
+                }
+
+                for (int s = 1; s < BUCKET_COUNT; ++s)
+                {
+                    LightBounds left, right;
+                    for (int b = 0; b < s; ++b) left = unionBounds(left, buckets[b]);
+                    for (int b = s; b < BUCKET_COUNT; ++b) right = unionBounds(right, buckets[b]);
+                    if (left.phi == 0.0f || right.phi == 0.0f) continue;
+                    float cost = evaluateCost(left, bounds, a) + evaluateCost(right, bounds, a);
+                    if (cost > 0.0f && cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_axis = a;
+                        best_bucket = s;
+                    }
+                }
+            }
+        }
+
+        int mid;
+        if (best_axis < 0)
+        {
+            // Coincident centroids, zero-power clusters or too deep: median split
+            mid = (start + end) / 2;
+            vec3 ext = cbounds.bmax - cbounds.bmin;
+            int a = (ext.x > ext.y && ext.x > ext.z) ? 0 : (ext.y > ext.z ? 1 : 2);
+            std::nth_element(entries.begin() + start, entries.begin() + mid, entries.begin() + end,
+                             [a](const Entry &l, const Entry &r) { return axis(l.centroid, a) < axis(r.centroid, a); });
+        }
+        else
+        {
+            float lo = axis(cbounds.bmin, best_axis), hi = axis(cbounds.bmax, best_axis);
+            float scale = BUCKET_COUNT / (hi - lo);
+            auto split = std::partition(entries.begin() + start, entries.begin() + end, [&](const Entry &e) {
+                int b = std::min(BUCKET_COUNT - 1, (int)((axis(e.centroid, best_axis) - lo) * scale));
+                return b < best_bucket;
+            });
+            mid = (int)(split - entries.begin());
+        }
+
+        build(start, mid, trail, depth + 1);
+        int right = build(mid, end, trail | (uint64_t(1) << depth), depth + 1);
+        bvh.nodes[node].child_or_light = right;
+        bvh.nodes[node].is_leaf = 0;
+        return node;
+    }
+};
+} // namespace
+
+void buildLightBvh(const Scene &scene, LightBvh &bvh)
+{
+    bvh.nodes.clear();
+    bvh.lights.clear();
+    bvh.trail.assign(scene.count(), 0);
+
+    Builder builder(bvh);
+    for (int i = 0; i < scene.count(); ++i)
+    {
+        if (scene.material[i] != MAT_DIFFUSE_LIGHT) continue;
+
+        const vec3 &c = scene.centers[i];
+        const vec3 &le = scene.emission[i];
+        float r = scene.radii[i];
+
+        // Spheres emit in every direction: the full cone (theta_o = pi)
+        // with an emission spread of pi/2 past it.
+        Entry e;
+        e.sphere = i;
+        e.centroid = c;
+        e.bounds.bmin = c - vec3(r, r, r);
+        e.bounds.bmax = c + vec3(r, r, r);
+        e.bounds.phi = (float)M_PI * 4.0f * (float)M_PI * r * r * std::max(le.x, std::max(le.y, le.z));
+        e.bounds.w = vec3(0.0f, 0.0f, 1.0f);
+        e.bounds.cos_theta_o = -1.0f;
+        e.bounds.cos_theta_e = 0.0f;
+        if (e.bounds.phi <= 0.0f) continue;
+
+        builder.entries.push_back(e);
+        bvh.lights.push_back(i);
+    }
+
+    if (builder.entries.empty()) return;
+    bvh.nodes.reserve(2 * builder.entries.size());
+    builder.build(0, (int)builder.entries.size(), 0, 0);
+}
@@ -1,9 +1,89 @@
 #include"game.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
 
 Game game(1920, 1080);
 
-int main()
+int main(int argc, char *argv[])
 {
+    // ./app [--fps TARGET | --scale S] [--spf N] [--tier T] [--auto-tier] [--hybrid]
+    //       [--fovea X,Y,RADIUS] [--tile-ms MS] [--adaptive RELMSE] [--time SECONDS]
+    //       [--error RELMSE] [--spp N] [--output FILE [--aov]] [sky.hdr]
+    // --fps sets the frame rate dynamic resolution holds (0 = off), --scale
+    // a fixed traced size instead; --spf fixes the camera rays per pixel per
+    // frame (0 = tuned to the frame rate); --tier caps the quality tier (0
+    // albedo, 1 ambient occlusion, 2 limited GI, 3 full); --auto-tier
+    // previews at ambient occlusion while the camera moves; --hybrid
+    // rasterizes primary visibility (sphere impostors) instead of tracing
+    // it; --fovea turns on foveated sampling around a point of the window;
+    // --tile-ms sets the trace time per frame (by default 3/4 of a refresh
+    // interval), beyond which a sample continues next frame while the last
+    // image is presented (0 = whole samples); --adaptive stops tracing the
+    // pixels of a still view whose estimated relative MSE is below it.
+    // Without a budget a still view is traced until it converges; with one
+    // (time, error or samples per pixel) it accumulates at full size until
+    // that is met. Either way the app then sleeps until input or the window
+    // changes; with --output it is then written (.pfm or .ppm), with --aov
+    // also its albedo, normal and depth, and the app exits.
+    const char *valueOptions[] = {"--fps", "--scale", "--spf", "--tier", "--tile-ms", "--fovea",
+                                  "--adaptive", "--time", "--error", "--spp", "--output"};
+    std::string environment;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        for (const char *o : valueOptions)
+            if (a == o && i + 1 >= argc)
+            {
+                std::fprintf(stderr, "%s needs a value\n", a.c_str());
+                return 1;
+            }
+        if (a == "--fps" && i + 1 < argc)
+            game.setTargetFps((float)std::atof(argv[++i]));
+        else if (a == "--scale" && i + 1 < argc)
+            game.setRenderScale((float)std::atof(argv[++i]));
+        else if (a == "--spf" && i + 1 < argc)
+            game.setSamplesPerFrame(std::atoi(argv[++i]));
+        else if (a == "--tier" && i + 1 < argc)
+            game.setQualityTier(std::atoi(argv[++i]));
+        else if (a == "--auto-tier")
+            game.setAutoTier(true);
+        else if (a == "--hybrid")
+            game.setHybrid(true);
+        else if (a == "--tile-ms" && i + 1 < argc)
+            game.setTileBudget((float)std::atof(argv[++i]));
+        else if (a == "--fovea" && i + 1 < argc)
+        {
+            float x = 0.5f, y = 0.5f, radius = 0.25f;
+            std::sscanf(argv[++i], "%f,%f,%f", &x, &y, &radius);
+            game.setFoveation(x, y, radius);
+        }
+        else if (a == "--adaptive" && i + 1 < argc)
+            game.setAdaptiveThreshold((float)std::atof(argv[++i]));
+        else if (a == "--time" && i + 1 < argc)
+            game.setTimeBudget(std::atof(argv[++i]));
+        else if (a == "--error" && i + 1 < argc)
+            game.setErrorBudget((float)std::atof(argv[++i]));
+        else if (a == "--spp" && i + 1 < argc)
+            game.setSampleBudget(std::atoi(argv[++i]));
+        else if (a == "--output" && i + 1 < argc)
+            game.setOutputFile(argv[++i]);
+        else if (a == "--aov")
+            game.setAovExport(true);
+        else if (a.rfind("--", 0) == 0)
+        {
+            std::fprintf(stderr, "unknown option %s\n", a.c_str());
+            return 1;
+        }
+        else if (!environment.empty())
+        {
+            std::fprintf(stderr, "more than one environment map (%s, %s)\n", environment.c_str(), a.c_str());
+            return 1;
+        }
+        else
+            environment = a;
+    }
+    if (!environment.empty()) game.setEnvironmentFile(environment); // optional HDR environment map
 
     if(!game.init("Ray tracer")){   
         return -1;
@@ -18,4 +98,4 @@ int main()
     
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,252 @@
+#include "path_guiding.h"
+#include <algorithm>
+#include <cmath>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace
+{
+// Area-preserving cylindrical map between the unit square and the sphere:
+// u = (cos theta + 1) / 2 about +y, v = phi / 2 pi
+void directionToSquare(const vec3 &d, float &u, float &v)
+{
+    float cos_theta = std::min(1.0f, std::max(-1.0f, d.y));
+    float phi = std::atan2(d.z, d.x);
+    if (phi < 0.0f) phi += 2.0f * (float)M_PI;
+    u = std::min(0.5f * (cos_theta + 1.0f), 0.99999994f);
+    v = std::min(phi / (2.0f * (float)M_PI), 0.99999994f);
+}
+
+vec3 squareToDirection(float u, float v)
+{
+    float cos_theta = 2.0f * u - 1.0f;
+    float sin_theta = std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+    float phi = 2.0f * (float)M_PI * v;
+    return vec3(sin_theta * std::cos(phi), cos_theta, sin_theta * std::sin(phi));
+}
+
+float axisOf(const vec3 &v, int a) { return a == 0 ? v.x : (a == 1 ? v.y : v.z); }
+void setAxis(vec3 &v, int a, float x) { (a == 0 ? v.x : (a == 1 ? v.y : v.z)) = x; }
+
+// Quadrant of (u, v) and the coordinates rescaled into it
+int descend(float &u, float &v)
+{
+    int q = 0;
+    if (u >= 0.5f) { q |= 1; u -= 0.5f; }
+    if (v >= 0.5f) { q |= 2; v -= 0.5f; }
+    u *= 2.0f;
+    v *= 2.0f;
+    return q;
+}
+} // namespace
+
+// -------------------
+// DIRECTIONAL QUADTREE
+// -------------------
+DTree::DTree() : nodes(1) {}
+
+void DTree::record(float u, float v, float value)
+{
+    sampleCount += 1.0f;
+    uint32_t n = 0;
+    while (true)
+    {
+        int q = descend(u, v);
+        nodes[n].sum[q] += value;
+        if (nodes[n].child[q] == 0) return;
+        n = nodes[n].child[q];
+    }
+}
+
+float DTree::total() const
+{
+    const Node &root = nodes[0];
+    return root.sum[0] + root.sum[1] + root.sum[2] + root.sum[3];
+}
+
+void DTree::sample(Rng &rng, float &u, float &v) const
+{
+    float ox = 0.0f, oy = 0.0f, size = 1.0f;
+    uint32_t n = 0;
+    while (true)
+    {
+        const Node &node = nodes[n];
+        float s = node.sum[0] + node.sum[1] + node.sum[2] + node.sum[3];
+        if (s <= 0.0f) break; // nothing learned here: uniform over the region
+
+        float r = rng.uniform() * s;
+        int q = 0;
+        while (q < 3 && r >= node.sum[q])
+        {
+            r -= node.sum[q];
+            ++q;
+        }
+        while (node.sum[q] <= 0.0f) q = (q + 3) % 4; // rounding landed on an empty quadrant
+
+        size *= 0.5f;
+        ox += (q & 1) ? size : 0.0f;
+        oy += (q & 2) ? size : 0.0f;
+        if (node.child[q] == 0) break;
+        n = node.child[q];
+    }
+    u = std::min(ox + size * rng.uniform(), 0.99999994f);
+    v = std::min(oy + size * rng.uniform(), 0.99999994f);
+}
+
+float DTree::pdf(float u, float v) const
+{
+    float p = 1.0f;
+    uint32_t n = 0;
+    while (true)
+    {
+        const Node &node = nodes[n];
+        float s = node.sum[0] + node.sum[1] + node.sum[2] + node.sum[3];
+        if (s <= 0.0f) return p;
+
+        int q = descend(u, v);
+        p *= 4.0f * node.sum[q] / s;
+        if (p == 0.0f || node.child[q] == 0) return p;
+        n = node.child[q];
+    }
+}
+
+DTree DTree::refined(float rho, int maxDepth) const
+{
+    DTree out;
+    out.sampleCount = sampleCount;
+    float t = total();
+    if (t > 0.0f)
+        refineNode(out, 0, 0, t, rho, 1, maxDepth);
+    else
+        out.nodes = nodes; // keep the structure, zeroed below
+
+    for (Node &n : out.nodes)
+        for (int q = 0; q < 4; ++q) n.sum[q] = 0.0f;
+    return out;
+}
+
+void DTree::refineNode(DTree &out, uint32_t outNode, uint32_t node, float t, float rho, int depth,
+                       int maxDepth) const
+{
+    for (int q = 0; q < 4; ++q)
+    {
+        if (depth >= maxDepth || nodes[node].sum[q] / t <= rho) continue;
+
+        uint32_t child = (uint32_t)out.nodes.size();
+        out.nodes.push_back(Node());
+        out.nodes[outNode].child[q] = child;
+
+        // Existing subtrees refine further; a leaf splits one level per iteration
+        if (nodes[node].child[q] != 0)
+            refineNode(out, child, nodes[node].child[q], t, rho, depth + 1, maxDepth);
+    }
+}
+
+// -------------------
+// SPATIAL TREE
+// -------------------
+PathGuide::PathGuide(const vec3 &bmin, const vec3 &bmax)
+{
+    // Cube around the bounds, so splits cycling x, y, z keep cells near-cubic
+    vec3 c = (bmin + bmax) * 0.5f;
+    vec3 e = bmax - bmin;
+    float half = 0.5f * std::max(e.x, std::max(e.y, e.z)) * 1.01f + 1e-3f;
+    lo = c - vec3(half, half, half);
+    hi = c + vec3(half, half, half);
+
+    SNode root;
+    root.leaf = 0;
+    nodes.push_back(root);
+    leaves.push_back(Leaf());
+}
+
+int PathGuide::leafAt(const vec3 &p) const
+{
+    vec3 a = lo, b = hi;
+    int n = 0;
+    while (nodes[n].child >= 0)
+    {
+        int ax = nodes[n].axis;
+        float mid = 0.5f * (axisOf(a, ax) + axisOf(b, ax));
+        if (axisOf(p, ax) < mid)
+        {
+            setAxis(b, ax, mid);
+            n = nodes[n].child;
+        }
+        else
+        {
+            setAxis(a, ax, mid);
+            n = nodes[n].child + 1;
+        }
+    }
+    return nodes[n].leaf;
+}
+
+vec3 PathGuide::sample(int leaf, Rng &rng, float &pdf) const
+{
+    float u, v;
+    const DTree &tree = leaves[leaf].sampling;
+    tree.sample(rng, u, v);
+    pdf = tree.pdf(u, v) / (4.0f * (float)M_PI);
+    return squareToDirection(u, v);
+}
+
+float PathGuide::pdf(int leaf, const vec3 &dir) const
+{
+    float u, v;
+    directionToSquare(dir, u, v);
+    return leaves[leaf].sampling.pdf(u, v) / (4.0f * (float)M_PI);
+}
+
+void PathGuide::record(int leaf, const vec3 &dir, float value)
+{
+    if (!(value >= 0.0f) || !std::isfinite(value)) return;
+
+    float u, v;
+    directionToSquare(dir, u, v);
+    std::lock_guard<std::mutex> lock(locks[leaf % LOCK_COUNT]);
+    leaves[leaf].building.record(u, v, value);
+}
+
+// Split a spatial leaf in half (copying its trees) until every piece has
+// seen at most threshold records
+void PathGuide::subdivide(int node, float threshold)
+{
+    int leaf = nodes[node].leaf;
+    if (leaf < 0 || leaves[leaf].building.statisticalWeight() <= threshold) return;
+
+    leaves[leaf].building.scaleWeight(0.5f);
+    leaves[leaf].sampling.scaleWeight(0.5f);
+    int other = (int)leaves.size();
+    leaves.push_back(leaves[leaf]);
+
+    int child = (int)nodes.size();
+    SNode left, right;
+    left.axis = right.axis = (nodes[node].axis + 1) % 3;
+    left.leaf = leaf;
+    right.leaf = other;
+    nodes.push_back(left);
+    nodes.push_back(right);
+    nodes[node].child = child;
+    nodes[node].leaf = -1;
+
+    subdivide(child, threshold);
+    subdivide(child + 1, threshold);
+}
+
+void PathGuide::nextIteration(int spp)
+{
+    float threshold = spatialThreshold * std::sqrt((float)std::max(spp, 1));
+    int count = (int)nodes.size();
+    for (int n = 0; n < count; ++n)
+        subdivide(n, threshold);
+
+    for (Leaf &leaf : leaves)
+    {
+        leaf.sampling = leaf.building;
+        leaf.building = leaf.building.refined(directionalRho, maxDirectionalDepth);
+    }
+    ++iteration;
+}
@@ -0,0 +1,105 @@
+#include "photon_map.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include "cpu_tracer.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace
+{
+const int BUILD_CHUNK = 4096; // photons per parallel work item
+} // namespace
+
+uint32_t PhotonMap::cellIndex(int x, int y, int z) const
+{
+    uint32_t h = (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u;
+    return h & cellMask;
+}
+
+void PhotonMap::build(std::vector<Photon> &&input, float radius, int threadCount)
+{
+    searchRadius = radius;
+    invCellSize = 1.0f / (2.0f * radius);
+
+    size_t n = input.size();
+    uint32_t cells = 1024;
+    while (cells < 2 * n) cells *= 2;
+    cellMask = cells - 1;
+
+    int chunks = (int)((n + BUILD_CHUNK - 1) / BUILD_CHUNK);
+    auto range = [&](int chunk, size_t &begin, size_t &end) {
+        begin = (size_t)chunk * BUILD_CHUNK;
+        end = std::min(n, begin + BUILD_CHUNK);
+    };
+
+    // Cell of every photon, and how many land in each cell
+    std::vector<uint32_t> cellOf(n);
+    std::unique_ptr<std::atomic<uint32_t>[]> counts(new std::atomic<uint32_t>[cells]);
+    for (uint32_t c = 0; c < cells; ++c) counts[c].store(0, std::memory_order_relaxed);
+    parallelRows(chunks, threadCount, [&](int chunk) {
+        size_t begin, end;
+        range(chunk, begin, end);
+        for (size_t i = begin; i < end; ++i)
+        {
+            const vec3 &p = input[i].position;
+            cellOf[i] = cellIndex((int)std::floor(p.x * invCellSize), (int)std::floor(p.y * invCellSize),
+                                  (int)std::floor(p.z * invCellSize));
+            counts[cellOf[i]].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    // Exclusive prefix sum, then scatter with the counters as cursors
+    cellStart.assign(cells + 1, 0);
+    for (uint32_t c = 0; c < cells; ++c)
+    {
+        cellStart[c + 1] = cellStart[c] + counts[c].load(std::memory_order_relaxed);
+        counts[c].store(cellStart[c], std::memory_order_relaxed);
+    }
+
+    photons.resize(n);
+    parallelRows(chunks, threadCount, [&](int chunk) {
+        size_t begin, end;
+        range(chunk, begin, end);
+        for (size_t i = begin; i < end; ++i)
+            photons[counts[cellOf[i]].fetch_add(1, std::memory_order_relaxed)] = input[i];
+    });
+
+    input.clear();
+    input.shrink_to_fit();
+}
+
+vec3 PhotonMap::irradiance(const vec3 &p, const vec3 &n) const
+{
+    vec3 sum;
+    if (photons.empty()) return sum;
+
+    // The 2x2x2 cells nearest p cover the whole search sphere
+    float gx = p.x * invCellSize - 0.5f, gy = p.y * invCellSize - 0.5f, gz = p.z * invCellSize - 0.5f;
+    int x0 = (int)std::floor(gx), y0 = (int)std::floor(gy), z0 = (int)std::floor(gz);
+    float r2 = searchRadius * searchRadius;
+
+    uint32_t seen[8];
+    int seenCount = 0;
+    for (int dz = 0; dz < 2; ++dz)
+        for (int dy = 0; dy < 2; ++dy)
+            for (int dx = 0; dx < 2; ++dx)
+            {
+                // Two of the cells may hash to the same bucket; visit it once
+                uint32_t c = cellIndex(x0 + dx, y0 + dy, z0 + dz);
+                if (std::find(seen, seen + seenCount, c) != seen + seenCount) continue;
+                seen[seenCount++] = c;
+
+                for (uint32_t i = cellStart[c]; i < cellStart[c + 1]; ++i)
+                {
+                    const Photon &ph = photons[i];
+                    vec3 d = ph.position - p;
+                    if (dot(d, d) > r2 || dot(ph.direction, n) >= 0.0f) continue;
+                    sum += ph.power;
+                }
+            }
+    return sum * (1.0f / ((float)M_PI * r2));
+}
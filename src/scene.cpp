@@ -0,0 +1,154 @@
+#include "scene.h"
+#include <random>
+#include <cmath>
+
+void Scene::clear()
+{
+    centers.clear();
+    radii.clear();
+    material.clear();
+    albedo.clear();
+    fuzz.clear();
+    ref_idx.clear();
+    emission.clear();
+}
+
+void Scene::addSphere(const vec3 &center, float radius, int mat, const vec3 &alb,
+                      float fz, float ri, const vec3 &emit)
+{
+    centers.push_back(center);
+    radii.push_back(radius);
+    material.push_back(mat);
+    albedo.push_back(alb);
+    fuzz.push_back(fz);
+    ref_idx.push_back(ri);
+    emission.push_back(emit);
+}
+
+// Build the final random world once
+void buildFinalScene(Scene &scene)
+{
+    scene.clear();
+    scene.sky_intensity = 1.0f;
+
+    std::mt19937 rng(1337); // fixed seed => deterministic layout
+    std::uniform_real_distribution<float> rnd01(0.0f, 1.0f);
+
+    // 1. Large Ground Sphere
+    scene.addSphere(vec3(0.0f, -1000.0f, 0.0f), 1000.0f, MAT_LAMBERTIAN, vec3(0.5f, 0.5f, 0.5f));
+
+    // 2. Small Random Spheres
+    for (int a = -11; a < 11; ++a)
+    {
+        for (int b = -11; b < 11; ++b)
+        {
+            float choose_mat = rnd01(rng);
+            float cx = a + 0.9f * rnd01(rng);
+            float cz = b + 0.9f * rnd01(rng);
+            vec3 center(cx, 0.2f, cz);
+
+            // Avoid intersecting the big 3 spheres in the center
+            if (length(center - vec3(4.0f, 0.2f, 0.0f)) <= 0.9f) continue;
+            if (length(center - vec3(0.0f, 0.2f, 0.0f)) <= 0.9f) continue;
+            if (length(center - vec3(-4.0f, 0.2f, 0.0f)) <= 0.9f) continue;
+
+            if (choose_mat < 0.8f)
+            {
+                // Diffuse
+                vec3 acol(rnd01(rng) * rnd01(rng), rnd01(rng) * rnd01(rng), rnd01(rng) * rnd01(rng));
+                scene.addSphere(center, 0.2f, MAT_LAMBERTIAN, acol);
+            }
+            else if (choose_mat < 0.95f)
+            {
+                // Metal
+                vec3 acol(0.5f + 0.5f * rnd01(rng), 0.5f + 0.5f * rnd01(rng), 0.5f + 0.5f * rnd01(rng));
+                float fz = 0.5f * rnd01(rng);
+                scene.addSphere(center, 0.2f, MAT_METAL, acol, fz);
+            }
+            else
+            {
+                // Glass
+                scene.addSphere(center, 0.2f, MAT_DIELECTRIC, vec3(1.0f, 1.0f, 1.0f), 0.0f, 1.5f);
+            }
+        }
+    }
+
+    // 3. Three Main Big Spheres
+
+    // Middle: Glass
+    scene.addSphere(vec3(0.0f, 1.0f, 0.0f), 1.0f, MAT_DIELECTRIC, vec3(1.0f, 1.0f, 1.0f), 0.0f, 1.5f);
+
+    // Left: Lambertian (Matte)
+    scene.addSphere(vec3(-4.0f, 1.0f, 0.0f), 1.0f, MAT_LAMBERTIAN, vec3(0.4f, 0.2f, 0.1f));
+
+    // Right: Metal
+    scene.addSphere(vec3(4.0f, 1.0f, 0.0f), 1.0f, MAT_METAL, vec3(0.7f, 0.6f, 0.5f));
+}
+
+void buildLightsScene(Scene &scene)
+{
+    scene.clear();
+    scene.sky_intensity = 0.02f; // night: the emitters do the lighting
+
+    std::mt19937 rng(4242);
+    std::uniform_real_distribution<float> rnd01(0.0f, 1.0f);
+
+    scene.addSphere(vec3(0.0f, -1000.0f, 0.0f), 1000.0f, MAT_LAMBERTIAN, vec3(0.5f, 0.5f, 0.5f));
+    scene.addSphere(vec3(0.0f, 1.0f, 0.0f), 1.0f, MAT_DIELECTRIC, vec3(1.0f, 1.0f, 1.0f), 0.0f, 1.5f);
+    scene.addSphere(vec3(-4.0f, 1.0f, 0.0f), 1.0f, MAT_LAMBERTIAN, vec3(0.4f, 0.2f, 0.1f));
+    scene.addSphere(vec3(4.0f, 1.0f, 0.0f), 1.0f, MAT_METAL, vec3(0.7f, 0.6f, 0.5f));
+
+    // 64 x 64 grid of small lamps hanging at random heights. Most are dim,
+    // a few are bright, so light power is spread very unevenly.
+    const int grid = 64;
+    for (int a = 0; a < grid; ++a)
+    {
+        for (int b = 0; b < grid; ++b)
+        {
+            float cx = -12.0f + 24.0f * (a + rnd01(rng)) / grid;
+            float cz = -12.0f + 24.0f * (b + rnd01(rng)) / grid;
+            float cy = 0.4f + 3.0f * rnd01(rng);
+            vec3 center(cx, cy, cz);
+
+            if (length(center - vec3(4.0f, 1.0f, 0.0f)) <= 1.2f) continue;
+            if (length(center - vec3(0.0f, 1.0f, 0.0f)) <= 1.2f) continue;
+            if (length(center - vec3(-4.0f, 1.0f, 0.0f)) <= 1.2f) continue;
+
+            vec3 tint(0.3f + 0.7f * rnd01(rng), 0.3f + 0.7f * rnd01(rng), 0.3f + 0.7f * rnd01(rng));
+            float power = rnd01(rng) < 0.05f ? 200.0f : 10.0f * rnd01(rng);
+            scene.addSphere(center, 0.04f, MAT_DIFFUSE_LIGHT, vec3(0.0f, 0.0f, 0.0f), 0.0f, 0.0f, tint * power);
+        }
+    }
+}
+
+void buildGlassScene(Scene &scene)
+{
+    scene.clear();
+    scene.sky_intensity = 0.05f;
+
+    std::mt19937 rng(777);
+    std::uniform_real_distribution<float> rnd01(0.0f, 1.0f);
+
+    scene.addSphere(vec3(0.0f, -1000.0f, 0.0f), 1000.0f, MAT_LAMBERTIAN, vec3(0.6f, 0.6f, 0.6f));
+
+    // The lamp: a small emitter inside a thick glass shell
+    scene.addSphere(vec3(0.0f, 2.6f, 0.0f), 0.7f, MAT_DIELECTRIC, vec3(1.0f, 1.0f, 1.0f), 0.0f, 1.5f);
+    scene.addSphere(vec3(0.0f, 2.6f, 0.0f), 0.12f, MAT_DIFFUSE_LIGHT, vec3(0.0f, 0.0f, 0.0f), 0.0f, 0.0f,
+                    vec3(900.0f, 800.0f, 650.0f));
+
+    // 7 x 7 field, mostly glass
+    for (int a = -3; a <= 3; ++a)
+    {
+        for (int b = -3; b <= 3; ++b)
+        {
+            if (a == 0 && b == 0) continue;
+            float r = 0.25f + 0.15f * rnd01(rng);
+            vec3 center(a * 1.1f + 0.3f * rnd01(rng), r, b * 1.1f + 0.3f * rnd01(rng));
+            if (rnd01(rng) < 0.7f)
+                scene.addSphere(center, r, MAT_DIELECTRIC, vec3(1.0f, 1.0f, 1.0f), 0.0f, 1.5f);
+            else
+                scene.addSphere(center, r, MAT_LAMBERTIAN, vec3(0.2f + 0.7f * rnd01(rng), 0.2f + 0.7f * rnd01(rng),
+                                                               0.2f + 0.7f * rnd01(rng)));
+        }
+    }
+}
@@ -0,0 +1,549 @@
+// Offline benchmarks for the CPU tracing path (no window, no GL).
+//
+//   make bench
+//   ./bench [name ...] [--size WxH] [--ref-spp N] [--target E] [--limit SECONDS]
+//           [--threads N] [--save]
+//
+// Each benchmark renders a reference, then runs competing integrators
+// progressively, reporting the wall-clock time each needs to reach the
+// target relative MSE against the reference, and the error both reach in
+// equal time. --save writes the reference and the final images (.pfm/.ppm).
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include "cpu_tracer.h"
+#include "foveation.h"
+#include "image_io.h"
+#include "path_guiding.h"
+#include "scene.h"
+
+namespace
+{
+struct Options
+{
+    int width = 160;
+    int height = 90;
+    int refSpp = 1024;
+    float target = 0.05f;
+    double limit = 60.0;
+    int threads = 0;
+    bool save = false;
+};
+
+double seconds()
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Mean over pixels and channels of (x - ref)^2 / (ref^2 + 0.01)
+double relativeMse(const std::vector<vec3> &img, const std::vector<vec3> &ref)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < img.size(); ++i)
+    {
+        const float a[3] = {img[i].x, img[i].y, img[i].z};
+        const float r[3] = {ref[i].x, ref[i].y, ref[i].z};
+        for (int c = 0; c < 3; ++c)
+        {
+            double d = a[c] - r[c];
+            sum += d * d / (r[c] * r[c] + 0.01);
+        }
+    }
+    return sum / (3.0 * img.size());
+}
+
+// Median over pixels of the same per-pixel error; robust to the odd firefly
+// that dominates the mean at low sample counts
+double medianRelativeError(const std::vector<vec3> &img, const std::vector<vec3> &ref)
+{
+    std::vector<double> e(img.size());
+    for (size_t i = 0; i < img.size(); ++i)
+    {
+        const float a[3] = {img[i].x, img[i].y, img[i].z};
+        const float r[3] = {ref[i].x, ref[i].y, ref[i].z};
+        double sum = 0.0;
+        for (int c = 0; c < 3; ++c)
+        {
+            double d = a[c] - r[c];
+            sum += d * d / (r[c] * r[c] + 0.01);
+        }
+        e[i] = sum / 3.0;
+    }
+    std::nth_element(e.begin(), e.begin() + e.size() / 2, e.end());
+    return e[e.size() / 2];
+}
+
+struct Result
+{
+    std::string name;
+    double timeToTarget = -1.0; // seconds, -1 = not reached within the limit
+    double sppAtTarget = 0.0;   // mean samples per pixel (passes, without adaptive sampling)
+    double spp = 0.0;
+    double seconds = 0.0;
+    double error = 0.0;
+    double median = 0.0; // medianRelativeError of the final image
+    std::vector<std::pair<double, double>> curve; // (time, error) after each pass
+};
+
+double meanSamples(const Film &film)
+{
+    double n = 0.0;
+    for (int s : film.samples) n += s;
+    return n / film.samples.size();
+}
+
+// Render passes until the error reaches the target or time runs out.
+// setup() runs first and is timed too (e.g. guide training).
+Result progressive(const std::string &name, const Options &opt, const std::vector<vec3> &ref,
+                   const std::function<void()> &setup, const std::function<void(Film &, uint32_t)> &pass)
+{
+    Result r;
+    r.name = name;
+    Film film;
+    film.resize(opt.width, opt.height);
+
+    double start = seconds();
+    double excluded = 0.0; // error evaluation is not part of the render
+    if (setup) setup();
+    for (uint32_t i = 0;; ++i)
+    {
+        pass(film, i);
+        double t0 = seconds();
+        double err = relativeMse(film.image(), ref);
+        excluded += seconds() - t0;
+
+        double elapsed = seconds() - start - excluded;
+        r.curve.push_back(std::make_pair(elapsed, err));
+        r.spp = meanSamples(film);
+        r.seconds = elapsed;
+        r.error = err;
+        if (r.timeToTarget < 0.0 && err <= opt.target)
+        {
+            r.timeToTarget = elapsed;
+            r.sppAtTarget = r.spp;
+        }
+        if (r.timeToTarget >= 0.0 || elapsed >= opt.limit) break;
+    }
+
+    std::vector<vec3> img = film.image();
+    r.median = medianRelativeError(img, ref);
+    if (opt.save)
+    {
+        writePfm("bench_" + name + ".pfm", opt.width, opt.height, img);
+        writePpm("bench_" + name + ".ppm", opt.width, opt.height, img);
+        writePpm("bench_" + name + "_spp.ppm", opt.width, opt.height, film.sampleMap());
+    }
+    return r;
+}
+
+// Error a run had reached by time t (last pass finished before t)
+double errorAt(const Result &r, double t)
+{
+    double err = r.curve.empty() ? 0.0 : r.curve.front().second;
+    for (const auto &p : r.curve)
+    {
+        if (p.first > t) break;
+        err = p.second;
+    }
+    return err;
+}
+
+void report(const char *title, const Options &opt, const std::vector<Result> &results)
+{
+    double equal_time = results.front().seconds;
+    for (const Result &r : results) equal_time = std::min(equal_time, r.seconds);
+
+    std::printf("\n%s (%dx%d, target relMSE %.3f, limit %.0f s)\n", title, opt.width, opt.height, opt.target,
+                opt.limit);
+    std::printf("  %-14s %16s %8s %22s %14s\n", "method", "time-to-target", "spp", "relMSE at equal time",
+                "final median");
+    for (const Result &r : results)
+    {
+        char ttt[32];
+        if (r.timeToTarget >= 0.0)
+            std::snprintf(ttt, sizeof(ttt), "%.2f s", r.timeToTarget);
+        else
+            std::snprintf(ttt, sizeof(ttt), "> %.0f s", opt.limit);
+        std::printf("  %-14s %16s %8.1f %15.4f @ %.1fs %14.5f\n", r.name.c_str(), ttt,
+                    r.timeToTarget >= 0.0 ? r.sppAtTarget : r.spp, errorAt(r, equal_time), equal_time, r.median);
+    }
+    if (results.size() > 1 && results[0].timeToTarget > 0.0 && results[1].timeToTarget > 0.0)
+        std::printf("  speed-up: %.2fx\n", results[0].timeToTarget / results[1].timeToTarget);
+}
+
+// Train the guide in iterations of 1, 2, 4, ... spp for about trainSpp samples
+void trainGuide(CpuTracer &tracer, PathGuide &guide, const Film &shape, int trainSpp)
+{
+    Film film;
+    film.resize(shape.width, shape.height);
+    tracer.guide = &guide;
+    tracer.recordGuide = true;
+    uint32_t pass = 1000000; // keep training samples independent of the final passes
+    for (int spp = 1, used = 0; used + spp <= trainSpp; used += spp, spp *= 2)
+    {
+        for (int i = 0; i < spp; ++i) tracer.renderPass(film, pass++);
+        guide.nextIteration(spp);
+    }
+    tracer.recordGuide = false;
+}
+
+// -------------------
+// BENCHMARKS
+// -------------------
+void glassCamera(CpuTracer &tracer)
+{
+    tracer.camera.origin = vec3(0.0f, 7.0f, 7.5f);
+    tracer.camera.lookAt = vec3(0.0f, 0.3f, 0.5f);
+    tracer.camera.fov = 35.0f;
+    tracer.maxDepth = 10;
+}
+
+// Path guiding against plain BSDF sampling, lamp sealed in glass
+void benchGuiding(const Options &opt)
+{
+    Scene scene;
+    buildGlassScene(scene);
+    CpuTracer tracer(scene);
+    glassCamera(tracer);
+    tracer.threadCount = opt.threads;
+    vec3 lo, hi;
+    tracer.bounds(lo, hi);
+
+    const int trainSpp = 255;
+    Film shape;
+    shape.resize(opt.width, opt.height);
+
+    // Reference: guided, many samples
+    std::printf("guiding: reference at %d spp...\n", opt.refSpp);
+    std::fflush(stdout);
+    // The paper's c = 12000 assumes ~1 megapixel; keep leaves as fine at bench sizes
+    const float threshold = std::max(100.0f, 12000.0f * opt.width * opt.height / (1280.0f * 720.0f));
+    PathGuide refGuide(lo, hi);
+    refGuide.spatialThreshold = threshold;
+    trainGuide(tracer, refGuide, shape, trainSpp);
+    Film refFilm;
+    refFilm.resize(opt.width, opt.height);
+    for (int i = 0; i < opt.refSpp; ++i) tracer.renderPass(refFilm, 2000000 + i);
+    std::vector<vec3> ref = refFilm.image();
+    if (opt.save)
+    {
+        writePfm("bench_guiding_reference.pfm", opt.width, opt.height, ref);
+        writePpm("bench_guiding_reference.ppm", opt.width, opt.height, ref);
+    }
+
+    std::vector<Result> results;
+    tracer.guide = nullptr;
+    results.push_back(progressive("unguided", opt, ref, nullptr, [&](Film &f, uint32_t i) { tracer.renderPass(f, i); }));
+
+    PathGuide guide(lo, hi);
+    guide.spatialThreshold = threshold;
+    results.push_back(progressive(
+        "guided", opt, ref, [&]() { trainGuide(tracer, guide, shape, trainSpp); },
+        [&](Film &f, uint32_t i) { tracer.renderPass(f, i); }));
+    tracer.guide = nullptr;
+
+    report("Path guiding: glass scene, lamp inside a glass globe", opt, results);
+    std::printf("  guide: %d spatial leaves after %d training iterations (%d spp)\n", guide.leafCount(),
+                guide.iterationCount(), (1 << guide.iterationCount()) - 1);
+}
+
+// Caustic photons against plain path tracing: the final scene's glass
+// spheres focusing the sun of the procedural sky onto the ground
+void benchCaustics(const Options &opt)
+{
+    Scene scene;
+    buildFinalScene(scene);
+    Environment sky;
+    buildSunSky(sky, 1024);
+    CpuTracer tracer(scene, &sky);
+    tracer.camera.origin = vec3(2.5f, 5.0f, 7.0f);
+    tracer.camera.lookAt = vec3(-0.3f, 0.4f, -0.8f);
+    tracer.camera.fov = 30.0f;
+    tracer.maxDepth = 10;
+    tracer.threadCount = opt.threads;
+    const int photons = 100000;
+
+    // Reference: the consistent (shrinking radius) photon estimate, many passes.
+    // Plain path tracing would need far more samples to resolve the sun caustics.
+    std::printf("caustics: reference at %d spp...\n", opt.refSpp);
+    std::fflush(stdout);
+    tracer.causticPhotons = photons;
+    Film refFilm;
+    refFilm.resize(opt.width, opt.height);
+    for (int i = 0; i < opt.refSpp; ++i) tracer.renderPass(refFilm, 2000000 + i);
+    std::vector<vec3> ref = refFilm.image();
+    if (opt.save)
+    {
+        writePfm("bench_caustics_reference.pfm", opt.width, opt.height, ref);
+        writePpm("bench_caustics_reference.ppm", opt.width, opt.height, ref);
+    }
+
+    std::vector<Result> results;
+    tracer.causticPhotons = 0;
+    results.push_back(progressive("path", opt, ref, nullptr, [&](Film &f, uint32_t i) { tracer.renderPass(f, i); }));
+    tracer.causticPhotons = photons;
+    results.push_back(progressive("photons", opt, ref, nullptr, [&](Film &f, uint32_t i) { tracer.renderPass(f, i); }));
+
+    char title[96];
+    std::snprintf(title, sizeof(title), "Caustic photons: final scene under a sun sky (%d photons per pass)", photons);
+    report(title, opt, results);
+}
+
+double meanLuminance(const std::vector<vec3> &img)
+{
+    double sum = 0.0;
+    for (const vec3 &c : img) sum += 0.2126 * c.x + 0.7152 * c.y + 0.0722 * c.z;
+    return sum / img.size();
+}
+
+// BDPT and path tracing must converge to the same image. A lamp in plain
+// view catches any strategy that counts the camera-to-emitter edge twice;
+// the globe in the glass scene hides exactly that case.
+void checkVisibleEmitter(const Options &opt)
+{
+    Scene scene;
+    scene.sky_intensity = 0.2f;
+    scene.addSphere(vec3(0.0f, -1000.0f, 0.0f), 1000.0f, MAT_LAMBERTIAN, vec3(0.5f, 0.5f, 0.5f));
+    scene.addSphere(vec3(0.0f, 1.0f, 0.0f), 1.0f, MAT_DIFFUSE_LIGHT, vec3(), 0.0f, 0.0f, vec3(4.0f, 4.0f, 4.0f));
+    scene.addSphere(vec3(2.2f, 0.7f, 0.5f), 0.7f, MAT_LAMBERTIAN, vec3(0.7f, 0.3f, 0.3f));
+    CpuTracer tracer(scene);
+    tracer.camera.origin = vec3(0.0f, 2.0f, 7.0f);
+    tracer.camera.lookAt = vec3(0.5f, 0.8f, 0.0f);
+    tracer.camera.fov = 40.0f;
+    tracer.maxDepth = 10;
+    tracer.threadCount = opt.threads;
+
+    const int spp = 64;
+    double mean[2];
+    const Integrator integrators[2] = {INTEGRATOR_PATH, INTEGRATOR_BDPT};
+    for (int k = 0; k < 2; ++k)
+    {
+        tracer.integrator = integrators[k];
+        Film film;
+        film.resize(opt.width, opt.height);
+        for (int i = 0; i < spp; ++i) tracer.renderPass(film, 3000000 + i);
+        mean[k] = meanLuminance(film.image());
+    }
+    double diff = (mean[1] - mean[0]) / mean[0];
+    std::printf("bdpt: visible lamp at %d spp, mean luminance path %.5f, bdpt %.5f (%+.3f%%)%s\n", spp, mean[0],
+                mean[1], 100.0 * diff, std::fabs(diff) > 0.02 ? "  MISMATCH" : "");
+    std::fflush(stdout);
+}
+
+// Bidirectional against unidirectional path tracing, lamp sealed in glass
+void benchBdpt(const Options &opt)
+{
+    checkVisibleEmitter(opt);
+
+    Scene scene;
+    buildGlassScene(scene);
+    CpuTracer tracer(scene);
+    glassCamera(tracer);
+    tracer.threadCount = opt.threads;
+
+    // The reference comes from the path tracer, so a BDPT bias shows up as
+    // error instead of being built into the target
+    std::printf("bdpt: reference at %d spp...\n", opt.refSpp);
+    std::fflush(stdout);
+    tracer.integrator = INTEGRATOR_PATH;
+    Film refFilm;
+    refFilm.resize(opt.width, opt.height);
+    for (int i = 0; i < opt.refSpp; ++i) tracer.renderPass(refFilm, 2000000 + i);
+    std::vector<vec3> ref = refFilm.image();
+    if (opt.save)
+    {
+        writePfm("bench_bdpt_reference.pfm", opt.width, opt.height, ref);
+        writePpm("bench_bdpt_reference.ppm", opt.width, opt.height, ref);
+    }
+
+    std::vector<Result> results;
+    tracer.integrator = INTEGRATOR_PATH;
+    results.push_back(progressive("path", opt, ref, nullptr, [&](Film &f, uint32_t i) { tracer.renderPass(f, i); }));
+    tracer.integrator = INTEGRATOR_BDPT;
+    results.push_back(progressive("bdpt", opt, ref, nullptr, [&](Film &f, uint32_t i) { tracer.renderPass(f, i); }));
+
+    report("BDPT: glass scene, lamp inside a glass globe", opt, results);
+}
+
+// Adaptive against uniform sampling on the final scene: sky and matte
+// pixels settle in a few samples, the glass and metal spheres need many
+void benchAdaptive(const Options &opt)
+{
+    Scene scene;
+    buildFinalScene(scene);
+    CpuTracer tracer(scene);
+    tracer.camera.origin = vec3(13.0f, 2.0f, 3.0f);
+    tracer.camera.lookAt = vec3(0.0f, 0.0f, 0.0f);
+    tracer.camera.fov = 20.0f;
+    tracer.maxDepth = 10;
+    tracer.threadCount = opt.threads;
+
+    std::printf("adaptive: reference at %d spp...\n", opt.refSpp);
+    std::fflush(stdout);
+    Film refFilm;
+    refFilm.resize(opt.width, opt.height);
+    for (int i = 0; i < opt.refSpp; ++i) tracer.renderPass(refFilm, 2000000 + i);
+    std::vector<vec3> ref = refFilm.image();
+    if (opt.save)
+    {
+        writePfm("bench_adaptive_reference.pfm", opt.width, opt.height, ref);
+        writePpm("bench_adaptive_reference.ppm", opt.width, opt.height, ref);
+    }
+
+    std::vector<Result> results;
+    results.push_back(progressive("uniform", opt, ref, nullptr, [&](Film &f, uint32_t i) { tracer.renderPass(f, i); }));
+    // Per-pixel errors below the target, so the mean gets there too
+    tracer.adaptiveThreshold = 0.5f * opt.target;
+    results.push_back(progressive("adaptive", opt, ref, nullptr, [&](Film &f, uint32_t i) { tracer.renderPass(f, i); }));
+    tracer.adaptiveThreshold = 0.0f;
+
+    report("Adaptive sampling: final scene", opt, results);
+}
+
+// Foveated against full-rate sampling on the final scene over the same
+// number of frames: rays per frame, and the error inside the full-rate
+// radius and outside it. The foveated frames trace only the pixels the
+// shader's pattern would, through film.active.
+void benchFoveated(const Options &opt)
+{
+    const int FRAMES = 64;
+    Scene scene;
+    buildFinalScene(scene);
+    CpuTracer tracer(scene);
+    tracer.camera.origin = vec3(13.0f, 2.0f, 3.0f);
+    tracer.camera.lookAt = vec3(0.0f, 0.0f, 0.0f);
+    tracer.camera.fov = 20.0f;
+    tracer.maxDepth = 10;
+    tracer.threadCount = opt.threads;
+
+    std::printf("foveated: reference at %d spp...\n", opt.refSpp);
+    std::fflush(stdout);
+    Film refFilm;
+    refFilm.resize(opt.width, opt.height);
+    for (int i = 0; i < opt.refSpp; ++i) tracer.renderPass(refFilm, 3000000 + i);
+    std::vector<vec3> ref = refFilm.image();
+
+    Foveation fovea;
+    fovea.enabled = true;
+    std::vector<uint8_t> inner(ref.size());
+    for (int y = 0; y < opt.height; ++y)
+        for (int x = 0; x < opt.width; ++x)
+            inner[(size_t)y * opt.width + x] =
+                foveaRate(fovea, x / FOVEA_TILE, y / FOVEA_TILE, opt.width, opt.height) == 1;
+
+    std::printf("\nFoveated sampling: final scene (%dx%d, %d frames, full rate within %.2f of the height)\n",
+                opt.width, opt.height, FRAMES, fovea.radius);
+    std::printf("  %-14s %14s %10s %16s %16s\n", "method", "rays/frame", "time", "relMSE fovea", "relMSE outside");
+    double fullRays = 0.0;
+    for (int foveated = 0; foveated < 2; ++foveated)
+    {
+        Film film;
+        film.resize(opt.width, opt.height);
+        size_t rays = 0;
+        double start = seconds();
+        for (int i = 0; i < FRAMES; ++i)
+        {
+            if (foveated)
+            {
+                film.active.clear();
+                for (int y = 0; y < opt.height; ++y)
+                    for (int x = 0; x < opt.width; ++x)
+                        if (foveaTraced(fovea, x, y, opt.width, opt.height, (uint32_t)i))
+                            film.active.push_back((uint32_t)((size_t)y * opt.width + x));
+            }
+            rays += film.active.size();
+            tracer.renderPass(film, (uint32_t)i);
+        }
+        double elapsed = seconds() - start;
+
+        std::vector<vec3> img = film.image();
+        std::vector<vec3> parts[2][2]; // [outside/inside][image/reference]
+        for (size_t i = 0; i < img.size(); ++i)
+        {
+            parts[inner[i]][0].push_back(img[i]);
+            parts[inner[i]][1].push_back(ref[i]);
+        }
+        double perFrame = (double)rays / FRAMES;
+        if (!foveated) fullRays = perFrame;
+        std::printf("  %-14s %14.0f %8.2f s %16.5f %16.5f\n", foveated ? "foveated" : "full rate", perFrame, elapsed,
+                    relativeMse(parts[1][0], parts[1][1]), relativeMse(parts[0][0], parts[0][1]));
+        if (foveated)
+            std::printf("  rays per frame saved: %.0f (%.1f%%; the formula gives %.1f%%)\n", fullRays - perFrame,
+                        100.0 * (1.0 - perFrame / fullRays),
+                        100.0 * (1.0 - foveaTracedFraction(fovea, opt.width, opt.height)));
+        if (opt.save)
+        {
+            std::string name = foveated ? "bench_foveated" : "bench_full_rate";
+            writePpm(name + ".ppm", opt.width, opt.height, img);
+        }
+    }
+}
+
+struct Benchmark
+{
+    const char *name;
+    void (*run)(const Options &);
+};
+
+const Benchmark BENCHMARKS[] = {
+    {"guiding", benchGuiding},
+    {"caustics", benchCaustics},
+    {"bdpt", benchBdpt},
+    {"adaptive", benchAdaptive},
+    {"foveated", benchFoveated},
+};
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+    std::vector<std::string> names;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string a = argv[i];
+        if (a == "--size" && i + 1 < argc)
+            std::sscanf(argv[++i], "%dx%d", &opt.width, &opt.height);
+        else if (a == "--ref-spp" && i + 1 < argc)
+            opt.refSpp = std::atoi(argv[++i]);
+        else if (a == "--target" && i + 1 < argc)
+            opt.target = (float)std::atof(argv[++i]);
+        else if (a == "--limit" && i + 1 < argc)
+            opt.limit = std::atof(argv[++i]);
+        else if (a == "--threads" && i + 1 < argc)
+            opt.threads = std::atoi(argv[++i]);
+        else if (a == "--save")
+            opt.save = true;
+        else if (a.rfind("--", 0) == 0)
+        {
+            std::fprintf(stderr, "unknown option %s\n", a.c_str());
+            return 1;
+        }
+        else
+            names.push_back(a);
+    }
+
+    bool ran = false;
+    for (const Benchmark &b : BENCHMARKS)
+    {
+        bool wanted = names.empty();
+        for (const std::string &n : names) wanted = wanted || n == b.name;
+        if (!wanted) continue;
+        b.run(opt);
+        ran = true;
+    }
+    if (!ran)
+    {
+        std::fprintf(stderr, "no such benchmark; available:");
+        for (const Benchmark &b : BENCHMARKS) std::fprintf(stderr, " %s", b.name);
+        std::fprintf(stderr, "\n");
+        return 1;
+    }
+    return 0;
+}